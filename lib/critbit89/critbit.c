@@ -31,6 +31,10 @@ typedef struct {
 	uint8_t otherbits;
 } cb_node_t;
 
+/* Offset of the data stored after a string of the given length */
+#define CBT_DATA_OFFSET(len) \
+	(((len) + sizeof(void *)) & ~(sizeof(void *) - 1))
+
 
 /* Standard memory allocation functions */
 static void *malloc_align_std(size_t alignment, size_t size, void *baton) {
@@ -132,8 +136,9 @@ int cb_tree_contains(cb_tree_t *tree, const char *str)
 	return (strcmp(str, (const char *)p) == 0);
 }
 
-/*! Inserts str into tree, returns 0 on suceess */
-int cb_tree_insert(cb_tree_t *tree, const char *str)
+/* Inserts str along with size bytes of data into tree */
+static int cbt_insert(cb_tree_t *tree, const char *str, size_t size,
+	void **data)
 {
 	const uint8_t *const ubytes = (void *)str;
 	const size_t ulen = strlen(str);
@@ -144,13 +149,18 @@ int cb_tree_insert(cb_tree_t *tree, const char *str)
 	int direction, newdirection;
 	cb_node_t *newnode;
 	void **wherep;
+	const size_t leafsize =
+		(size > 0 ? CBT_DATA_OFFSET(ulen) + size : ulen + 1);
 
 	if (p == NULL) {
-		x = (tree->malloc_align)(sizeof(void *), ulen + 1, tree->baton);
+		x = (tree->malloc_align)(sizeof(void *), leafsize, tree->baton);
 		if (x == NULL) {
 			return ENOMEM;
 		}
 		memcpy(x, str, ulen + 1);
+		if (size > 0) {
+			*data = memset(x + CBT_DATA_OFFSET(ulen), 0, size);
+		}
 		tree->root = x;
 		return 0;
 	}
@@ -177,6 +187,9 @@ int cb_tree_insert(cb_tree_t *tree, const char *str)
 		newotherbits = p[newbyte];
 		goto different_byte_found;
 	}
+	if (size > 0) {
+		*data = p + CBT_DATA_OFFSET(ulen);
+	}
 	return 1;
 
 different_byte_found:
@@ -193,13 +206,16 @@ different_byte_found:
 		return ENOMEM;
 	}
 
-	x = (tree->malloc_align)(sizeof(void *), ulen + 1, tree->baton);
+	x = (tree->malloc_align)(sizeof(void *), leafsize, tree->baton);
 	if (x == NULL) {
 		(tree->free)(newnode, tree->baton);
 		return ENOMEM;
 	}
 
 	memcpy(x, ubytes, ulen + 1);
+	if (size > 0) {
+		*data = memset(x + CBT_DATA_OFFSET(ulen), 0, size);
+	}
 	newnode->byte = newbyte;
 	newnode->otherbits = newotherbits;
 	newnode->child[1 - newdirection] = x;
@@ -234,6 +250,55 @@ different_byte_found:
 	return 0;
 }
 
+/*! Inserts str into tree, returns 0 on suceess */
+int cb_tree_insert(cb_tree_t *tree, const char *str)
+{
+	return cbt_insert(tree, str, 0, NULL);
+}
+
+/*! Inserts str into tree along with size bytes of zero-initialized data */
+int cb_tree_insert_data(cb_tree_t *tree, const char *str, size_t size,
+	void **data)
+{
+	return cbt_insert(tree, str, size, data);
+}
+
+/*! Returns the data stored along with str, or NULL */
+void *cb_tree_get_data(cb_tree_t *tree, const char *str)
+{
+	const uint8_t *ubytes = (void *)str;
+	const size_t ulen = strlen(str);
+	uint8_t *p = tree->root;
+
+	if (p == NULL) {
+		return NULL;
+	}
+
+	while (1 & (intptr_t)p) {
+		cb_node_t *q = (void *)(p - 1);
+		uint8_t c = 0;
+		int direction;
+
+		if (q->byte < ulen) {
+			c = ubytes[q->byte];
+		}
+		direction = (1 + (q->otherbits | c)) >> 8;
+
+		p = q->child[direction];
+	}
+
+	if (strcmp(str, (const char *)p) != 0) {
+		return NULL;
+	}
+	return p + CBT_DATA_OFFSET(ulen);
+}
+
+/*! Returns the data stored along with a string that is part of a tree */
+void *cb_tree_data(const char *str)
+{
+	return (char *)str + CBT_DATA_OFFSET(strlen(str));
+}
+
 /*! Deletes str from the tree, returns 0 on suceess */
 int cb_tree_delete(cb_tree_t *tree, const char *str)
 {
@@ -317,3 +382,56 @@ int cb_tree_walk_prefixed(cb_tree_t *tree, const char *prefix,
 
 	return cbt_traverse_prefixed(top, callback, baton);
 }
+
+/*! Deletes all strings with the given prefix, returns 0 on success */
+int cb_tree_delete_prefixed(cb_tree_t *tree, const char *prefix)
+{
+	const uint8_t *ubytes = (void *)prefix;
+	const size_t ulen = strlen(prefix);
+	uint8_t *p = tree->root;
+	uint8_t *top = p;
+	void **wherep = &tree->root, **whereq = 0;
+	cb_node_t *q = 0;
+	int direction = 0;
+
+	if (p == NULL) {
+		return 1;
+	}
+
+	while (1 & (intptr_t)p) {
+		cb_node_t *r = (void *)(p - 1);
+		void **wherer = wherep;
+		uint8_t c = 0;
+		int rdirection;
+
+		if (r->byte < ulen) {
+			c = ubytes[r->byte];
+		}
+		rdirection = (1 + (r->otherbits | c)) >> 8;
+
+		wherep = r->child + rdirection;
+		p = *wherep;
+		if (r->byte < ulen) {
+			/* Remember the parent of the subtree */
+			top = p;
+			q = r;
+			whereq = wherer;
+			direction = rdirection;
+		}
+	}
+
+	/* All strings below top share their first ulen bytes */
+	if (strncmp(prefix, (const char *)p, ulen) != 0) {
+		return 1;
+	}
+	cbt_traverse_delete(tree, top);
+
+	if (!whereq) {
+		tree->root = NULL;
+		return 0;
+	}
+
+	*whereq = q->child[1 - direction];
+	(tree->free)(q, tree->baton);
+	return 0;
+}
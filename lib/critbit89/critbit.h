@@ -31,6 +31,19 @@ extern int cb_tree_contains(cb_tree_t *tree, const char *str);
 /*! Inserts str into tree, returns 0 on suceess */
 extern int cb_tree_insert(cb_tree_t *tree, const char *str);
 
+/*! Inserts str into tree along with size bytes of zero-initialized data.
+ *  Returns 0 on success and 1 if str is already present. In both cases,
+ *  *data will point to the data stored along with str */
+extern int cb_tree_insert_data(cb_tree_t *tree, const char *str, size_t size,
+	void **data);
+
+/*! Returns the data stored along with str, or NULL if str is not present */
+extern void *cb_tree_get_data(cb_tree_t *tree, const char *str);
+
+/*! Returns the data stored along with a string that is part of a tree,
+ *  e.g. one passed to the callback of cb_tree_walk_prefixed() */
+extern void *cb_tree_data(const char *str);
+
 /*! Deletes str from the tree, returns 0 on suceess */
 extern int cb_tree_delete(cb_tree_t *tree, const char *str);
 
@@ -41,6 +54,9 @@ extern void cb_tree_clear(cb_tree_t *tree);
 extern int cb_tree_walk_prefixed(cb_tree_t *tree, const char *prefix,
 	int (*callback)(const char *, void *), void *baton);
 
+/*! Deletes all strings with the given prefix, returns 0 on success */
+extern int cb_tree_delete_prefixed(cb_tree_t *tree, const char *prefix);
+
 
 #ifdef __cplusplus
 }
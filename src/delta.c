@@ -21,6 +21,10 @@
  */
 
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <svn_delta.h>
 #include <svn_io.h>
 #include <svn_md5.h>
@@ -32,32 +36,58 @@
 #include <apr_file_io.h>
 #include <apr_hash.h>
 #include <apr_md5.h>
+#if APR_HAS_THREADS
+	#include <apr_allocator.h>
+	#include <apr_thread_cond.h>
+	#include <apr_thread_mutex.h>
+	#include <apr_thread_pool.h>
+#endif
 
 #include "main.h"
 #include "dump.h"
 #include "log.h"
 #include "logger.h"
+#include "output.h"
 #include "path_repo.h"
 #include "property.h"
-#include "rhash.h"
 #include "session.h"
+#include "state.h"
+#include "text_store.h"
 #include "utils.h"
 
 #include "delta.h"
 
+#include "critbit89/critbit.h"
+
 /* This is for compabibility for Subverison 1.4 */
 #if (SVN_VER_MAJOR==1) && (SVN_VER_MINOR<=5)
  #define SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5 SVN_REPOS_DUMPFILE_TEXT_CONTENT_CHECKSUM
+ #define SVN_REPOS_DUMPFILE_TEXT_COPY_SOURCE_MD5 SVN_REPOS_DUMPFILE_TEXT_COPY_SOURCE_CHECKSUM
 #endif
 
-#define ERRBUFFER_SIZE 512
-
 
 /*---------------------------------------------------------------------------*/
 /* Local data structures                                                     */
 /*---------------------------------------------------------------------------*/
 
 
+/* Local state of a file */
+typedef struct {
+	unsigned char text[APR_MD5_DIGESTSIZE];  /* Reference into the text store */
+	unsigned char md5sum[APR_MD5_DIGESTSIZE];
+	svn_revnum_t changed;  /* Last global revision touching the file, 0 if unknown */
+	char has_text;
+	char has_md5sum;
+} de_file_state_t;
+
+
+/* Baton for saving the file table to a state file */
+typedef struct {
+	state_file_t *sf;
+	int err;
+} de_save_baton_t;
+
+
 /* Copy info enumeration */
 typedef enum {
 	CPI_NONE = 0x01,
@@ -67,18 +97,78 @@ typedef enum {
 } cp_info_t;
 
 
+/*
+ * Dump state shared by all revisions. If the dump output is not using
+ * deltas, we need to keep a local copy of every file in the repository.
+ * The file table maps repository paths to the local state of the respective
+ * files, i.e. their texts and the md5-sums of their contents. It is ordered
+ * by path, so all files below a deleted directory can be found without
+ * visiting any other file. The texts themselves are kept in the text store,
+ * which stores identical texts only once.
+ */
+struct delta_context_t {
+	char              file_table_created;
+	cb_tree_t         file_table;
+	text_store_t      *text_store;
+
+	/*
+	 * When checkpointing the dump state, the texts referenced by the last
+	 * checkpoint must survive until the next one, so the text store has to
+	 * defer the removal of pack files.
+	 */
+	char              defer_removal;
+
+#if APR_HAS_THREADS
+	/*
+	 * In --deltas mode, texts that can't be dumped using the svndiff sent by
+	 * the server are deltified on a pool of worker threads as soon as they
+	 * have been received. The results are collected while dumping the nodes.
+	 */
+	apr_pool_t        *worker_pool;
+	apr_pool_t        *job_pool;   /* Parent of the job pools, thread-safe */
+	apr_thread_pool_t *workers;
+	apr_thread_mutex_t *workers_mutex;
+	apr_thread_cond_t *workers_cond;
+#endif
+};
+
+
+#if APR_HAS_THREADS
+
+/* A deltification running on the worker pool */
+typedef struct {
+	delta_context_t *ctx;
+	dump_options_t *opts;
+	svn_stream_t *source;
+	svn_stream_t *target;
+	apr_file_t *file;
+	char *filename;
+	char *svndiff_path;  /* Converts this svndiff instead of deltifying */
+	char from_old_text;  /* Based on the previous text instead of an empty one */
+	char done;
+	svn_error_t *err;
+	apr_pool_t *pool;
+} de_deltify_job_t;
+
+#endif /* APR_HAS_THREADS */
+
+
 /* Main delta editor baton */
 typedef struct {
+	delta_context_t   *ctx;
 	session_t         *session;
 	dump_options_t    *opts;
 	apr_array_header_t *logs;
 	log_revision_t    *log_revision;
 	apr_pool_t        *revision_pool;
 	apr_hash_t        *dumped_entries;
+	apr_hash_t        *flagged_entries; /* Dumped nodes that have been deleted or are part of a failed copy */
+	apr_hash_t        *links; /* Copied files reported as present, value is the source md5-sum */
 	svn_revnum_t      local_revnum;
 	void              *root_node;
 	path_repo_t       *path_repo;
 	property_storage_t *prop_store;
+	output_t          *output;
 } de_baton_t;
 
 
@@ -87,40 +177,67 @@ typedef struct {
 	de_baton_t        *de_baton;
 	apr_pool_t        *pool;
 	const char        *path;
-	char              *filename;
-	char              *old_filename;
+	unsigned char     old_text[APR_MD5_DIGESTSIZE];
+	char              has_old_text;
 	char              *delta_filename;
 	char              action;
 	svn_node_kind_t   kind;
-	apr_hash_t        *properties;
-	apr_hash_t        *del_properties; /* Value is always 0x1 */
+	apr_hash_t        *properties;     /* Created on demand */
+	apr_hash_t        *del_properties; /* Created on demand, value is always 0x1 */
 	unsigned char     md5sum[APR_MD5_DIGESTSIZE];
 	char              *copyfrom_path;
 	svn_revnum_t      copyfrom_revision;
 	svn_revnum_t      copyfrom_rev_local;
+	unsigned char     *copyfrom_md5sum; /* Only set if known to match copyfrom_revision */
 	cp_info_t         cp_info;
 	char              applied_delta;
+	char              svndiff_from_empty; /* Incoming svndiff has an empty base */
+	char              *svndiff_filename; /* Incoming svndiff (DF_USE_DELTAS) */
+	char              svndiff_raw;       /* Incoming svndiff is still uncompressed */
 	char              dump_needed;
 	char              props_changed;
+#if APR_HAS_THREADS
+	de_deltify_job_t  *deltify_job;
+#endif
 	void              *parent;
-	apr_array_header_t *children;
+	void              *first_child;
+	void              *last_child;
+	void              *next_sibling;
 } de_node_baton_t;
 
 
+/* Baton for removing the files below a deleted path */
+typedef struct {
+	de_node_baton_t *node;
+	const char *prefix;
+	size_t prefix_len;
+	apr_pool_t *pool;
+} de_delete_baton_t;
+
+
+/* Baton for delta_store_window() */
+typedef struct {
+	svn_txdelta_window_handler_t apply_handler;
+	void              *apply_baton;
+	de_node_baton_t   *node;
+	text_writer_t     *writer;
+} de_text_baton_t;
+
+
+/* Baton for delta_tee_window() */
+typedef struct {
+	svn_txdelta_window_handler_t apply_handler;
+	void              *apply_baton;
+	svn_txdelta_window_handler_t svndiff_handler;
+	void              *svndiff_baton;
+} de_tee_baton_t;
+
+
 /*---------------------------------------------------------------------------*/
 /* Static variables                                                          */
 /*---------------------------------------------------------------------------*/
 
 
-/*
- * If the dump output is not using deltas, we need to keep a local copy of
- * every file in the repository. The delta_hash hash defines a mapping of
- * repository paths to temporary files for this purpose. The md5_hash is
- * used to store the md5-sums of the file contents.
- */
-static char hashes_created = 0;
-static rhash_t *delta_hash = NULL;
-static rhash_t *md5_hash = NULL;
 #ifdef USE_TIMING
  static float tm_de_apply_textdelta = 0.0f;
 #endif
@@ -135,32 +252,91 @@ static rhash_t *md5_hash = NULL;
 static svn_error_t *delta_dump_node(de_node_baton_t *node);
 
 
-/* Creates a new node baton */
-static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *parent)
+/* Creates the file table and text store of a context if needed */
+static void delta_create_file_table(delta_context_t *ctx, dump_options_t *opts, apr_pool_t *pool)
 {
-	de_node_baton_t *node = apr_palloc(parent->pool, sizeof(de_node_baton_t));
-	node->pool = svn_pool_create(parent->pool);
-	node->path = apr_pstrdup(node->pool, path);
-	node->de_baton = parent->de_baton;
-	node->properties = apr_hash_make(node->pool);
-	node->del_properties = apr_hash_make(node->pool);
-	node->filename = NULL;
-	node->old_filename = NULL;
-	node->delta_filename = NULL;
-	node->cp_info = parent->cp_info;
-	node->copyfrom_path = NULL;
-	node->copyfrom_revision = 0;
-	node->applied_delta = 0;
-	node->dump_needed = 0;
-	node->props_changed = 0;
-	node->parent = parent;
-	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
-	memset(node->md5sum, 0x00, sizeof(node->md5sum));
+	if (!ctx->file_table_created) {
+		ctx->file_table = cb_tree_make();
+		ctx->text_store = text_store_create(apr_psprintf(pool, "%s/td", opts->temp_dir), (apr_size_t)opts->small_text_size, pool);
+		if (ctx->defer_removal) {
+			text_store_defer_removal(ctx->text_store);
+		}
+		ctx->file_table_created = 1;
+	}
+}
 
-	/* Register node in parent list */
-	APR_ARRAY_PUSH(parent->children, de_node_baton_t *) = node;
 
-	return node;
+/* Returns the local state of a file, optionally creating a new one.
+   Returns NULL if there is no state or a new one can't be created */
+static de_file_state_t *delta_file_state(delta_context_t *ctx, const char *path, char create)
+{
+	void *state = NULL;
+
+	if (!create) {
+		return cb_tree_get_data(&ctx->file_table, path);
+	}
+	if (cb_tree_insert_data(&ctx->file_table, path, sizeof(de_file_state_t), &state) == ENOMEM) {
+		return NULL;
+	}
+	return state;
+}
+
+
+/* Sets the text of a file, which may be NULL. The caller must take care
+   of the reference to the previous text. Returns -1 on error */
+static int delta_set_text(delta_context_t *ctx, const char *path, const unsigned char *text)
+{
+	de_file_state_t *state = delta_file_state(ctx, path, (text != NULL));
+
+	if (state == NULL) {
+		return (text != NULL ? -1 : 0);
+	}
+	if (text != NULL) {
+		memcpy(state->text, text, APR_MD5_DIGESTSIZE);
+		state->has_text = 1;
+	} else if (!state->has_md5sum) {
+		cb_tree_delete(&ctx->file_table, path);
+	} else {
+		state->has_text = 0;
+	}
+	return 0;
+}
+
+
+/* Sets the md5-sum of a file, which may be NULL. Returns -1 on error */
+static int delta_set_md5sum(delta_context_t *ctx, const char *path, const unsigned char *md5sum)
+{
+	de_file_state_t *state = delta_file_state(ctx, path, (md5sum != NULL));
+
+	if (state == NULL) {
+		return (md5sum != NULL ? -1 : 0);
+	}
+	if (md5sum != NULL) {
+		memcpy(state->md5sum, md5sum, APR_MD5_DIGESTSIZE);
+		state->has_md5sum = 1;
+	} else if (!state->has_text) {
+		cb_tree_delete(&ctx->file_table, path);
+	} else {
+		state->has_md5sum = 0;
+	}
+	return 0;
+}
+
+
+/* Writes a file table entry to a state file */
+static int delta_save_file_state_cb(const char *path, void *baton)
+{
+	de_save_baton_t *sb = (de_save_baton_t *)baton;
+	de_file_state_t *state = cb_tree_data(path);
+
+	if (state_write_string(sb->sf, path) != 0
+		|| state_write_data(sb->sf, state->text, (state->has_text ? APR_MD5_DIGESTSIZE : -1)) != 0
+		|| state_write_data(sb->sf, state->md5sum, (state->has_md5sum ? APR_MD5_DIGESTSIZE : -1)) != 0
+		|| state_write_int(sb->sf, state->changed) != 0) {
+		sb->err = 1;
+		return 1;
+	}
+	return 0;
 }
 
 
@@ -168,35 +344,112 @@ static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *par
 static de_node_baton_t *delta_create_node_no_parent(const char *path, de_baton_t *de_baton, apr_pool_t *pool)
 {
 	de_node_baton_t *node = apr_palloc(pool, sizeof(de_node_baton_t));
-	node->pool = svn_pool_create(pool);
+	node->pool = pool;
 	node->path = apr_pstrdup(node->pool, path);
 	node->de_baton = de_baton;
-	node->properties = apr_hash_make(node->pool);
-	node->del_properties = apr_hash_make(node->pool);
-	node->filename = NULL;
-	node->old_filename = NULL;
+	node->properties = NULL;
+	node->del_properties = NULL;
+	node->has_old_text = 0;
 	node->delta_filename = NULL;
 	node->cp_info = CPI_NONE;
 	node->copyfrom_path = NULL;
+	node->copyfrom_revision = 0;
+	node->copyfrom_md5sum = NULL;
 	node->applied_delta = 0;
+	node->svndiff_from_empty = 0;
+	node->svndiff_filename = NULL;
+	node->svndiff_raw = 0;
 	node->dump_needed = 0;
 	node->props_changed = 0;
+#if APR_HAS_THREADS
+	node->deltify_job = NULL;
+#endif
 	node->parent = NULL;
-	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
+	node->first_child = NULL;
+	node->last_child = NULL;
+	node->next_sibling = NULL;
 	memset(node->md5sum, 0x00, sizeof(node->md5sum));
 
 	return node;
 }
 
 
+/* Creates a new node baton */
+static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *parent)
+{
+	de_node_baton_t *node = delta_create_node_no_parent(path, parent->de_baton, parent->pool);
+	node->cp_info = parent->cp_info;
+	node->parent = parent;
+
+	/* Register node in parent list */
+	if (parent->last_child != NULL) {
+		((de_node_baton_t *)parent->last_child)->next_sibling = node;
+	} else {
+		parent->first_child = node;
+	}
+	parent->last_child = node;
+
+	return node;
+}
+
+
+/* Returns the properties of a node, which are created on demand */
+static apr_hash_t *delta_node_props(de_node_baton_t *node)
+{
+	if (node->properties == NULL) {
+		node->properties = apr_hash_make(node->pool);
+	}
+	return node->properties;
+}
+
+
+/* Checks if a property of a node has been deleted */
+static char delta_prop_deleted(de_node_baton_t *node, const char *name)
+{
+	return (node->del_properties != NULL && apr_hash_get(node->del_properties, name, APR_HASH_KEY_STRING) != NULL);
+}
+
+
+/* Saves the properties of a node to the property storage */
+static int delta_store_props(de_node_baton_t *node, apr_pool_t *pool)
+{
+	if (node->properties == NULL) {
+		return property_delete(node->de_baton->prop_store, node->path, pool);
+	}
+	return property_store(node->de_baton->prop_store, node->path, node->properties, pool);
+}
+
+
+/* Saves the md5-sum of a file node if its contents are known. This
+   must be done for every node whose text has been applied, regardless
+   of whether it is dumped, in order to get the same results when
+   starting in the middle of the history. */
+static svn_error_t *delta_remember_md5(de_node_baton_t *node)
+{
+	if (node->kind == svn_node_file && node->applied_delta) {
+		if (delta_set_md5sum(node->de_baton->ctx, node->path, node->md5sum) != 0) {
+			return svn_error_createf(1, NULL, _("Unable to update the local state of %s"), node->path);
+		}
+		DEBUG_MSG("file_table += %s : %s\n", node->path, svn_md5_digest_to_cstring(node->md5sum, node->pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
 /* Marks a node as being dumped, i.e. set dump_needed to 0 */
-static void delta_mark_node(de_node_baton_t *node)
+static svn_error_t *delta_mark_node(de_node_baton_t *node)
 {
+	svn_error_t *err;
 	de_baton_t *de_baton = node->de_baton;
 	apr_hash_set(de_baton->dumped_entries, node->path, APR_HASH_KEY_STRING, node);
-	if (node->kind == svn_node_file) {
-		rhash_set(md5_hash, node->path, APR_HASH_KEY_STRING, node->md5sum, APR_MD5_DIGESTSIZE);
-		DEBUG_MSG("md5_hash += %s : %s\n", node->path, svn_md5_digest_to_cstring(node->md5sum, node->pool));
+	if (node->action == 'D' || (node->cp_info & CPI_FAILED)) {
+		apr_hash_set(de_baton->flagged_entries, node->path, APR_HASH_KEY_STRING, node);
+	} else {
+		/* A path that has been deleted and added again is valid again */
+		apr_hash_set(de_baton->flagged_entries, node->path, APR_HASH_KEY_STRING, NULL);
+	}
+	if ((err = delta_remember_md5(node))) {
+		return err;
 	}
 	node->dump_needed = 0;
 
@@ -207,6 +460,31 @@ static void delta_mark_node(de_node_baton_t *node)
 			L1(_("done.\n"));
 		}
 	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns the nearest parent of the given path that has been dumped as being
+   deleted or as part of a failed copy, or NULL. The parents are looked up
+   using prefixes of the path itself, so nothing needs to be allocated */
+static de_node_baton_t *delta_flagged_parent(de_baton_t *de_baton, const char *path)
+{
+	apr_ssize_t len;
+
+	if (apr_hash_count(de_baton->flagged_entries) == 0) {
+		return NULL;
+	}
+
+	len = (apr_ssize_t)strlen(path);
+	while (--len > 0) {
+		if (path[len] == '/') {
+			de_node_baton_t *node = apr_hash_get(de_baton->flagged_entries, path, len);
+			if (node != NULL) {
+				return node;
+			}
+		}
+	}
+	return NULL;
 }
 
 
@@ -269,6 +547,79 @@ static char delta_check_copy(de_node_baton_t *node)
 }
 
 
+/* Returns the local state of the source of a copied file if it is known to
+   match the copy revision and the copy can be dumped as such */
+static de_file_state_t *delta_link_source(de_baton_t *de_baton, const char *path, svn_log_changed_path_t *log, apr_pool_t *pool)
+{
+	session_t *session = de_baton->session;
+	dump_options_t *opts = de_baton->opts;
+	const char *copyfrom_path;
+	de_file_state_t *state;
+	char *parent;
+
+	if (log->action != 'A' || log->copyfrom_path == NULL) {
+		return NULL;
+	}
+
+	/* The copy source must be reachable (see delta_check_copy()) */
+	if ((copyfrom_path = delta_get_local_copyfrom_path(session->prefix, log->copyfrom_path)) == NULL) {
+		return NULL;
+	}
+	if ((strlen(session->prefix) > 0) || ((opts->start != 0) && !(opts->flags & DF_INCREMENTAL))) {
+		if (!(opts->flags & DF_INCREMENTAL) && (opts->start > log->copyfrom_rev)) {
+			return NULL;
+		}
+		if (delta_get_local_copyfrom_rev(log->copyfrom_rev, opts, de_baton->logs, de_baton->local_revnum) <= 0) {
+			return NULL;
+		}
+	}
+
+	/* The local copy of the source must not have been changed since */
+	state = delta_file_state(de_baton->ctx, copyfrom_path, 0);
+	if (state == NULL || !state->has_text || !state->has_md5sum || state->changed <= 0 || state->changed > log->copyfrom_rev) {
+		return NULL;
+	}
+
+	/* The copy destination must not be present yet, but its parent must */
+	if (delta_file_state(de_baton->ctx, path, 0) != NULL) {
+		return NULL;
+	}
+	parent = svn_path_dirname(path, pool);
+	while (parent && *parent) {
+		svn_log_changed_path_t *plog = apr_hash_get(de_baton->log_revision->changed_paths, parent, APR_HASH_KEY_STRING);
+		if (plog != NULL && (plog->action == 'A' || plog->action == 'R')) {
+			return NULL;
+		}
+		parent = svn_path_dirname(parent, pool);
+	}
+	return state;
+}
+
+
+/* Sets up a node for a copied file that has been reported to the server as
+   being present already */
+static svn_error_t *delta_setup_link(de_node_baton_t *node, unsigned char *copyfrom_md5sum)
+{
+	svn_log_changed_path_t *log = apr_hash_get(node->de_baton->log_revision->changed_paths, node->path, APR_HASH_KEY_STRING);
+
+	node->kind = svn_node_file;
+	node->action = 'A';
+	node->cp_info = CPI_NONE;
+	node->copyfrom_path = apr_pstrdup(node->pool, log->copyfrom_path);
+	node->copyfrom_revision = log->copyfrom_rev;
+	node->copyfrom_md5sum = copyfrom_md5sum;
+	node->dump_needed = 1;
+
+	/* Unless a new text is applied, the text is the one of the source */
+	memcpy(node->md5sum, copyfrom_md5sum, APR_MD5_DIGESTSIZE);
+
+	if (path_repo_add(node->de_baton->path_repo, node->path, node->pool) != 0) {
+		return svn_error_createf(1, NULL, _("Unable to update local tree history"));
+	}
+	return SVN_NO_ERROR;
+}
+
+
 /* Checks if a 'modify' or 'replace' action should be replaced by an 'add' action */
 static svn_error_t *delta_check_action(de_node_baton_t *node)
 {
@@ -453,35 +804,262 @@ static svn_error_t *delta_propagate_copy(de_node_baton_t *parent, de_node_baton_
 }
 
 
-/* Deltifies a node, i.e. generates a svndiff that can be dumped */
-static svn_error_t *delta_deltify_node(de_node_baton_t *node)
+/* Sets up a window handler that writes svndiff data in the selected format */
+static void delta_svndiff_handler(dump_options_t *opts, svn_stream_t *output, svn_txdelta_window_handler_t *handler, void **handler_baton, apr_pool_t *pool)
+{
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 7)
+	svn_txdelta_to_svndiff3(handler, handler_baton, output, opts->delta_format, opts->delta_compression, pool);
+#else
+	svn_txdelta_to_svndiff2(handler, handler_baton, output, opts->delta_format, pool);
+#endif
+}
+
+
+/* Checks whether the svndiff received from the server can be dumped as-is */
+static char delta_svndiff_usable(de_node_baton_t *node)
+{
+	if (node->svndiff_filename == NULL) {
+		return 0;
+	}
+
+	/*
+	 * Deltas against an empty base don't refer to any source data and are
+	 * thus valid for any base. Otherwise, the delta base of the server is
+	 * the previous version of the file, which is only the same as the
+	 * base in the dump if the file is being changed.
+	 */
+	return (node->svndiff_from_empty || node->action == 'M');
+}
+
+
+/* Writes a delta between two texts in svndiff format to a file */
+static svn_error_t *delta_write_svndiff(dump_options_t *opts, svn_stream_t *source, svn_stream_t *target, apr_file_t *file, apr_pool_t *pool)
 {
 	svn_txdelta_stream_t *stream;
 	svn_txdelta_window_handler_t handler;
 	void *handler_baton;
-	svn_stream_t *source, *target, *dest;
-	apr_file_t *source_file = NULL, *target_file = NULL, *dest_file = NULL;
+
+	svn_txdelta(&stream, source, target, pool);
+	delta_svndiff_handler(opts, svn_stream_from_aprfile2(file, FALSE, pool), &handler, &handler_baton, pool);
+	return svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+}
+
+
+#if APR_HAS_THREADS
+
+/* Converts a svndiff file to the svndiff version given by the options */
+static svn_error_t *delta_convert_svndiff(dump_options_t *opts, const char *path, apr_file_t *file, apr_pool_t *pool)
+{
+	svn_txdelta_window_handler_t handler;
+	void *handler_baton;
+	apr_file_t *src_file;
+	svn_stream_t *parser;
 	apr_status_t status;
-	dump_options_t *opts = node->de_baton->opts;
-	apr_pool_t *pool = svn_pool_create(node->pool);
+
+	if ((status = apr_file_open(&src_file, path, APR_READ | APR_BUFFERED | APR_BINARY, 0600, pool))) {
+		return svn_error_wrap_apr(status, "Unable to open %s", path);
+	}
+	delta_svndiff_handler(opts, svn_stream_from_aprfile2(file, FALSE, pool), &handler, &handler_baton, pool);
+	parser = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE, pool);
+	SVN_ERR(svn_stream_copy(svn_stream_from_aprfile2(src_file, FALSE, pool), parser, pool));
+	return svn_stream_close(parser);
+}
+
+
+/* Creates the parent pool of the deltification jobs. The job pools are
+   created and destroyed on the main thread but used on the worker threads,
+   so they share an allocator that is protected by a mutex. The pool is no
+   child of the worker pool, as it must outlive the worker threads. */
+static int delta_create_job_pool(delta_context_t *ctx)
+{
+	apr_allocator_t *allocator;
+	apr_thread_mutex_t *mutex;
+
+	if (apr_allocator_create(&allocator) != APR_SUCCESS) {
+		return -1;
+	}
+	if (apr_pool_create_ex(&ctx->job_pool, NULL, NULL, allocator) != APR_SUCCESS) {
+		apr_allocator_destroy(allocator);
+		return -1;
+	}
+	apr_allocator_owner_set(allocator, ctx->job_pool);
+	if (apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, ctx->job_pool) != APR_SUCCESS) {
+		apr_pool_destroy(ctx->job_pool);
+		ctx->job_pool = NULL;
+		return -1;
+	}
+	apr_allocator_mutex_set(allocator, mutex);
+	return 0;
+}
+
+
+/* Starts the worker pool for deltifying texts. If this fails, texts will
+   be deltified on the main thread */
+static void delta_create_workers(delta_context_t *ctx, int threads, apr_pool_t *pool)
+{
+	ctx->worker_pool = svn_pool_create(pool);
+	if (delta_create_job_pool(ctx) != 0
+		|| apr_thread_mutex_create(&ctx->workers_mutex, APR_THREAD_MUTEX_DEFAULT, ctx->worker_pool) != APR_SUCCESS
+		|| apr_thread_cond_create(&ctx->workers_cond, ctx->worker_pool) != APR_SUCCESS
+		|| apr_thread_pool_create(&ctx->workers, threads, threads, ctx->worker_pool) != APR_SUCCESS) {
+		fprintf(stderr, _("WARNING: Unable to create worker threads, deltifying sequentially\n"));
+		svn_pool_clear(ctx->worker_pool);
+		if (ctx->job_pool != NULL) {
+			apr_pool_destroy(ctx->job_pool);
+			ctx->job_pool = NULL;
+		}
+		ctx->workers = NULL;
+	}
+}
+
+
+/* Thread function for deltifying a text */
+static void * APR_THREAD_FUNC delta_deltify_thread(apr_thread_t *thread, void *data)
+{
+	de_deltify_job_t *job = data;
 	svn_error_t *err;
 
-	DEBUG_MSG("delta_deltify_node(%s): %s -> %s\n", node->path, node->old_filename, node->filename);
+	(void)thread;
+	if (job->svndiff_path != NULL) {
+		err = delta_convert_svndiff(job->opts, job->svndiff_path, job->file, job->pool);
+	} else {
+		err = delta_write_svndiff(job->opts, job->source, job->target, job->file, job->pool);
+	}
+
+	apr_thread_mutex_lock(job->ctx->workers_mutex);
+	job->err = err;
+	job->done = 1;
+	apr_thread_cond_broadcast(job->ctx->workers_cond);
+	apr_thread_mutex_unlock(job->ctx->workers_mutex);
+	return NULL;
+}
+
 
-	/* Open source and target */
-	status = apr_file_open(&target_file, node->filename, APR_READ, 0600, pool);
+/* Starts deltifying the text of a node on the worker pool. If convert is
+   set, the svndiff from the server is converted instead */
+static svn_error_t *delta_deltify_start(de_node_baton_t *node, char convert)
+{
+	dump_options_t *opts = node->de_baton->opts;
+	apr_pool_t *pool = svn_pool_create(node->de_baton->ctx->job_pool);
+	de_deltify_job_t *job = apr_pcalloc(pool, sizeof(de_deltify_job_t));
+	apr_status_t status;
+
+	DEBUG_MSG("delta_deltify_start(%s)\n", node->path);
+
+	/* The text store must only be accessed from the main thread */
+	job->ctx = node->de_baton->ctx;
+	job->opts = opts;
+	job->pool = pool;
+	if (convert) {
+		job->svndiff_path = apr_pstrdup(pool, node->svndiff_filename);
+	} else {
+		job->from_old_text = (node->has_old_text && node->action == 'M');
+		job->target = text_store_read(node->de_baton->ctx->text_store, node->md5sum, pool);
+		job->source = (job->from_old_text ? text_store_read(node->de_baton->ctx->text_store, node->old_text, pool) : svn_stream_empty(pool));
+		if (job->target == NULL || job->source == NULL) {
+			svn_pool_destroy(pool);
+			return svn_error_createf(1, NULL, "Missing text of %s", node->path);
+		}
+	}
+
+	job->filename = apr_psprintf(pool, "%s/df/XXXXXX", opts->temp_dir);
+	status = utils_mkstemp(&job->file, job->filename, pool);
+	if (status) {
+		svn_pool_destroy(pool);
+		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
+	}
+
+	status = apr_thread_pool_push(job->ctx->workers, delta_deltify_thread, job, APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
 	if (status) {
-		DEBUG_MSG("delta_deltify_node(%s): Error opening %s\n", node->path, node->filename);
-		return svn_error_wrap_apr(status, "Unable to open %s", node->filename);
+		apr_file_close(job->file);
+		apr_file_remove(job->filename, pool);
+		svn_pool_destroy(pool);
+		return svn_error_wrap_apr(status, "Unable to deltify %s", node->path);
 	}
-	target = svn_stream_from_aprfile2(target_file, FALSE, pool);
-	if (node->old_filename) {
-		status = apr_file_open(&source_file, node->old_filename, APR_READ, 0600, pool);
-		if (status) {
-			DEBUG_MSG("delta_deltify_node(%s): Error opening %s\n", node->path, node->old_filename);
-			return svn_error_wrap_apr(status, "Unable to open %s", node->old_filename);
+	node->deltify_job = job;
+	return SVN_NO_ERROR;
+}
+
+
+/* Waits for the background deltification of a node. The resulting svndiff
+   is used if requested and if it has the right base, and removed otherwise */
+static svn_error_t *delta_deltify_collect(de_node_baton_t *node, char use)
+{
+	de_deltify_job_t *job = node->deltify_job;
+	delta_context_t *ctx = node->de_baton->ctx;
+	svn_error_t *err;
+	char *filename;
+	char from_old_text, converted;
+
+	if (job == NULL) {
+		return SVN_NO_ERROR;
+	}
+	node->deltify_job = NULL;
+
+	apr_thread_mutex_lock(ctx->workers_mutex);
+	while (!job->done) {
+		apr_thread_cond_wait(ctx->workers_cond, ctx->workers_mutex);
+	}
+	apr_thread_mutex_unlock(ctx->workers_mutex);
+
+	filename = apr_pstrdup(node->pool, job->filename);
+	from_old_text = job->from_old_text;
+	converted = (job->svndiff_path != NULL);
+	err = job->err;
+	svn_pool_destroy(job->pool);
+
+	/* A converted svndiff has the same base as the one from the server */
+	if (use && err == SVN_NO_ERROR && (converted ? delta_svndiff_usable(node) : from_old_text == (node->has_old_text && node->action == 'M'))) {
+		DEBUG_MSG("delta_deltify_collect(%s): using %s\n", node->path, filename);
+		node->delta_filename = filename;
+		return SVN_NO_ERROR;
+	}
+
+	if (apr_file_remove(filename, node->pool) != APR_SUCCESS) {
+		DEBUG_MSG("delta_deltify_collect(%s): Cannot remove file %s\n", node->path, filename);
+	}
+	if (!use) {
+		svn_error_clear(err);
+		return SVN_NO_ERROR;
+	}
+	return err;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/* Deltifies a node, i.e. generates a svndiff that can be dumped */
+static svn_error_t *delta_deltify_node(de_node_baton_t *node)
+{
+	svn_stream_t *source, *target;
+	apr_file_t *dest_file = NULL;
+	apr_status_t status;
+	dump_options_t *opts = node->de_baton->opts;
+	apr_pool_t *pool;
+	svn_error_t *err;
+
+	DEBUG_MSG("delta_deltify_node(%s)\n", node->path);
+
+#if APR_HAS_THREADS
+	/* The svndiff may have been generated in the background already */
+	if ((err = delta_deltify_collect(node, 1))) {
+		return err;
+	}
+	if (node->delta_filename != NULL) {
+		return SVN_NO_ERROR;
+	}
+#endif
+
+	/* Open source and target */
+	pool = svn_pool_create(node->pool);
+	if ((target = text_store_read(node->de_baton->ctx->text_store, node->md5sum, pool)) == NULL) {
+		return svn_error_createf(1, NULL, "Missing text of %s", node->path);
+	}
+	/* Only changes are based on the previous file contents */
+	if (node->has_old_text && node->action == 'M') {
+		if ((source = text_store_read(node->de_baton->ctx->text_store, node->old_text, pool)) == NULL) {
+			return svn_error_createf(1, NULL, "Missing previous text of %s", node->path);
 		}
-		source = svn_stream_from_aprfile2(source_file, FALSE, pool);
 	} else {
 		source = svn_stream_empty(pool);
 	}
@@ -493,15 +1071,11 @@ static svn_error_t *delta_deltify_node(de_node_baton_t *node)
 		DEBUG_MSG("delta_deltify_node(%s): Error creating temporary file in %s\n", node->path, opts->temp_dir);
 		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
 	}
-	dest = svn_stream_from_aprfile2(dest_file, FALSE, pool);
 
 	DEBUG_MSG("delta_deltify_node(%s): writing to %s\n", node->path, node->delta_filename);
 
 	/* Produce delta in svndiff format */
-	svn_txdelta(&stream, source, target, pool);
-	svn_txdelta_to_svndiff2(&handler, &handler_baton, dest, 0, pool);
-
-	err = svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+	err = delta_write_svndiff(opts, source, target, dest_file, pool);
 	if (err) {
 		DEBUG_MSG("delta_delify_node(%s): Error creating svndiff\n", node->path);
 		return err;
@@ -511,42 +1085,73 @@ static svn_error_t *delta_deltify_node(de_node_baton_t *node)
 }
 
 
-/* Dumps the contents of a file to stdout */
-static svn_error_t *delta_cat_file(apr_pool_t *pool, const char *path)
+/* Removes the svndiff received from the server */
+static void delta_discard_svndiff(de_node_baton_t *node)
 {
+	if (node->svndiff_filename == NULL) {
+		return;
+	}
+#ifndef DUMP_DEBUG
+	DEBUG_MSG("delta_discard_svndiff(%s): Removing %s\n", node->path, node->svndiff_filename);
+	if (apr_file_remove(node->svndiff_filename, node->pool) != APR_SUCCESS) {
+		DEBUG_MSG("delta_discard_svndiff(%s): Cannot remove file %s\n", node->path, node->svndiff_filename);
+	}
+#endif
+	node->svndiff_filename = NULL;
+}
+
+
+/* Window handler that stores the resulting text once it has been applied */
+static svn_error_t *delta_store_window(svn_txdelta_window_t *window, void *baton)
+{
+	de_text_baton_t *tb = (de_text_baton_t *)baton;
+	de_node_baton_t *node = tb->node;
+	de_file_state_t *state;
 	svn_error_t *err;
-	apr_status_t status;
-	apr_file_t *in_file = NULL;
-	svn_stream_t *in, *out;
 
-	status = apr_file_open(&in_file, path, APR_READ, 0600, pool);
-	if (status) {
-		apr_pool_t *epool = svn_pool_create(NULL);
-		char *errbuf = apr_palloc(epool, ERRBUFFER_SIZE);
-		return svn_error_create(status, NULL, apr_strerror(status, errbuf, ERRBUFFER_SIZE));
-	}
-	in = svn_stream_from_aprfile2(in_file, FALSE, pool);
-	if ((err = svn_stream_for_stdout(&out, pool))) {
-		svn_stream_close(in);
+	if ((err = tb->apply_handler(window, tb->apply_baton))) {
+		text_store_abort(tb->writer);
 		return err;
 	}
+	if (window != NULL) {
+		return SVN_NO_ERROR;
+	}
 
-	/* Write contents */
-	if ((err = svn_stream_copy(in, out, pool))) {
-		svn_stream_close(in);
-		return err;
+	if (text_store_commit(tb->writer, node->md5sum) != 0) {
+		return svn_error_createf(1, NULL, _("Unable to store the text of %s"), node->path);
 	}
 
-	err = svn_stream_close(in);
+	/* The reference to the previous text is passed on to the node */
+	state = delta_file_state(node->de_baton->ctx, node->path, 1);
+	if (state == NULL) {
+		return svn_error_createf(1, NULL, _("Unable to update the local state of %s"), node->path);
+	}
+	if (state->has_text) {
+		memcpy(node->old_text, state->text, APR_MD5_DIGESTSIZE);
+		node->has_old_text = 1;
+	}
+	delta_set_text(node->de_baton->ctx, node->path, node->md5sum);
+	DEBUG_MSG("applied delta: %s -> %s\n", node->path, svn_md5_digest_to_cstring(node->md5sum, node->pool));
 	return SVN_NO_ERROR;
 }
 
 
+/* Window handler that passes windows to two other handlers */
+static svn_error_t *delta_tee_window(svn_txdelta_window_t *window, void *baton)
+{
+	de_tee_baton_t *tb = (de_tee_baton_t *)baton;
+
+	SVN_ERR(tb->svndiff_handler(window, tb->svndiff_baton));
+	return tb->apply_handler(window, tb->apply_baton);
+}
+
+
 /* Dumps a node that has a 'replace' action */
 static svn_error_t *delta_dump_replace(de_node_baton_t *node)
 {
 	de_baton_t *de_baton = node->de_baton;
 	dump_options_t *opts = de_baton->opts;
+	output_t *out = de_baton->output;
 	const char *path = node->path;
 
 	/*
@@ -555,12 +1160,12 @@ static svn_error_t *delta_dump_replace(de_node_baton_t *node)
 
 	/* Dump the deletion */
 	if (opts->prefix != NULL) {
-		printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
+		output_printf(out, "%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
 	} else {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
+		output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
 	}
-	printf("%s: delete\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
-	printf("\n\n");
+	output_printf(out, "%s: delete\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
+	output_puts(out, "\n\n");
 
 	/* Don't use the copy information of the parent */
 	node->cp_info = CPI_NONE;
@@ -575,6 +1180,7 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	de_baton_t *de_baton = node->de_baton;
 	session_t *session = de_baton->session;
 	dump_options_t *opts = de_baton->opts;
+	output_t *out = de_baton->output;
 	const char *path = node->path;
 	unsigned long prop_len, content_len;
 	char dump_content = 0, dump_props = 0;
@@ -589,6 +1195,10 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 	/* Check if this is a dry run */
 	if (opts->flags & DF_INITIAL_DRY_RUN) {
+		if ((err = delta_remember_md5(node))) {
+			return err;
+		}
+		delta_discard_svndiff(node);
 		node->dump_needed = 0;
 		DEBUG_MSG("delta_dump_node(%s): aborting: DF_INITIAL_DRY_RUN\n", node->path);
 		return SVN_NO_ERROR;
@@ -605,6 +1215,10 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	/* If the node's parent has been copied, we don't need to dump it if its contents haven't changed.
 	   Addionally, make sure the node doesn't contain extra copyfrom information. */
 	if ((node->cp_info == CPI_COPY) && (node->action == 'A') && (node->copyfrom_path == NULL)) {
+		if ((err = delta_remember_md5(node))) {
+			return err;
+		}
+		delta_discard_svndiff(node);
 		node->dump_needed = 0;
 		DEBUG_MSG("delta_dump_node(%s): aborting: cp_info == CPI_COPY && action == 'A'\n", node->path);
 		return SVN_NO_ERROR;
@@ -628,35 +1242,35 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 	/* Dump node path */
 	if (opts->prefix != NULL) {
-		printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
+		output_printf(out, "%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
 	} else {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
+		output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
 	}
 
 	/* Dump node kind */
 	if (node->action != 'D') {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_KIND, node->kind == svn_node_file ? "file" : "dir");
+		output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_NODE_KIND, node->kind == svn_node_file ? "file" : "dir");
 	}
 
 	/* Dump action */
-	printf("%s: ", SVN_REPOS_DUMPFILE_NODE_ACTION);
+	output_printf(out, "%s: ", SVN_REPOS_DUMPFILE_NODE_ACTION);
 	switch (node->action) {
 		case 'M':
-			printf("change\n");
+			output_puts(out, "change\n");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * editing path : %s ... "), path);
 			}
 			break;
 
 		case 'A':
-			printf("add\n");
+			output_puts(out, "add\n");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * adding path : %s ... "), path);
 			}
 			break;
 
 		case 'D':
-			printf("delete\n");
+			output_puts(out, "delete\n");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * deleting path : %s ... "), path);
 			}
@@ -666,7 +1280,7 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 			goto finish;
 
 		case 'R':
-			printf("replace\n");
+			output_puts(out, "replace\n");
 			break;
 	}
 
@@ -686,16 +1300,22 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	if (node->cp_info == CPI_COPY && node->copyfrom_path) {
 		const char *copyfrom_path = delta_get_local_copyfrom_path(session->prefix, node->copyfrom_path);
 
-		printf("%s: %ld\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_REV, node->copyfrom_rev_local);
+		output_printf(out, "%s: %ld\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_REV, node->copyfrom_rev_local);
 		if (opts->prefix != NULL) {
-			printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, opts->prefix, copyfrom_path);
+			output_printf(out, "%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, opts->prefix, copyfrom_path);
 		} else {
-			printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, copyfrom_path);
+			output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, copyfrom_path);
 		}
 
 		/* Maybe we don't need to dump the contents */
 		if ((node->action == 'A') && (node->kind == svn_node_file)) {
-			unsigned char *prev_md5 = rhash_get(md5_hash, copyfrom_path, APR_HASH_KEY_STRING);
+			de_file_state_t *prev_state = delta_file_state(node->de_baton->ctx, copyfrom_path, 0);
+			unsigned char *prev_md5 = (prev_state && prev_state->has_md5sum ? prev_state->md5sum : NULL);
+			if (node->copyfrom_md5sum != NULL) {
+				/* The source may have been changed in this revision, too */
+				prev_md5 = node->copyfrom_md5sum;
+				output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_TEXT_COPY_SOURCE_MD5, svn_md5_digest_to_cstring(prev_md5, node->pool));
+			}
 			if (prev_md5 && !memcmp(node->md5sum, prev_md5, APR_MD5_DIGESTSIZE)) {
 				DEBUG_MSG("md5sum matches\n");
 				dump_content = 0;
@@ -720,20 +1340,38 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 	/* Deltify? */
 	if (dump_content && (opts->flags & DF_USE_DELTAS)) {
-		if ((err = delta_deltify_node(node))) {
-			return err;
+		if (delta_svndiff_usable(node)) {
+#if APR_HAS_THREADS
+			/* The svndiff may have been converted in the background */
+			if ((err = delta_deltify_collect(node, 1))) {
+				return err;
+			}
+#endif
+			if (node->delta_filename != NULL) {
+				DEBUG_MSG("delta_dump_node(%s): using converted svndiff from server\n", node->path);
+				delta_discard_svndiff(node);
+			} else {
+				DEBUG_MSG("delta_dump_node(%s): using svndiff from server\n", node->path);
+				node->delta_filename = node->svndiff_filename;
+				node->svndiff_filename = NULL;
+			}
+		} else {
+			delta_discard_svndiff(node);
+			if ((err = delta_deltify_node(node))) {
+				return err;
+			}
 		}
 	}
 
 #ifdef DUMP_DEBUG
 	/* Dump some extra debug info */
 	if (dump_content) {
-		printf("Debug-filename: %s\n", node->filename);
-		if (node->old_filename) {
-			printf("Debug-old-filename: %s\n", node->old_filename);
+		output_printf(out, "Debug-text: %s\n", svn_md5_digest_to_cstring(node->md5sum, node->pool));
+		if (node->has_old_text) {
+			output_printf(out, "Debug-old-text: %s\n", svn_md5_digest_to_cstring(node->old_text, node->pool));
 		}
 		if (opts->flags & DF_USE_DELTAS) {
-			printf("Debug-delta-filename: %s\n", node->delta_filename);
+			output_printf(out, "Debug-delta-filename: %s\n", node->delta_filename);
 		}
 	}
 #endif
@@ -743,18 +1381,18 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	content_len = 0;
 
 	/* Dump property size */
-	for (hi = apr_hash_first(node->pool, node->properties); hi; hi = apr_hash_next(hi)) {
+	for (hi = (node->properties ? apr_hash_first(node->pool, node->properties) : NULL); hi; hi = apr_hash_next(hi)) {
 		const char *key;
 		svn_string_t *value;
 		apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
 		/* Don't dump the property if it has been deleted */
-		if (apr_hash_get(node->del_properties, key, APR_HASH_KEY_STRING) != NULL) {
+		if (delta_prop_deleted(node, key)) {
 			continue;
 		}
 		prop_len += property_strlen(node->pool, key, value->data);
 	}
 	/* In dump format version 3, deleted properties should be dumped, too */
-	if (opts->dump_format == 3) {
+	if (opts->dump_format == 3 && node->del_properties != NULL) {
 		for (hi = apr_hash_first(node->pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
 			const char *key;
 			apr_hash_this(hi, (const void **)&key, NULL, NULL);
@@ -766,70 +1404,74 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	}
 	if (dump_props) {
 		if (opts->dump_format == 3) {
-			printf("%s: true\n", SVN_REPOS_DUMPFILE_PROP_DELTA);
+			output_printf(out, "%s: true\n", SVN_REPOS_DUMPFILE_PROP_DELTA);
 		}
 
 		prop_len += PROPS_END_LEN;
-		printf("%s: %lu\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, prop_len);
+		output_printf(out, "%s: %lu\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, prop_len);
 	}
 
 	/* Dump content size */
 	if (dump_content) {
-		char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
-		apr_finfo_t *info = apr_pcalloc(node->pool, sizeof(apr_finfo_t));
-		if (apr_stat(info, fpath, APR_FINFO_SIZE, node->pool) != APR_SUCCESS) {
-			DEBUG_MSG("delta_dump_node: FATAL: cannot stat %s\n", node->filename);
-			return svn_error_create(1, NULL, apr_psprintf(session->pool, "Cannot stat %s", node->filename));
+		if (opts->flags & DF_USE_DELTAS) {
+			apr_finfo_t *info = apr_pcalloc(node->pool, sizeof(apr_finfo_t));
+			if (apr_stat(info, node->delta_filename, APR_FINFO_SIZE, node->pool) != APR_SUCCESS) {
+				DEBUG_MSG("delta_dump_node: FATAL: cannot stat %s\n", node->delta_filename);
+				return svn_error_create(1, NULL, apr_psprintf(session->pool, "Cannot stat %s", node->delta_filename));
+			}
+			content_len = (unsigned long)info->size;
+		} else {
+			apr_off_t size = text_store_size(node->de_baton->ctx->text_store, node->md5sum);
+			if (size < 0) {
+				DEBUG_MSG("delta_dump_node: FATAL: missing text of %s\n", node->path);
+				return svn_error_createf(1, NULL, "Missing text of %s", node->path);
+			}
+			content_len = (unsigned long)size;
 		}
-		content_len = (unsigned long)info->size;
 
 		if (opts->flags & DF_USE_DELTAS) {
-			printf("%s: true\n", SVN_REPOS_DUMPFILE_TEXT_DELTA);
+			output_printf(out, "%s: true\n", SVN_REPOS_DUMPFILE_TEXT_DELTA);
 		}
-		printf("%s: %lu\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_LENGTH, content_len);
+		output_printf(out, "%s: %lu\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_LENGTH, content_len);
 
 		if (*node->md5sum != 0x00) {
-			printf("%s: %s\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5, svn_md5_digest_to_cstring(node->md5sum, node->pool));
+			output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5, svn_md5_digest_to_cstring(node->md5sum, node->pool));
 		}
 	}
-	printf("%s: %lu\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, (unsigned long)prop_len+content_len);
+	output_printf(out, "%s: %lu\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, (unsigned long)prop_len+content_len);
 
 	/* Dump properties */
 	if (dump_props) {
-		for (hi = apr_hash_first(node->pool, node->properties); hi; hi = apr_hash_next(hi)) {
+		for (hi = (node->properties ? apr_hash_first(node->pool, node->properties) : NULL); hi; hi = apr_hash_next(hi)) {
 			const char *key;
 			svn_string_t *value;
 			apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
 			/* Don't dump the property if it has been deleted */
-			if (apr_hash_get(node->del_properties, key, APR_HASH_KEY_STRING) != NULL) {
+			if (delta_prop_deleted(node, key)) {
 				continue;
 			}
-			property_dump(key, value->data);
+			property_dump(out, key, value->data);
 		}
 		/* In dump format version 3, deleted properties should be dumped, too */
-		if (opts->dump_format == 3) {
+		if (opts->dump_format == 3 && node->del_properties != NULL) {
 			for (hi = apr_hash_first(node->pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
 				const char *key;
 				apr_hash_this(hi, (const void **)&key, NULL, NULL);
-				property_del_dump(key);
+				property_del_dump(out, key);
 			}
 		}
-		printf(PROPS_END);
+		output_puts(out, PROPS_END);
 	}
 
 	/* Dump content */
 	if (dump_content) {
-		svn_error_t *err;
-		apr_pool_t *pool = svn_pool_create(node->pool);
-		const char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
-
-		fflush(stdout);
-		if ((err = delta_cat_file(pool, fpath))) {
-			return err;
+		if (opts->flags & DF_USE_DELTAS) {
+			if (output_file(out, node->delta_filename) != 0) {
+				return svn_error_createf(1, NULL, _("Unable to write %s to the dump output (%s)"), node->delta_filename, strerror(errno));
+			}
+		} else if (text_store_output(node->de_baton->ctx->text_store, node->md5sum, out) != 0) {
+			return svn_error_createf(1, NULL, _("Unable to write %s to the dump output (%s)"), node->path, strerror(errno));
 		}
-		fflush(stdout);
-
-		svn_pool_destroy(pool);
 #ifndef DUMP_DEBUG
 		if (opts->flags & DF_USE_DELTAS) {
 			DEBUG_MSG("delta_dump_node(%s): Removing delta file %s\n", node->path, node->delta_filename);
@@ -841,19 +1483,23 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	}
 
 finish:
-	printf("\n\n");
-	delta_mark_node(node);
-
-	/* Remove the old file if any - it's not needed any more */
-#ifndef DUMP_DEBUG
-	if (node->old_filename) {
-		DEBUG_MSG("de_close_file(%s): Removing old file %s\n", node->path, node->old_filename);
-		if (apr_file_remove(node->old_filename, node->pool) != APR_SUCCESS) {
-			DEBUG_MSG("de_close_file(%s): Cannot remove old file %s\n", node->path, node->old_filename);
-		}
+	output_puts(out, "\n\n");
+	if ((err = delta_mark_node(node))) {
+		return err;
+	}
+	delta_discard_svndiff(node);
+#if APR_HAS_THREADS
+	if ((err = delta_deltify_collect(node, 0))) {
+		return err;
 	}
 #endif
 
+	/* Release the previous text if any - it's not needed any more */
+	if (node->has_old_text) {
+		text_store_unref(node->de_baton->ctx->text_store, node->old_text);
+		node->has_old_text = 0;
+	}
+
 	return SVN_NO_ERROR;
 }
 
@@ -861,7 +1507,7 @@ finish:
 /* Dumps a node and all its children */
 static svn_error_t *delta_dump_node_recursive(de_node_baton_t *node)
 {
-	int i;
+	de_node_baton_t *child;
 	svn_error_t *err;
 
 	/*
@@ -874,11 +1520,15 @@ static svn_error_t *delta_dump_node_recursive(de_node_baton_t *node)
 			return err;
 		}
 	}
+#if APR_HAS_THREADS
+	/* The text has been deltified in vain if the node has been skipped */
+	if ((err = delta_deltify_collect(node, 0))) {
+		return err;
+	}
+#endif
 
-	DEBUG_MSG("delta_dump_node_recursive(%s): dumping %d children\n", node->path, node->children->nelts);
-	for (i = 0; i < node->children->nelts; i++) {
-		de_node_baton_t *child = APR_ARRAY_IDX(node->children, i, de_node_baton_t *);
-
+	DEBUG_MSG("delta_dump_node_recursive(%s): dumping children\n", node->path);
+	for (child = node->first_child; child != NULL; child = child->next_sibling) {
 		/* Propagate copy information obtained while dumping the parent node */
 		if ((err = delta_propagate_copy(node, child))) {
 			return err;
@@ -925,13 +1575,34 @@ static svn_error_t *de_open_root(void *edit_baton, svn_revnum_t base_revision, a
 }
 
 
+/* Releases the text and properties of a file below a deleted path */
+static int delta_delete_child_cb(const char *path, void *baton)
+{
+	de_delete_baton_t *db = (de_delete_baton_t *)baton;
+	de_file_state_t *state = cb_tree_data(path);
+
+	/* The walk may include paths without the prefix if there are none */
+	if (strncmp(path, db->prefix, db->prefix_len) || !state->has_text) {
+		return 0;
+	}
+
+	DEBUG_MSG("de_delete_entry(%s): Releasing text of %s\n", db->node->path, path);
+	text_store_unref(db->node->de_baton->ctx->text_store, state->text);
+	state->has_text = 0;
+
+	/* Delete property data */
+	DEBUG_MSG("de_delete_entry(%s): removeing properties for %s\n", db->node->path, path);
+	property_delete(db->node->de_baton->prop_store, path, db->pool);
+	return 0;
+}
+
+
 /* Subversion delta editor callback */
 static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
 {
 	de_node_baton_t *node;
 	de_node_baton_t *parent = (de_node_baton_t *)parent_baton;
-	apr_hash_index_t *hi;
-	int pathlen;
+	de_delete_baton_t db;
 
 	path = session_obfuscate(parent->de_baton->session, pool, path);
 	DEBUG_MSG("de_delete_entry(%s@%ld)\n", path, revision);
@@ -948,38 +1619,13 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 #endif
 
 	/* This node might be a directory, so clear the data of all children */
-	pathlen = strlen(node->path);
-	for (hi = rhash_first(pool, delta_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *filename;
-		rhash_this(hi, (const void **)&npath, NULL, (void **)&filename);
-		/* TODO: This is a small hack to make sure the node is a directory */
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-#ifndef DUMP_DEBUG
-			DEBUG_MSG("de_delete_entry(%s): Removing file %s\n", node->path, filename);
-			if (apr_file_remove(filename, node->pool) != APR_SUCCESS) {
-				DEBUG_MSG("de_delete_entry(%s): Cannot remove file %s\n", node->path, filename);
-			}
-#endif
-
-			/* Delete property data */
-			DEBUG_MSG("de_delete_entry(%s): removeing properties for %s\n", node->path, npath);
-			property_delete(node->de_baton->prop_store, npath, pool);
-
-			DEBUG_MSG("de_delete_entry(%s): deleting %s from delta_hash\n", node->path, npath);
-			rhash_set(delta_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
-	}
-
-	for (hi = rhash_first(pool, md5_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *md5sum;
-		rhash_this(hi, (const void **)&npath, NULL, (void **)&md5sum);
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-			DEBUG_MSG("deleting %s from md5_hash\n", npath);
-			rhash_set(md5_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
-	}
+	db.node = node;
+	db.prefix = apr_pstrcat(pool, node->path, "/", NULL);
+	db.prefix_len = strlen(db.prefix);
+	db.pool = pool;
+	cb_tree_walk_prefixed(&node->de_baton->ctx->file_table, db.prefix, delta_delete_child_cb, &db);
+	cb_tree_delete_prefixed(&node->de_baton->ctx->file_table, db.prefix);
+	delta_set_md5sum(node->de_baton->ctx, node->path, NULL);
 
 	property_delete(node->de_baton->prop_store, node->path, pool);
 
@@ -1064,7 +1710,7 @@ static svn_error_t *de_open_directory(const char *path, void *parent_baton, svn_
 	*child_baton = node;
 
 	/* Load properties (if any) */
-	ret = property_load(parent->de_baton->prop_store, node->path, node->properties, node->pool);
+	ret = property_load(parent->de_baton->prop_store, node->path, delta_node_props(node), node->pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to load properties for %s (%d)\n"), path, ret);
 	}
@@ -1085,8 +1731,11 @@ static svn_error_t *de_change_dir_prop(void *dir_baton, const char *name, const
 	DEBUG_MSG("de_change_dir_prop(%s) %s = %s\n", ((de_node_baton_t *)dir_baton)->path, name, value ? value->data : NULL);
 
 	if (value != NULL) {
-		apr_hash_set(node->properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
+		apr_hash_set(delta_node_props(node), apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
 	} else {
+		if (node->del_properties == NULL) {
+			node->del_properties = apr_hash_make(node->pool);
+		}
 		apr_hash_set(node->del_properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, (void *)0x1);
 	}
 	node->props_changed = 1;
@@ -1105,7 +1754,7 @@ static svn_error_t *de_close_directory(void *dir_baton, apr_pool_t *pool)
 	DEBUG_MSG("de_close_directory(%s): dump_needed = %d\n", node->path, (int)node->dump_needed);
 
 	/* Save properties for next time */
-	ret = property_store(node->de_baton->prop_store, node->path, node->properties, pool);
+	ret = delta_store_props(node, pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to store properties for %s (%d)\n"), node->path, ret);
 	}
@@ -1136,6 +1785,7 @@ static svn_error_t *de_add_file(const char *path, void *parent_baton, const char
 	node = delta_create_node(path, parent);
 	node->kind = svn_node_file;
 	node->dump_needed = 1;
+	node->svndiff_from_empty = 1;
 
 	/* Get corresponding log entry */
 	log = apr_hash_get(node->de_baton->log_revision->changed_paths, path, APR_HASH_KEY_STRING);
@@ -1195,6 +1845,8 @@ static svn_error_t *de_open_file(const char *path, void *parent_baton, svn_revnu
 {
 	de_node_baton_t *parent = (de_node_baton_t *)parent_baton;
 	de_node_baton_t *node;
+	unsigned char *copyfrom_md5sum;
+	svn_error_t *err;
 	int ret;
 
 	path = session_obfuscate(parent->de_baton->session, file_pool, path);
@@ -1205,8 +1857,14 @@ static svn_error_t *de_open_file(const char *path, void *parent_baton, svn_revnu
 
 	*file_baton = node;
 
+	/* Linked copies are opened if they have been changed after copying */
+	copyfrom_md5sum = apr_hash_get(parent->de_baton->links, path, APR_HASH_KEY_STRING);
+	if (copyfrom_md5sum != NULL && (err = delta_setup_link(node, copyfrom_md5sum))) {
+		return err;
+	}
+
 	/* Load properties (if any) */
-	ret = property_load(parent->de_baton->prop_store, node->path, node->properties, node->pool);
+	ret = property_load(parent->de_baton->prop_store, node->path, delta_node_props(node), node->pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to load properties for %s (%d)\n"), path, ret);
 	}
@@ -1217,7 +1875,6 @@ static svn_error_t *de_open_file(const char *path, void *parent_baton, svn_revnu
 /* Subversion delta editor callback */
 static svn_error_t *de_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
 {
-	apr_file_t *src_file = NULL, *dest_file = NULL;
 	apr_status_t status;
 	svn_stream_t *src_stream, *dest_stream;
 	de_node_baton_t *node = (de_node_baton_t *)file_baton;
@@ -1225,38 +1882,64 @@ static svn_error_t *de_apply_textdelta(void *file_baton, const char *base_checks
 #ifdef USE_TIMING
 	stopwatch_t watch = stopwatch_create();
 #endif
-	char *filename;
+	de_file_state_t *state;
+	de_text_baton_t *xb = apr_palloc(pool, sizeof(de_text_baton_t));
 
 	DEBUG_MSG("de_apply_textdelta(%s)\n", node->path);
 
-	/* Create a new temporary file to write to */
-	node->filename = apr_psprintf(node->pool, "%s/td/XXXXXX", opts->temp_dir);
-	status = utils_mkstemp(&dest_file, node->filename, pool);
-	if (status) {
-		DEBUG_MSG("de_apply_textdelta(%s): Error creating temporary file in %s\n", node->path, opts->temp_dir);
-		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
+	/* The new text is appended to the text store */
+	if (text_store_write(node->de_baton->ctx->text_store, &xb->writer, &dest_stream, pool) != 0) {
+		DEBUG_MSG("de_apply_textdelta(%s): Error writing to the text store in %s\n", node->path, opts->temp_dir);
+		return svn_error_createf(1, NULL, _("Unable to create temporary file in %s"), opts->temp_dir);
 	}
-	dest_stream = svn_stream_from_aprfile2(dest_file, FALSE, pool);
 
 	/* Update the local copy */
-	filename = rhash_get(delta_hash, node->path, APR_HASH_KEY_STRING);
-	if (filename == NULL) {
+	state = delta_file_state(node->de_baton->ctx, node->path, 0);
+	if (state == NULL || !state->has_text) {
 		src_stream = svn_stream_empty(pool);
-	} else {
-		status = apr_file_open(&src_file, filename, APR_READ, 0600, pool);
-		if (status) {
-			DEBUG_MSG("de_apply_textdelta(%s): Error opening %s\n", node->path, filename);
-			return svn_error_wrap_apr(status, "Unable to open %s", filename);
-		}
-		src_stream = svn_stream_from_aprfile2(src_file, FALSE, pool);
+	} else if ((src_stream = text_store_read(node->de_baton->ctx->text_store, state->text, pool)) == NULL) {
+		text_store_abort(xb->writer);
+		return svn_error_createf(1, NULL, "Missing text of %s", node->path);
 	}
 
-	svn_txdelta_apply(src_stream, dest_stream, node->md5sum, node->path, pool, handler, handler_baton);
+	svn_txdelta_apply(src_stream, dest_stream, node->md5sum, node->path, pool, &xb->apply_handler, &xb->apply_baton);
+	xb->node = node;
+	*handler = delta_store_window;
+	*handler_baton = xb;
 
-	node->old_filename = apr_pstrdup(node->pool, filename);
-	rhash_set(delta_hash, node->path, APR_HASH_KEY_STRING, node->filename, RHASH_VAL_STRING);
+	/*
+	 * When dumping deltas, the incoming windows are written to a svndiff
+	 * file, too. In most cases, this can be dumped directly.
+	 */
+	if ((opts->flags & DF_USE_DELTAS) && !(opts->flags & DF_INITIAL_DRY_RUN)) {
+		apr_file_t *svndiff_file = NULL;
+		de_tee_baton_t *tb = apr_palloc(pool, sizeof(de_tee_baton_t));
 
-	DEBUG_MSG("applying delta: %s -> %s\n", node->old_filename, node->filename);
+		node->svndiff_filename = apr_psprintf(node->pool, "%s/df/XXXXXX", opts->temp_dir);
+		status = utils_mkstemp(&svndiff_file, node->svndiff_filename, pool);
+		if (status) {
+			DEBUG_MSG("de_apply_textdelta(%s): Error creating temporary file in %s\n", node->path, opts->temp_dir);
+			text_store_abort(xb->writer);
+			return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
+		}
+
+		tb->apply_handler = *handler;
+		tb->apply_baton = *handler_baton;
+#if APR_HAS_THREADS
+		/*
+		 * Compressing the svndiff takes time, so it is recorded uncompressed
+		 * and converted on the worker threads if possible, which keeps
+		 * receiving and dumping the revision from waiting for it.
+		 */
+		if (node->de_baton->ctx->workers != NULL && opts->delta_format != 0) {
+			svn_txdelta_to_svndiff2(&tb->svndiff_handler, &tb->svndiff_baton, svn_stream_from_aprfile2(svndiff_file, FALSE, pool), 0, pool);
+			node->svndiff_raw = 1;
+		} else
+#endif
+		delta_svndiff_handler(opts, svn_stream_from_aprfile2(svndiff_file, FALSE, pool), &tb->svndiff_handler, &tb->svndiff_baton, pool);
+		*handler = delta_tee_window;
+		*handler_baton = tb;
+	}
 
 	node->applied_delta = 1;
 	node->dump_needed = 1;
@@ -1281,8 +1964,11 @@ static svn_error_t *de_change_file_prop(void *file_baton, const char *name, cons
 	DEBUG_MSG("de_change_file_prop(%s) %s = %s\n", ((de_node_baton_t *)file_baton)->path, name, value ? value->data : NULL);
 
 	if (value != NULL) {
-		apr_hash_set(node->properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
+		apr_hash_set(delta_node_props(node), apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
 	} else {
+		if (node->del_properties == NULL) {
+			node->del_properties = apr_hash_make(node->pool);
+		}
 		apr_hash_set(node->del_properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, (void *)0x1);
 	}
 	node->props_changed = 1;
@@ -1296,13 +1982,31 @@ static svn_error_t *de_change_file_prop(void *file_baton, const char *name, cons
 static svn_error_t *de_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
 {
 	de_node_baton_t *node = (de_node_baton_t *)file_baton;
+	de_file_state_t *state;
 	int ret;
 
 	/* Save properties for next time */
-	ret = property_store(node->de_baton->prop_store, node->path, node->properties, pool);
+	ret = delta_store_props(node, pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to store properties for %s (%d)\n"), node->path, ret);
 	}
+
+	/* Remember the revision for checking later copies of this file */
+	if ((state = delta_file_state(node->de_baton->ctx, node->path, 0)) != NULL) {
+		state->changed = node->de_baton->log_revision->revision;
+	}
+
+#if APR_HAS_THREADS
+	/* If the svndiff of the server can't be used, deltify in the background.
+	   Otherwise, it may need to be converted. */
+	if (node->de_baton->ctx->workers != NULL && node->applied_delta && !(node->de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
+		if (!delta_svndiff_usable(node)) {
+			return delta_deltify_start(node, 0);
+		} else if (node->svndiff_raw) {
+			return delta_deltify_start(node, 1);
+		}
+	}
+#endif
 	return SVN_NO_ERROR;
 }
 
@@ -1329,6 +2033,27 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		return err;
 	}
 
+	/*
+	 * Linked copies that haven't been changed after copying won't be
+	 * touched by the delta editor at all, so they are dumped here.
+	 */
+	for (hi = apr_hash_first(pool, de_baton->links); hi; hi = apr_hash_next(hi)) {
+		const char *path;
+		unsigned char *copyfrom_md5sum;
+		de_node_baton_t *node;
+		apr_hash_this(hi, (const void **)&path, NULL, (void **)&copyfrom_md5sum);
+
+		if (apr_hash_get(de_baton->dumped_entries, path, APR_HASH_KEY_STRING) != NULL) {
+			continue;
+		}
+
+		DEBUG_MSG("Post-dumping linked copy %s\n", path);
+		node = delta_create_node_no_parent(path, de_baton, de_baton->revision_pool);
+		if ((err = delta_setup_link(node, copyfrom_md5sum)) || (err = delta_dump_node(node))) {
+			return err;
+		}
+	}
+
 	/*
 	 * There are probably some deleted nodes that haven't been dumped yet.
 	 * This will happen if nodes whose parent is a copy destination have been
@@ -1342,18 +2067,16 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		apr_hash_this(hi, (const void **)&path, NULL, (void **)&log);
 		DEBUG_MSG("Checking %s (%c)\n", path, log->action);
 		if (log->action == 'D') {
-			char *filename, *parent, skip = 0;
-
-			/* We can unlink a possible temporary file now */
-			filename = rhash_get(delta_hash, path, APR_HASH_KEY_STRING);
-			if (filename) {
-#ifndef DUMP_DEBUG
-				DEBUG_MSG("de_close_edit(): Removing %s\n", filename);
-				if (apr_file_remove(filename, pool) != APR_SUCCESS) {
-					DEBUG_MSG("de_close_edit(): Cannot remove file %s\n", filename);
-				}
-#endif
-				rhash_set(delta_hash, path, APR_HASH_KEY_STRING, NULL, 0);
+			de_file_state_t *state;
+			de_node_baton_t *pnode;
+			char skip = 0;
+
+			/* We can release a possible local copy now */
+			state = delta_file_state(de_baton->ctx, path, 0);
+			if (state != NULL && state->has_text) {
+				DEBUG_MSG("de_close_edit(): Releasing text of %s\n", path);
+				text_store_unref(de_baton->ctx->text_store, state->text);
+				delta_set_text(de_baton->ctx, path, NULL);
 			}
 
 			/* Already dumped? */
@@ -1365,21 +2088,13 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 			 * If this file is part of a deleted tree (that has been dumped as being
 			 * deleted) or part of a manually copied tree, we can safely ignore it.
 			 */
-			parent = svn_path_dirname(path, pool);
-			while (parent && *parent) {
-				de_node_baton_t *pnode = apr_hash_get(de_baton->dumped_entries, parent, APR_HASH_KEY_STRING);
-				if (pnode && pnode->action == 'D') {
-					DEBUG_MSG("de_close_edit(): Parent %s of %s already deleted, ignoring\n", parent, path);
-					skip = 1;
-					break;
-				}
-				if (pnode && (pnode->cp_info & CPI_FAILED)) {
-					DEBUG_MSG("de_close_edit(): Parent %s of %s is part of a failed copy, ignoring\n", parent, path);
-					skip = 1;
-					break;
-				}
-
-				parent = svn_path_dirname(parent, pool);
+			pnode = delta_flagged_parent(de_baton, path);
+			if (pnode && pnode->action == 'D') {
+				DEBUG_MSG("de_close_edit(): Parent %s of %s already deleted, ignoring\n", pnode->path, path);
+				skip = 1;
+			} else if (pnode) {
+				DEBUG_MSG("de_close_edit(): Parent %s of %s is part of a failed copy, ignoring\n", pnode->path, path);
+				skip = 1;
 			}
 
 			if (!skip) {
@@ -1396,6 +2111,11 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		}
 	}
 
+	/* Reclaim space of texts that are no longer referenced */
+	if (text_store_compact(de_baton->ctx->text_store) != 0) {
+		return svn_error_createf(1, NULL, _("Unable to compact the local file copies in %s"), de_baton->opts->temp_dir);
+	}
+
 #ifdef USE_TIMING
 	DEBUG_MSG("apply_text_delta: %f seconds\n", tm_de_apply_textdelta);
 #endif
@@ -1438,6 +2158,7 @@ const char *delta_get_local_copyfrom_path(const char *prefix, const char *path)
 svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t *opts, apr_array_header_t *logs, svn_revnum_t local_revnum)
 {
 	svn_revnum_t rev;
+	int lo, hi;
 
 	/* If we sync the revision numbers, the original one is correct */
 	if (opts->flags & DF_KEEP_REVNUMS) {
@@ -1447,29 +2168,26 @@ svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t
 	DEBUG_MSG("local_revnum = %ld\n", local_revnum);
 
 	/*
-	 * Loop backwards through the revision list, starting at the previous
-	 * revision ,in order to find the best matching revision for the copy.
+	 * Find the last revision before the current one that is not newer than
+	 * the copy source. If the copy source itself has not been dumped, the
+	 * node contents haven't changed between this revision and the original
+	 * one, so it can be used as well. Original revision numbers are
+	 * ascending in the revision list, so a binary search can be used.
 	 * NOTE: This algorithm assumes that list indexes are equal to their
 	 * respective local revision numbers. This is ensured in dump()
 	 */
-	rev = logs->nelts-1;
-	while (--rev >= 0) {
-		log_revision_t *logrev = &APR_ARRAY_IDX(logs, rev, log_revision_t);;
-		DEBUG_MSG("node->copyfrom = %ld, logrev->revision = %ld, rev = %ld\n",  original, logrev->revision, rev);
-		if (original == logrev->revision) {
-			/* This is ideal, there's an exact match */
-			DEBUG_MSG("-> equal, using %ld\n", rev);
-			break;
-		} else if (logrev->revision < original)  {
-			/* The revision in question has not been dumped as we've just
-			   missed it. Therefore, simply use this revision (since
-			   node->copyfrom_revision has not been dumped, the node contents
-			   haven't changed between this revision and
-			   node->copyfrom_revision) */
-			DEBUG_MSG("-> smaller , using %ld\n", rev);
-			break;
+	lo = 0;
+	hi = logs->nelts-1;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (APR_ARRAY_IDX(logs, mid, log_revision_t).revision <= original) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
+	rev = lo - 1;
+	DEBUG_MSG("node->copyfrom = %ld, using %ld\n", original, rev);
 
 	return rev;
 }
@@ -1499,6 +2217,7 @@ void delta_setup_editor(delta_editor_info_t *info, log_revision_t *log_revision,
 	(*editor)->abort_edit = de_abort_edit;
 
 	baton = apr_palloc(pool, sizeof(de_baton_t));
+	baton->ctx = info->context;
 	baton->session = info->session;
 	baton->opts = info->options;
 	baton->logs = info->logs;
@@ -1506,29 +2225,219 @@ void delta_setup_editor(delta_editor_info_t *info, log_revision_t *log_revision,
 	baton->local_revnum = local_revnum;
 	baton->revision_pool = svn_pool_create(pool);
 	baton->dumped_entries = apr_hash_make(baton->revision_pool);
+	baton->flagged_entries = apr_hash_make(baton->revision_pool);
+	baton->links = apr_hash_make(baton->revision_pool);
 	baton->path_repo = info->path_repo;
 	baton->prop_store = info->property_storage;
+	baton->output = info->output;
 	*editor_baton = baton;
 
-	/* Create global hashes if needed */
-	if (!hashes_created) {
-		apr_pool_t *hash_pool = svn_pool_create(info->session->pool);
+	/* Create the file table if needed */
+	delta_create_file_table(info->context, info->options, info->session->pool);
 
-		md5_hash = rhash_make(hash_pool);
-		delta_hash = rhash_make(hash_pool);
-		
-		hashes_created = 1;
+#if APR_HAS_THREADS
+	if (info->context->worker_pool == NULL && (info->options->flags & DF_USE_DELTAS) && info->options->delta_threads > 1) {
+		delta_create_workers(info->context, info->options->delta_threads, info->session->pool);
 	}
+#endif
 }
 
 
-/* Cleans up global resources */
-void delta_cleanup()
+/* Determines the copied files of the current revision whose sources are
+   available locally and sets up their local state. If these are reported
+   to the server as being present, it will only send changes made to the
+   copies, and nothing at all for unchanged ones */
+int delta_prepare_links(void *editor_baton, apr_array_header_t **links, apr_pool_t *pool)
 {
-	if (hashes_created) {
-		rhash_clear(md5_hash);
-		rhash_clear(delta_hash);
+	de_baton_t *de_baton = (de_baton_t *)editor_baton;
+	session_t *session = de_baton->session;
+	apr_hash_index_t *hi;
+	int i;
+
+	*links = apr_array_make(pool, 0, sizeof(delta_link_t));
+
+	/* The repository paths must be known */
+	if ((de_baton->opts->flags & (DF_DRY_RUN | DF_INITIAL_DRY_RUN)) || (session->flags & SF_OBFUSCATE)) {
+		return 0;
+	}
+#ifdef USE_SINGLEFILE_DUMP
+	if (session->file != NULL) {
+		return 0;
+	}
+#endif
+
+	for (hi = apr_hash_first(pool, de_baton->log_revision->changed_paths); hi; hi = apr_hash_next(hi)) {
+		const char *path;
+		svn_log_changed_path_t *log;
+		delta_link_t *link;
+		apr_hash_this(hi, (const void **)&path, NULL, (void **)&log);
+
+		if (delta_link_source(de_baton, path, log, pool) == NULL) {
+			continue;
+		}
+		link = (delta_link_t *)apr_array_push(*links);
+		link->path = path;
+		link->url = apr_pstrcat(pool, session->root, "/", svn_path_uri_encode(log->copyfrom_path, pool), NULL);
+		link->revision = log->copyfrom_rev;
+	}
+
+	/* The reporter expects paths in depth-first order */
+	utils_sort(*links);
+
+	for (i = 0; i < (*links)->nelts; i++) {
+		delta_link_t *link = &APR_ARRAY_IDX(*links, i, delta_link_t);
+		svn_log_changed_path_t *log = apr_hash_get(de_baton->log_revision->changed_paths, link->path, APR_HASH_KEY_STRING);
+		const char *copyfrom_path = delta_get_local_copyfrom_path(session->prefix, log->copyfrom_path);
+		de_file_state_t *state = delta_file_state(de_baton->ctx, copyfrom_path, 0);
+		unsigned char *md5sum = apr_pmemdup(de_baton->revision_pool, state->md5sum, APR_MD5_DIGESTSIZE);
+		unsigned char text[APR_MD5_DIGESTSIZE];
+		apr_hash_t *props = apr_hash_make(pool);
+
+		/* The copy starts out with the text and properties of its source */
+		memcpy(text, state->text, APR_MD5_DIGESTSIZE);
+		if (text_store_ref(de_baton->ctx->text_store, text) != 0) {
+			fprintf(stderr, _("ERROR: Missing local copy of %s\n"), copyfrom_path);
+			return -1;
+		}
+		if (delta_set_text(de_baton->ctx, link->path, text) != 0) {
+			text_store_unref(de_baton->ctx->text_store, text);
+			fprintf(stderr, _("ERROR: Unable to update the local state of %s\n"), link->path);
+			return -1;
+		}
+		if (delta_set_md5sum(de_baton->ctx, link->path, md5sum) != 0) {
+			fprintf(stderr, _("ERROR: Unable to update the local state of %s\n"), link->path);
+			return -1;
+		}
+		delta_file_state(de_baton->ctx, link->path, 0)->changed = de_baton->log_revision->revision;
+
+		if (property_load(de_baton->prop_store, copyfrom_path, props, pool) != 0
+			|| property_store(de_baton->prop_store, link->path, props, pool) != 0) {
+			fprintf(stderr, _("ERROR: Unable to copy properties from %s to %s\n"), copyfrom_path, link->path);
+			return -1;
+		}
+
+		apr_hash_set(de_baton->links, link->path, APR_HASH_KEY_STRING, md5sum);
+		DEBUG_MSG("delta_prepare_links(): %s -> %s@%ld\n", link->path, link->url, link->revision);
+	}
+	return 0;
+}
+
+
+/* Creates a new context for the dump state that is shared by all revisions */
+delta_context_t *delta_context_create(apr_pool_t *pool)
+{
+	return apr_pcalloc(pool, sizeof(delta_context_t));
+}
+
+
+/* Cleans up the resources of a context */
+void delta_cleanup(delta_context_t *ctx)
+{
+#if APR_HAS_THREADS
+	/* This waits for all running deltifications */
+	if (ctx->worker_pool != NULL) {
+		svn_pool_destroy(ctx->worker_pool);
+		ctx->worker_pool = NULL;
+		ctx->workers = NULL;
+		if (ctx->job_pool != NULL) {
+			apr_pool_destroy(ctx->job_pool);
+			ctx->job_pool = NULL;
+		}
+		ctx->workers_mutex = NULL;
+		ctx->workers_cond = NULL;
+	}
+#endif
+	if (ctx->file_table_created) {
+		cb_tree_clear(&ctx->file_table);
+		text_store_destroy(ctx->text_store);
+		ctx->text_store = NULL;
+
+		ctx->file_table_created = 0;
+	}
+	ctx->defer_removal = 0;
+}
+
+
+/* Defers the removal of local file copies until delta_release_files() is called */
+void delta_defer_removal(delta_context_t *ctx, apr_pool_t *pool)
+{
+	(void)pool;
+	if (ctx->text_store != NULL) {
+		text_store_defer_removal(ctx->text_store);
+	}
+	ctx->defer_removal = 1;
+}
+
+
+/* Removes all local file copies whose removal has been deferred */
+void delta_release_files(delta_context_t *ctx)
+{
+	if (ctx->text_store != NULL) {
+		text_store_release_files(ctx->text_store);
+	}
+}
+
+
+/* Saves the local file copies and checksums to a state file */
+int delta_save_state(delta_context_t *ctx, state_file_t *sf, apr_pool_t *pool)
+{
+	de_save_baton_t sb;
+
+	(void)pool;
+	sb.sf = sf;
+	sb.err = 0;
+	if (ctx->file_table_created) {
+		cb_tree_walk_prefixed(&ctx->file_table, "", delta_save_file_state_cb, &sb);
+	}
+
+	/* The table is terminated by a NULL path */
+	if (sb.err || state_write_string(sf, NULL) != 0) {
+		return -1;
+	}
+	if (ctx->text_store == NULL) {
+		return state_write_int(sf, -1);
+	}
+	return (state_write_int(sf, 0) != 0 || text_store_save(ctx->text_store, sf) != 0 ? -1 : 0);
+}
+
+
+/* Loads the local file copies and checksums from a state file, removing
+   copies in the temporary directory that are no longer referenced */
+int delta_load_state(delta_context_t *ctx, state_file_t *sf, dump_options_t *opts, apr_pool_t *pool)
+{
+	de_file_state_t *state;
+	apr_int64_t len, v, changed;
+	char *path;
+
+	delta_create_file_table(ctx, opts, pool);
+
+	if (state_read_string(sf, &path, pool) != 0) {
+		return -1;
+	}
+	while (path != NULL) {
+		char *text, *md5sum;
+		if (state_read_data(sf, &text, &len, pool) != 0
+			|| (text != NULL && len != APR_MD5_DIGESTSIZE)
+			|| state_read_data(sf, &md5sum, &len, pool) != 0
+			|| (md5sum != NULL && len != APR_MD5_DIGESTSIZE)
+			|| state_read_int(sf, &changed) != 0) {
+			return -1;
+		}
+		if ((text != NULL && delta_set_text(ctx, path, (unsigned char *)text) != 0)
+			|| (md5sum != NULL && delta_set_md5sum(ctx, path, (unsigned char *)md5sum) != 0)) {
+			return -1;
+		}
+		if ((state = delta_file_state(ctx, path, 0)) != NULL) {
+			state->changed = (svn_revnum_t)changed;
+		}
+		if (state_read_string(sf, &path, pool) != 0) {
+			return -1;
+		}
+	}
 
-		hashes_created = 0;
+	/* The text store is only present if a revision has been dumped */
+	if (state_read_int(sf, &v) != 0) {
+		return -1;
 	}
+	return (v < 0 ? 0 : text_store_load(ctx->text_store, sf, pool));
 }
@@ -31,18 +31,32 @@
 
 #include "dump.h"
 #include "log.h"
+#include "output.h"
 #include "session.h"
+#include "state.h"
 
 
+/* Dump state shared by all revisions (opaque) */
+typedef struct delta_context_t delta_context_t;
+
 /* Bundles information passed to delta_setup_editor() */
 typedef struct {
+	delta_context_t *context;
 	session_t *session;
 	dump_options_t *options;
 	struct path_repo_t *path_repo;
 	struct property_storage_t *property_storage;
 	apr_array_header_t *logs;
+	output_t *output;
 } delta_editor_info_t;
 
+/* A copied file that can be reported to the server as being present */
+typedef struct {
+	const char *path;  /* Must be the first member for utils_sort() */
+	const char *url;
+	svn_revnum_t revision;
+} delta_link_t;
+
 
 /* Determines the local copyfrom_path (returns NULL if it can't be reached) */
 const char *delta_get_local_copyfrom_path(const char *prefix, const char *path);
@@ -53,8 +67,30 @@ svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t
 /* Sets up a delta editor for dumping a revision */
 extern void delta_setup_editor(delta_editor_info_t *info, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool);
 
-/* Cleans up global resources */
-extern void delta_cleanup();
+/* Determines the copied files of the current revision whose sources are
+   available locally and sets up their local state. If these are reported
+   to the server as being present, it will only send changes made to the
+   copies, and nothing at all for unchanged ones */
+extern int delta_prepare_links(void *editor_baton, apr_array_header_t **links, apr_pool_t *pool);
+
+/* Creates a new context for the dump state that is shared by all revisions */
+extern delta_context_t *delta_context_create(apr_pool_t *pool);
+
+/* Cleans up the resources of a context */
+extern void delta_cleanup(delta_context_t *ctx);
+
+/* Defers the removal of local file copies until delta_release_files() is called */
+extern void delta_defer_removal(delta_context_t *ctx, apr_pool_t *pool);
+
+/* Removes all local file copies whose removal has been deferred */
+extern void delta_release_files(delta_context_t *ctx);
+
+/* Saves the local file copies and checksums to a state file */
+extern int delta_save_state(delta_context_t *ctx, state_file_t *sf, apr_pool_t *pool);
+
+/* Loads the local file copies and checksums from a state file, removing
+   copies in the temporary directory that are no longer referenced */
+extern int delta_load_state(delta_context_t *ctx, state_file_t *sf, dump_options_t *opts, apr_pool_t *pool);
 
 
 #endif
@@ -21,32 +21,113 @@
  */
 
 
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+	#include <fcntl.h>
+	#include <sys/types.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
 
 #include <svn_pools.h>
 #include <svn_ra.h>
 #include <svn_repos.h>
 
+#include <apr_file_io.h>
 #include <apr_hash.h>
 #include <apr_pools.h>
+#include <apr_time.h>
+#if APR_HAS_THREADS
+	#include <apr_thread_proc.h>
+#endif
 
 #include "main.h"
 #include "delta.h"
 #include "log.h"
 #include "logger.h"
+#include "mukv.h"
+#include "output.h"
 #include "path_repo.h"
 #include "property.h"
+#include "revindex.h"
+#include "spool.h"
+#include "state.h"
+#include "utils.h"
 
 #include "dump.h"
 
 
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Maximum number of revisions that are replayed with a single request */
+#define REPLAY_GROUP_SIZE 64
+
+/* Checkpoint file in the state directory */
+#define STATE_FILE "dump.state"
+#define STATE_MAGIC "rsvndump-state"
+#define STATE_VERSION 8
+
+/* Minimum time between two checkpoints */
+#define STATE_INTERVAL apr_time_from_sec(30)
+
+/* Dump flags that must not change when resuming */
+#define STATE_FLAGS (DF_USE_DELTAS | DF_KEEP_REVNUMS | DF_INCREMENTAL | DF_DRY_RUN | DF_COMPRESS)
+
+
+/* State of the replay engine */
+typedef struct {
+	char enabled;
+	apr_array_header_t *logs;   /* Upcoming revision logs in ascending order */
+	svn_revnum_t logs_start;    /* First revision of logs if fetched separately */
+	int index;                  /* Current position in logs */
+	apr_hash_t *spools;         /* Revision number -> spool file */
+	apr_pool_t *pool;
+	const char *temp_dir;
+} dump_replay_t;
+
+
+#if APR_HAS_THREADS
+
+/* A diff that is being fetched in the background */
+typedef struct {
+	session_t *session;
+	dump_options_t opts;
+	svn_revnum_t src;
+	svn_revnum_t dest;
+	int start_empty;
+	char *spool_path;
+	apr_pool_t *pool;
+	apr_thread_t *thread;
+	char ret;
+} dump_prefetch_t;
+
+#endif /* APR_HAS_THREADS */
+
+
+/*---------------------------------------------------------------------------*/
+/* Static variables                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Set by signal handlers while waiting for new revisions in watch mode */
+static volatile sig_atomic_t watch_stop = 0;
+
+
 /*---------------------------------------------------------------------------*/
 /* Static functions                                                          */
 /*---------------------------------------------------------------------------*/
 
 
 /* Dumps a revision header using the given properties */
-static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn_revnum_t local_revnum, dump_options_t *opts)
+static void dump_revision_header(output_t *out, apr_pool_t *pool, log_revision_t *revision, svn_revnum_t local_revnum, dump_options_t *opts)
 {
 	int props_length = 0;
 
@@ -64,28 +145,28 @@ static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn
 		props_length += PROPS_END_LEN;
 	}
 
-	printf("%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, local_revnum);
-	printf("%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
-	printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
+	output_printf(out, "%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, local_revnum);
+	output_printf(out, "%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
+	output_printf(out, "%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
 
 	if (props_length > 0) {
 		if (revision->message != NULL) {
-			property_dump("svn:log", revision->message);
+			property_dump(out, "svn:log", revision->message);
 		}
 		if (revision->author != NULL) {
-			property_dump("svn:author", revision->author);
+			property_dump(out, "svn:author", revision->author);
 		}
 		if (revision->date != NULL) {
-			property_dump("svn:date", revision->date);
+			property_dump(out, "svn:date", revision->date);
 		}
 
-		printf(PROPS_END"\n");
+		output_puts(out, PROPS_END"\n");
 	}
 }
 
 
 /* Dumps an empty revision for padding the given number */
-static void dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev)
+static void dump_padding_revision(output_t *out, apr_pool_t *pool, svn_revnum_t rev)
 {
 	int props_length = 0;
 	const char *message = "This is an empty revision for padding.";
@@ -93,18 +174,19 @@ static void dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev)
 	props_length += property_strlen(pool, "svn:log", message);
 	props_length += PROPS_END_LEN;
 
-	printf("%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, rev);
-	printf("%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
-	printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
+	output_printf(out, "%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, rev);
+	output_printf(out, "%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
+	output_printf(out, "%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
 
-	property_dump("svn:log", message);
-	printf(PROPS_END"\n");
+	property_dump(out, "svn:log", message);
+	output_puts(out, PROPS_END"\n");
 }
 
 
 /* Creates (and possibly cleans up) the user prefix path.
-   The new prefix will be allocated in the given pool. */
-static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
+   The new prefix will be allocated in the given pool. If dump_nodes is
+   zero, the prefix is only cleaned up. */
+static void dump_create_user_prefix(output_t *out, dump_options_t *opts, apr_pool_t *pool, char dump_nodes)
 {
 	char *new_prefix, *s, *e;
 	if (opts->prefix == NULL) {
@@ -123,9 +205,11 @@ static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
 		/* Append to new prefix and dump */
 		strncat(new_prefix, s, e - s);
 
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, new_prefix);
-		printf("%s: dir\n", SVN_REPOS_DUMPFILE_NODE_KIND);
-		printf("%s: add\n\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
+		if (dump_nodes) {
+			output_printf(out, "%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, new_prefix);
+			output_printf(out, "%s: dir\n", SVN_REPOS_DUMPFILE_NODE_KIND);
+			output_printf(out, "%s: add\n\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
+		}
 
 		strcat(new_prefix, "/");
 		s = e + 1;
@@ -136,12 +220,14 @@ static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
 }
 
 
-/* Runs a diff against two revisions */
-static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty, const svn_delta_editor_t *editor, void *editor_baton, apr_pool_t *pool)
+/* Runs a diff against two revisions. The given links (which may be NULL)
+   are reported as being present in the source revision */
+static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty, apr_array_header_t *links, const svn_delta_editor_t *editor, void *editor_baton, apr_pool_t *pool)
 {
 	const svn_ra_reporter2_t *reporter;
 	void *report_baton;
 	svn_error_t *err;
+	int i;
 	apr_pool_t *subpool = svn_pool_create(pool);
 #ifdef USE_TIMING
 	stopwatch_t watch = stopwatch_create();
@@ -168,6 +254,17 @@ static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t
 		return 1;
 	}
 
+	for (i = 0; links != NULL && i < links->nelts; i++) {
+		delta_link_t *link = &APR_ARRAY_IDX(links, i, delta_link_t);
+		err = reporter->link_path(report_baton, link->path, link->url, link->revision, FALSE, NULL, subpool);
+		if (err) {
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			svn_pool_destroy(subpool);
+			return 1;
+		}
+	}
+
 	err = reporter->finish_report(report_baton, subpool);
 	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
@@ -184,6 +281,411 @@ static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t
 }
 
 
+/* Determines the diff base for the given global revision */
+static svn_revnum_t dump_diff_base(session_t *session, dump_options_t *opts, svn_revnum_t global_rev)
+{
+	svn_revnum_t diff_rev = global_rev - 1;
+	if (diff_rev < 0) {
+		diff_rev = 0;
+	}
+	if (/*(strlen(session->prefix) > 0) &&*/ diff_rev < opts->start) {
+#ifdef USE_SINGLEFILE_DUMP
+		/* TODO: This isn't working well with single files
+		 * and a revision range */
+		if (session->file) {
+			diff_rev = opts->end;
+		} else {
+			diff_rev = opts->start;
+		}
+#else
+		diff_rev = opts->start;
+#endif
+	}
+	return diff_rev;
+}
+
+
+#if APR_HAS_THREADS
+
+/* Thread function for fetching a diff into a spool file */
+static void * APR_THREAD_FUNC dump_prefetch_thread(apr_thread_t *thread, void *data)
+{
+	dump_prefetch_t *pf = data;
+	const svn_delta_editor_t *editor;
+	void *editor_baton;
+	svn_error_t *err;
+
+	if ((err = spool_get_editor(pf->spool_path, &editor, &editor_baton, pf->pool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		pf->ret = 1;
+	} else {
+		pf->ret = dump_do_diff(pf->session, &pf->opts, pf->src, pf->dest, pf->start_empty, NULL, editor, editor_baton, pf->pool);
+	}
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+/* Starts fetching a diff in the background. Returns NULL on failure */
+static dump_prefetch_t *dump_prefetch_start(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty)
+{
+	apr_pool_t *pool = svn_pool_create(NULL);
+	dump_prefetch_t *pf = apr_pcalloc(pool, sizeof(dump_prefetch_t));
+	apr_file_t *file;
+	apr_status_t status;
+
+	pf->session = session;
+	pf->opts = *opts;
+	pf->src = src;
+	pf->dest = dest;
+	pf->start_empty = start_empty;
+	pf->pool = pool;
+	pf->ret = 1;
+
+	/* The spool file is created here to get a unique name */
+	pf->spool_path = apr_psprintf(pool, "%s/spool/XXXXXX", opts->temp_dir);
+	if ((status = utils_mkstemp(&file, pf->spool_path, pool)) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to create temporary file in %s\n"), opts->temp_dir);
+		svn_pool_destroy(pool);
+		return NULL;
+	}
+	apr_file_close(file);
+
+	DEBUG_MSG("prefetching diff %ld against %ld into %s\n", dest, src, pf->spool_path);
+	if ((status = apr_thread_create(&pf->thread, NULL, dump_prefetch_thread, pf, pool)) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to create prefetching thread\n"));
+		apr_file_remove(pf->spool_path, pool);
+		svn_pool_destroy(pool);
+		return NULL;
+	}
+	return pf;
+}
+
+
+/* Checks whether the diff of a revision may be fetched in the background.
+   Revisions that copy files are diffed directly, as the local copies of the
+   copy sources can only be reported to the server once the previous
+   revision has been dumped (see delta_prepare_links()) */
+static char dump_prefetch_eligible(log_revision_t *log, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	if (log->changed_paths == NULL) {
+		return 1;
+	}
+	for (hi = apr_hash_first(pool, log->changed_paths); hi; hi = apr_hash_next(hi)) {
+		svn_log_changed_path_t *info;
+		apr_hash_this(hi, NULL, NULL, (void **)&info);
+		if (info->action == 'A' && info->copyfrom_path != NULL) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Waits for a background diff to finish. Returns the status of the diff */
+static char dump_prefetch_wait(dump_prefetch_t *pf)
+{
+	apr_status_t retval;
+
+	if (pf->thread != NULL) {
+		apr_thread_join(&retval, pf->thread);
+		pf->thread = NULL;
+	}
+	return pf->ret;
+}
+
+
+/* Waits for a background diff and frees all associated resources */
+static void dump_prefetch_free(dump_prefetch_t *pf)
+{
+	dump_prefetch_wait(pf);
+	apr_file_remove(pf->spool_path, pf->pool);
+	svn_pool_destroy(pf->pool);
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+#ifndef WIN32
+
+/* Dumps a single shard of a parallel dump to the given file. This
+   function is run in a child process and never returns */
+static void dump_run_shard(session_t *session, dump_options_t *opts, const char *path)
+{
+	session_t shard_session;
+	char ret = 1;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		fprintf(stderr, _("ERROR: Unable to open %s for writing\n"), path);
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/* The parent's RA connection must not be shared */
+	shard_session = session_clone(session);
+	if (apr_dir_make(opts->temp_dir, APR_UREAD | APR_UWRITE | APR_UEXECUTE, shard_session.pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to create temporary directory.\n"));
+	} else if (session_open(&shard_session) == 0) {
+		ret = dump(&shard_session, opts);
+		session_close(&shard_session);
+	}
+
+	_exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/* Appends the contents of a file to the given output */
+static char dump_append_file(output_t *out, const char *path)
+{
+	if (output_file(out, path) != 0) {
+		fprintf(stderr, _("ERROR: Unable to append %s to the dump output (%s)\n"), path, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+#endif /* !WIN32 */
+
+
+/* Initializes the replay engine */
+static char dump_replay_init(dump_replay_t *replay, session_t *session, dump_options_t *opts, apr_array_header_t *logs, svn_revnum_t start)
+{
+	replay->enabled = 0;
+	replay->logs = NULL;
+	replay->logs_start = 0;
+	replay->index = 0;
+	replay->pool = svn_pool_create(session->pool);
+	replay->spools = apr_hash_make(replay->pool);
+	replay->temp_dir = opts->temp_dir;
+
+	if (!(opts->flags & DF_REPLAY)) {
+		return 0;
+	}
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR < 5)
+	fprintf(stderr, _("WARNING: Replaying revisions requires Subversion 1.5 or later, ignoring\n"));
+	return 0;
+#endif
+
+	/*
+	 * The paths of replayed editor drives are not relative to the session
+	 * URL, so the diff engine is used for subdirectories.
+	 */
+	if (strlen(session->prefix) > 0) {
+		L1(_("Replaying revisions is only possible for repository roots, using diffs\n"));
+		return 0;
+	}
+
+	/* The logs are needed in advance in order to group revisions */
+	if (logs != NULL) {
+		replay->logs = logs;
+	} else {
+		replay->logs_start = (start > 0 ? start : 1);
+		replay->logs = apr_array_make(session->pool, 0, sizeof(log_revision_t));
+		if (replay->logs_start <= opts->end && log_fetch_all(session, replay->logs_start, opts->end, replay->logs)) {
+			return 1;
+		}
+	}
+
+	replay->enabled = 1;
+	return 0;
+}
+
+
+/* Searches the replay logs for the first revision not lower than rev */
+static log_revision_t *dump_replay_seek(dump_replay_t *replay, svn_revnum_t rev)
+{
+	while (replay->index < replay->logs->nelts && APR_ARRAY_IDX(replay->logs, replay->index, log_revision_t).revision < rev) {
+		++replay->index;
+	}
+	if (replay->index >= replay->logs->nelts) {
+		return NULL;
+	}
+	return &APR_ARRAY_IDX(replay->logs, replay->index, log_revision_t);
+}
+
+
+/*
+ * Checks whether a revision log allows dumping by replaying it. The editor
+ * drive of a replay will contain copy information that the delta editor
+ * is not prepared for, so only revisions containing plain additions,
+ * modifications and deletions are allowed.
+ */
+static char dump_replay_check_log(log_revision_t *log, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	if (log->changed_paths == NULL) {
+		return 1;
+	}
+	for (hi = apr_hash_first(pool, log->changed_paths); hi; hi = apr_hash_next(hi)) {
+		svn_log_changed_path_t *entry;
+		apr_hash_this(hi, NULL, NULL, (void **)&entry);
+		if (entry->action == 'R' || entry->copyfrom_path != NULL) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Checks whether a revision can be dumped by replaying it */
+static char dump_replay_eligible(dump_replay_t *replay, svn_revnum_t rev, apr_pool_t *pool)
+{
+	log_revision_t *log;
+
+	if (!replay->enabled || (log = dump_replay_seek(replay, rev)) == NULL || log->revision != rev) {
+		return 0;
+	}
+	return dump_replay_check_log(log, pool);
+}
+
+
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5)
+
+/* Replay callback: Returns a spool editor for a single revision */
+static svn_error_t *dump_replay_revstart(svn_revnum_t revision, void *replay_baton, const svn_delta_editor_t **editor, void **edit_baton, apr_hash_t *rev_props, apr_pool_t *pool)
+{
+	dump_replay_t *replay = replay_baton;
+	char *path = apr_psprintf(replay->pool, "%s/replay/XXXXXX", replay->temp_dir);
+	svn_revnum_t *key;
+	apr_file_t *file;
+	apr_status_t status;
+
+	if ((status = utils_mkstemp(&file, path, pool)) != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", replay->temp_dir);
+	}
+	apr_file_close(file);
+
+	key = apr_palloc(replay->pool, sizeof(svn_revnum_t));
+	*key = revision;
+	apr_hash_set(replay->spools, key, sizeof(svn_revnum_t), path);
+
+	DEBUG_MSG("dump_replay_revstart: spooling revision %ld to %s\n", revision, path);
+	return spool_get_editor(path, editor, edit_baton, replay->pool);
+}
+
+
+/* Replay callback: Finishes the editor drive of a single revision */
+static svn_error_t *dump_replay_revfinish(svn_revnum_t revision, void *replay_baton, const svn_delta_editor_t *editor, void *edit_baton, apr_hash_t *rev_props, apr_pool_t *pool)
+{
+	return editor->close_edit(edit_baton, pool);
+}
+
+#endif
+
+
+/* Removes all spooled revisions */
+static void dump_replay_clear(dump_replay_t *replay)
+{
+	apr_hash_index_t *hi;
+
+	for (hi = apr_hash_first(replay->pool, replay->spools); hi; hi = apr_hash_next(hi)) {
+		const char *path;
+		apr_hash_this(hi, NULL, NULL, (void **)&path);
+		apr_file_remove(path, replay->pool);
+	}
+	svn_pool_clear(replay->pool);
+	replay->spools = apr_hash_make(replay->pool);
+}
+
+
+/* Returns the spool file of a revision if it can be replayed. The given
+   revision and possibly some following ones are replayed if necessary */
+static char dump_replay_fetch(dump_replay_t *replay, session_t *session, dump_options_t *opts, svn_revnum_t rev, const char **path, apr_pool_t *pool)
+{
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5)
+	svn_error_t *err;
+	svn_revnum_t end = rev;
+	int i;
+#endif
+
+	*path = NULL;
+	if (!dump_replay_eligible(replay, rev, pool)) {
+		return 0;
+	}
+	if ((*path = apr_hash_get(replay->spools, &rev, sizeof(svn_revnum_t))) != NULL) {
+		return 0;
+	}
+
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5)
+	/* Determine the range of consecutive revisions that can be replayed */
+	dump_replay_clear(replay);
+	for (i = replay->index + 1; i < replay->logs->nelts && i - replay->index < REPLAY_GROUP_SIZE; i++) {
+		log_revision_t *log = &APR_ARRAY_IDX(replay->logs, i, log_revision_t);
+		if (log->revision != end + 1 || log->revision > opts->end || !dump_replay_check_log(log, pool)) {
+			break;
+		}
+		end = log->revision;
+	}
+
+	DEBUG_MSG("dump_replay_fetch: replaying %ld:%ld\n", rev, end);
+	err = svn_ra_replay_range(session->ra, rev, end, 0, !(opts->flags & DF_DRY_RUN), dump_replay_revstart, dump_replay_revfinish, replay, pool);
+	if (err) {
+		if (err->apr_err == SVN_ERR_RA_NOT_IMPLEMENTED || err->apr_err == SVN_ERR_UNSUPPORTED_FEATURE) {
+			L1(_("Replaying revisions is not supported by the server, falling back to diffs\n"));
+			svn_error_clear(err);
+			dump_replay_clear(replay);
+			replay->enabled = 0;
+			return 0;
+		}
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		dump_replay_clear(replay);
+		return 1;
+	}
+
+	*path = apr_hash_get(replay->spools, &rev, sizeof(svn_revnum_t));
+	if (*path == NULL) {
+		fprintf(stderr, _("ERROR: Revision %ld has not been replayed by the server\n"), rev);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+
+/* Removes the spool file of a replayed revision */
+static void dump_replay_done(dump_replay_t *replay, svn_revnum_t rev)
+{
+	const char *path = apr_hash_get(replay->spools, &rev, sizeof(svn_revnum_t));
+	if (path != NULL) {
+		apr_file_remove(path, replay->pool);
+		apr_hash_set(replay->spools, &rev, sizeof(svn_revnum_t), NULL);
+	}
+}
+
+
+/* Fetches the log of the next revision, either directly, from the logs
+   of the replay engine or from a log window */
+static char dump_fetch_log(session_t *session, dump_replay_t *replay, log_window_t *window, svn_revnum_t rev, svn_revnum_t end, log_revision_t *log, apr_pool_t *pool)
+{
+	if (replay->logs_start > 0 && rev >= replay->logs_start) {
+		log_revision_t *entry = dump_replay_seek(replay, rev);
+		if (entry == NULL) {
+			fprintf(stderr, _("ERROR: No more revision logs available\n"));
+			return 1;
+		}
+		*log = *entry;
+		return 0;
+	}
+	if (window == NULL) {
+		return log_fetch_single(session, rev, end, log, pool);
+	}
+
+	do {
+		if (log_window_next(window, log)) {
+			return 1;
+		}
+	} while (log->revision < rev);
+	return 0;
+}
+
+
 /* Determines the correct end revision of a repository */
 static char dump_determine_end(session_t *session, svn_revnum_t *rev)
 {
@@ -251,6 +753,266 @@ static char dump_fetch_uuid(session_t *session, const char **uuid)
 }
 
 
+/* Removes transient files from the state directory. The local file copies
+   are only kept when resuming, as they are referenced by the checkpoint */
+static void dump_state_clean(dump_options_t *opts, char resume, apr_pool_t *pool)
+{
+	utils_rrmdir(pool, apr_psprintf(pool, "%s/df", opts->state_dir), 1);
+	utils_rrmdir(pool, apr_psprintf(pool, "%s/spool", opts->state_dir), 1);
+	utils_rrmdir(pool, apr_psprintf(pool, "%s/replay", opts->state_dir), 1);
+	if (!resume) {
+		utils_rrmdir(pool, apr_psprintf(pool, "%s/td", opts->state_dir), 1);
+	}
+}
+
+
+/* Writes a checkpoint of the dump state, covering all revisions up to the given log index */
+static char dump_state_save(session_t *session, dump_options_t *opts, svn_revnum_t global_rev, svn_revnum_t local_rev, output_t *output, apr_array_header_t *logs, int list_idx, path_repo_t *path_repo, property_storage_t *property_storage, delta_context_t *delta_ctx, apr_pool_t *pool)
+{
+	const char *path = apr_psprintf(pool, "%s/%s", opts->state_dir, STATE_FILE);
+	state_file_t *sf;
+	apr_off_t position;
+	int i;
+
+	/* The checkpoint must not cover output that hasn't been written yet */
+	if (output_flush(output) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write dump output (%s)\n"), strerror(errno));
+		return 1;
+	}
+	position = output_position(output);
+
+	if ((sf = state_file_create(path, pool)) == NULL) {
+		fprintf(stderr, _("ERROR: Unable to create state file %s\n"), path);
+		return 1;
+	}
+	if (state_write_string(sf, STATE_MAGIC) != 0
+		|| state_write_int(sf, STATE_VERSION) != 0
+		|| state_write_string(sf, session->url) != 0
+		|| state_write_string(sf, opts->prefix) != 0
+		|| state_write_int(sf, opts->flags & STATE_FLAGS) != 0
+		|| state_write_int(sf, opts->start) != 0
+		|| state_write_int(sf, global_rev) != 0
+		|| state_write_int(sf, local_rev) != 0
+		|| state_write_int(sf, position) != 0
+		|| state_write_int(sf, list_idx+1) != 0) {
+		goto write_error;
+	}
+	for (i = 0; i <= list_idx; i++) {
+		if (state_write_int(sf, APR_ARRAY_IDX(logs, i, log_revision_t).revision) != 0) {
+			goto write_error;
+		}
+	}
+	if (path_repo_save(path_repo, sf) != 0
+		|| property_storage_save(property_storage, sf, pool) != 0
+		|| delta_save_state(delta_ctx, sf, pool) != 0) {
+		goto write_error;
+	}
+	if (state_file_commit(sf) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write state file %s\n"), path);
+		return 1;
+	}
+	DEBUG_MSG("dump_state_save: global_rev = %ld, local_rev = %ld, position = %ld\n", global_rev, local_rev, (long)position);
+
+	/* Local file copies replaced since the previous checkpoint aren't needed any more */
+	delta_release_files(delta_ctx);
+	return 0;
+
+write_error:
+	fprintf(stderr, _("ERROR: Unable to write state file %s\n"), path);
+	state_file_close(sf);
+	return 1;
+}
+
+
+/* Reads the header of a checkpoint, restoring the revision counters and
+   checking that the dump options haven't changed */
+static char dump_state_load_header(state_file_t *sf, session_t *session, dump_options_t *opts, svn_revnum_t *global_rev, svn_revnum_t *local_rev, apr_off_t *position, apr_pool_t *pool)
+{
+	char *magic, *url, *prefix;
+	apr_int64_t version, flags, start, grev, lrev, pos;
+
+	if (state_read_string(sf, &magic, pool) != 0 || magic == NULL || strcmp(magic, STATE_MAGIC)
+		|| state_read_int(sf, &version) != 0 || version != STATE_VERSION) {
+		fprintf(stderr, _("ERROR: The state directory %s contains an invalid state file\n"), opts->state_dir);
+		return 1;
+	}
+	if (state_read_string(sf, &url, pool) != 0
+		|| state_read_string(sf, &prefix, pool) != 0
+		|| state_read_int(sf, &flags) != 0
+		|| state_read_int(sf, &start) != 0
+		|| state_read_int(sf, &grev) != 0
+		|| state_read_int(sf, &lrev) != 0
+		|| state_read_int(sf, &pos) != 0) {
+		fprintf(stderr, _("ERROR: Unable to read the state file in %s\n"), opts->state_dir);
+		return 1;
+	}
+
+	/* The user prefix has been stored after being cleaned up */
+	dump_create_user_prefix(NULL, opts, session->pool, 0);
+	if (url == NULL || strcmp(url, session->url)
+		|| (prefix == NULL) != (opts->prefix == NULL)
+		|| (prefix != NULL && strcmp(prefix, opts->prefix))
+		|| flags != (opts->flags & STATE_FLAGS)) {
+		fprintf(stderr, _("ERROR: The state in %s belongs to a dump with different options\n"), opts->state_dir);
+		return 1;
+	}
+
+	opts->start = (svn_revnum_t)start;
+	*global_rev = (svn_revnum_t)grev;
+	*local_rev = (svn_revnum_t)lrev;
+	*position = (apr_off_t)pos;
+	return 0;
+}
+
+
+/* Restores the revision logs and the dump data structures from a checkpoint */
+static char dump_state_load(state_file_t *sf, dump_options_t *opts, apr_array_header_t *logs, path_repo_t *path_repo, property_storage_t *property_storage, delta_context_t *delta_ctx, apr_pool_t *pool)
+{
+	apr_int64_t n, rev;
+
+	/* Only the revision numbers of previous logs are needed */
+	apr_array_clear(logs);
+	if (state_read_int(sf, &n) != 0) {
+		goto read_error;
+	}
+	while (n-- > 0) {
+		log_revision_t log;
+		if (state_read_int(sf, &rev) != 0) {
+			goto read_error;
+		}
+		log.revision = (svn_revnum_t)rev;
+		log.author = NULL;
+		log.date = NULL;
+		log.message = NULL;
+		log.changed_paths = NULL;
+		APR_ARRAY_PUSH(logs, log_revision_t) = log;
+	}
+
+	if (path_repo_load(path_repo, sf, pool) != 0
+		|| property_storage_load(property_storage, sf, pool) != 0
+		|| delta_load_state(delta_ctx, sf, opts, pool) != 0) {
+		goto read_error;
+	}
+	return 0;
+
+read_error:
+	fprintf(stderr, _("ERROR: Unable to read the state file in %s\n"), opts->state_dir);
+	return 1;
+}
+
+
+/* Writes the dumpfile header */
+static char dump_header(output_t *out, session_t *session, dump_options_t *opts)
+{
+	output_printf(out, "%s: %d\n\n", SVN_REPOS_DUMPFILE_MAGIC_HEADER, opts->dump_format);
+	if ((opts->prefix == NULL) && (strlen(session->prefix) == 0)) {
+		const char *uuid;
+		if (dump_fetch_uuid(session, &uuid)) {
+			return 1;
+		}
+		output_printf(out, "UUID: %s\n\n", uuid);
+	}
+	return 0;
+}
+
+
+/* Starts a new rotated output file */
+static char dump_rotate_start(output_t *out, dump_options_t *opts, apr_pool_t *pool)
+{
+	const char *path = apr_psprintf(pool, "%s.part", opts->rotate_prefix);
+
+	if (output_open_file(out, path) != 0) {
+		fprintf(stderr, _("ERROR: Unable to open output file %s (%s)\n"), path, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+
+/* Finishes the current rotated output file, naming it after the local revisions it contains */
+static char dump_rotate_finish(output_t *out, dump_options_t *opts, svn_revnum_t first, svn_revnum_t last, apr_pool_t *pool)
+{
+	const char *part = apr_psprintf(pool, "%s.part", opts->rotate_prefix);
+	const char *path;
+
+	if (output_close_file(out) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write output file %s (%s)\n"), part, strerror(errno));
+		return 1;
+	}
+
+	/* Files without revisions are not needed */
+	if (last < first) {
+		apr_file_remove(part, pool);
+		return 0;
+	}
+
+	path = apr_psprintf(pool, "%s-%ld-%ld", opts->rotate_prefix, first, last);
+	if (apr_file_rename(part, path, pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to rename %s to %s\n"), part, path);
+		return 1;
+	}
+	L1(_("Finished output file %s\n"), path);
+	return 0;
+}
+
+
+/* Signal handler for leaving watch mode */
+static void dump_watch_signal(int sig)
+{
+	watch_stop = 1;
+	(void)sig;
+}
+
+
+/* Waits until new revisions are available and extends the revision range
+   accordingly. Returns -1 if interrupted and 1 on errors */
+static int dump_watch_wait(session_t *session, dump_options_t *opts, apr_array_header_t *logs, char logs_fetched, dump_replay_t *replay)
+{
+	void (*prev_int)(int), (*prev_term)(int);
+	svn_revnum_t head = opts->end;
+	int i, ret = 0;
+
+	/* Termination requests are only handled gracefully while waiting */
+	watch_stop = 0;
+	prev_int = signal(SIGINT, dump_watch_signal);
+	prev_term = signal(SIGTERM, dump_watch_signal);
+
+	L2(_("Waiting for new revisions after original revision %ld\n"), opts->end);
+	while (head <= opts->end) {
+		for (i = 0; i < opts->watch_interval && !watch_stop; i++) {
+			apr_sleep(apr_time_from_sec(1));
+		}
+		if (watch_stop) {
+			ret = -1;
+			break;
+		}
+
+		head = -1; /* HEAD */
+		if (dump_determine_end(session, &head)) {
+			ret = 1;
+			break;
+		}
+		DEBUG_MSG("dump_watch_wait: head = %ld, end = %ld\n", head, opts->end);
+	}
+
+	signal(SIGINT, prev_int);
+	signal(SIGTERM, prev_term);
+	if (ret != 0) {
+		return ret;
+	}
+
+	/* Extend the logs that have been fetched in advance */
+	if (logs_fetched && log_fetch_all(session, opts->end+1, head, logs)) {
+		return 1;
+	}
+	if (replay->enabled && replay->logs != logs && log_fetch_all(session, opts->end+1, head, replay->logs)) {
+		return 1;
+	}
+	opts->end = head;
+	return 0;
+}
+
+
 /*---------------------------------------------------------------------------*/
 /* Global functions                                                          */
 /*---------------------------------------------------------------------------*/
@@ -269,6 +1031,19 @@ dump_options_t dump_options_create()
 	opts.start = 0;
 	opts.end = -1; /* HEAD */
 
+	opts.jobs = 1;
+	opts.log_window_size = 0;
+	opts.index_file = NULL;
+	opts.state_dir = NULL;
+	opts.watch_interval = 0;
+	opts.rotate_prefix = NULL;
+	opts.small_text_size = 8192;
+	opts.delta_threads = 1;
+	opts.delta_format = 0;
+	opts.delta_compression = 5;
+	opts.path_snapshot_size = 1<<20;
+	opts.path_cache_size = 256;
+
 	return opts;
 }
 
@@ -285,18 +1060,46 @@ char dump(session_t *session, dump_options_t *opts)
 {
 	apr_array_header_t *logs = NULL;
 	char logs_fetched = 0, ret = 0;
-	char start_mid = 0, show_local_rev = 1;
-	svn_revnum_t global_rev, local_rev = -1;
-	int list_idx;
+	char start_mid = 0, show_local_rev = 1, resume = 0;
+	svn_revnum_t global_rev = 0, local_rev = -1, batch_first;
+	int list_idx, mukv_flags = 0;
 	path_repo_t *path_repo;
 	property_storage_t *property_storage;
+	delta_context_t *delta_ctx;
 	delta_editor_info_t delta_info;
+	output_t *output;
+	revindex_t *revindex = NULL;
+	log_window_t *log_window = NULL;
+	apr_pool_t *log_window_pool = NULL;
+	dump_replay_t replay;
+	state_file_t *state = NULL;
+	apr_off_t resume_position = -1;
+	apr_time_t last_checkpoint;
+#if APR_HAS_THREADS
+	session_t prefetch_session;
+	char prefetch_session_open = 0;
+	dump_prefetch_t *prefetch = NULL;
+	log_revision_t next_log;
+	apr_pool_t *log_pool = NULL;
+	apr_pool_t *next_log_pool = NULL;
+#endif
 
 	/* Dumping with deltas requires dump format version 3 */
 	if (opts->flags & DF_USE_DELTAS) {
 		opts->dump_format = 3;
 	}
 
+#if !APR_HAS_THREADS
+	if (opts->flags & DF_PREFETCH) {
+		fprintf(stderr, _("WARNING: Prefetching is not supported without thread support, ignoring\n"));
+		opts->flags &= ~DF_PREFETCH;
+	}
+	if (opts->delta_threads > 1) {
+		fprintf(stderr, _("WARNING: Deltifying in parallel is not supported without thread support, ignoring\n"));
+		opts->delta_threads = 1;
+	}
+#endif
+
 	/*
 	 * If start_mid is set, it is assumed we start somewhere (not at the beginning)
 	 * of the history and don't need information about prior revisions inside
@@ -324,6 +1127,47 @@ char dump(session_t *session, dump_options_t *opts)
 	}
 	DEBUG_MSG("adjusted range: %ld:%ld\n", opts->start, opts->end);
 
+	/* All state that is shared by the revisions is kept in this context */
+	delta_ctx = delta_context_create(session->pool);
+
+	/* Continue after the last checkpoint if there is one */
+	if (opts->state_dir != NULL) {
+		state = state_file_open(apr_psprintf(session->pool, "%s/%s", opts->state_dir, STATE_FILE), session->pool);
+		if (state != NULL) {
+			if (dump_state_load_header(state, session, opts, &global_rev, &local_rev, &resume_position, session->pool)) {
+				state_file_close(state);
+				return 1;
+			}
+			resume = 1;
+			start_mid = 0;
+		}
+		dump_state_clean(opts, resume, session->pool);
+		mukv_flags = MUKV_PERSISTENT | (resume ? MUKV_RESUME : 0);
+		delta_defer_removal(delta_ctx, session->pool);
+	}
+
+	output = output_create_stdout(session->pool);
+	if ((opts->flags & DF_COMPRESS) && output_compress(output, 0) != 0) {
+		fprintf(stderr, _("ERROR: Unable to set up output compression (%s)\n"), strerror(errno));
+		return 1;
+	}
+
+	/* Discard output written after the checkpoint */
+	if (resume && opts->rotate_prefix == NULL) {
+		if (resume_position >= 0 && output_truncate(output, resume_position) != 0 && errno == ERANGE) {
+			fprintf(stderr, _("ERROR: The dump output is shorter than at the last checkpoint.\n"));
+			fprintf(stderr, _("Please append to the previous output when resuming a dump.\n"));
+			state_file_close(state);
+			return 1;
+		} else if (resume_position < 0 || output_position(output) != resume_position) {
+			fprintf(stderr, _("WARNING: Unable to position the dump output. Make sure it continues the\n" \
+			                  "         previous output after local revision %ld.\n"), local_rev-1);
+		}
+	}
+	if (resume) {
+		L1(_("Resuming dump at original revision %ld\n"), global_rev);
+	}
+
 	/*
 	 * Check if we need to reparent the RA session. This is needed if we
 	 * are only dumping the history of a single file. Else, svn_ra_do_diff()
@@ -348,20 +1192,27 @@ char dump(session_t *session, dump_options_t *opts)
 		APR_ARRAY_PUSH(logs, log_revision_t) = dummy;
 	}
 
-	property_storage = property_storage_create(opts->temp_dir, session->pool);
+	property_storage = property_storage_create(opts->temp_dir, mukv_flags, session->pool);
 	if (property_storage == NULL) {
 		return 1;
 	}
-	path_repo = path_repo_create(opts->temp_dir, session->pool);
+	path_repo = path_repo_create(opts->temp_dir, mukv_flags, (apr_size_t)opts->path_snapshot_size, (apr_size_t)opts->path_cache_size << 20, session->pool);
 	if (path_repo == NULL) {
 		return 1;
 	}
 
 	/*
 	 * Decide whether the whole repository log should be fetched
-	 * prior to dumping.
+	 * prior to dumping. When resuming, the tree history and the base
+	 * revision are restored from the checkpoint instead.
 	 */
-	if (start_mid) {
+	if (resume) {
+		char err = dump_state_load(state, opts, logs, path_repo, property_storage, delta_ctx, session->pool);
+		state_file_close(state);
+		if (err) {
+			return 1;
+		}
+	} else if (start_mid) {
 		apr_pool_t *log_pool = svn_pool_create(session->pool);
 
 		if (log_fetch_all(session, 0, opts->end, logs)) {
@@ -398,6 +1249,10 @@ char dump(session_t *session, dump_options_t *opts)
 		}
 		opts->start = APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision;
 
+		/* The user prefix has already been created in a previous dump,
+		   but it should be cleaned up the same way */
+		dump_create_user_prefix(output, opts, session->pool, 0);
+
 		svn_pool_destroy(log_pool);
 	} else {
 		/* There aren't any subdirectories at revision 0 */
@@ -406,18 +1261,31 @@ char dump(session_t *session, dump_options_t *opts)
 		}
 	}
 
-	/* Write dumpfile header */
-	if (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || !start_mid) {
-		printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_MAGIC_HEADER, opts->dump_format);
-		if ((opts->prefix == NULL) && (strlen(session->prefix) == 0)) {
-			const char *uuid;
-			if (dump_fetch_uuid(session, &uuid)) {
+	/* Write dumpfile header. Every rotated output file gets its own one. */
+	if (opts->rotate_prefix != NULL) {
+		if (dump_rotate_start(output, opts, session->pool)) {
+			return 1;
+		}
+		if (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || (!resume && !start_mid)) {
+			if (dump_header(output, session, opts)) {
 				return 1;
 			}
-			printf("UUID: %s\n\n", uuid);
+		}
+	} else if (!resume && (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || !start_mid)) {
+		if (dump_header(output, session, opts)) {
+			return 1;
 		}
 	}
 
+	/* Start the revision index once the header has been written */
+	if (opts->index_file != NULL) {
+		revindex = revindex_create(opts->index_file, session->pool);
+		if (revindex == NULL) {
+			return 1;
+		}
+		revindex_set_header(revindex, output_tell(output));
+	}
+
 	/* Determine end revision if neccessary */
 	if (logs_fetched) {
 		opts->end = APR_ARRAY_IDX(logs, logs->nelts-1, log_revision_t).revision;
@@ -425,11 +1293,15 @@ char dump(session_t *session, dump_options_t *opts)
 	}
 
 	/* Pre-dumping initialization */
-	global_rev = opts->start;
-	if (!start_mid) {
+	if (resume) {
+		/* The revision counters have been restored from the checkpoint */
+		list_idx = logs->nelts-1;
+	} else if (!start_mid) {
+		global_rev = opts->start;
 		local_rev = global_rev == 0 ? 0 : 1;
 		list_idx = 0;
 	} else {
+		global_rev = opts->start;
 		list_idx = local_rev-1;
 		if (opts->flags & DF_KEEP_REVNUMS) {
 			local_rev = opts->start;
@@ -441,26 +1313,115 @@ char dump(session_t *session, dump_options_t *opts)
 		show_local_rev = 0;
 	}
 
+	/* Prepare the replay engine */
+	if (dump_replay_init(&replay, session, opts, (logs_fetched ? logs : NULL), global_rev)) {
+		return 1;
+	}
+
+	/* Fetch logs in batches if requested */
+	if (!logs_fetched && !replay.enabled && opts->log_window_size > 0) {
+		log_window_pool = svn_pool_create(session->pool);
+		log_window = log_window_create(session, global_rev, opts->end, opts->log_window_size, log_window_pool);
+		if (log_window == NULL) {
+			svn_pool_destroy(log_window_pool);
+			return 1;
+		}
+	}
+
 	/* Setup delta editor information */
+	delta_info.context = delta_ctx;
 	delta_info.session = session;
 	delta_info.options = opts;
 	delta_info.path_repo = path_repo;
 	delta_info.property_storage = property_storage;
 	delta_info.logs = logs;
+	delta_info.output = output;
 
 	/* Start dumping */
+	last_checkpoint = apr_time_now();
+	batch_first = local_rev + ((opts->flags & DF_INITIAL_DRY_RUN) ? 1 : 0);
 	do {
 		svn_delta_editor_t *editor;
 		void *editor_baton;
 		svn_revnum_t diff_rev;
+		const char *replay_path = NULL;
+		apr_array_header_t *links = NULL;
+		char prefetched = 0;
+		apr_off_t rev_offset;
 		apr_pool_t *revpool = svn_pool_create(session->pool);
+#if APR_HAS_THREADS
+		dump_prefetch_t *current;
+#endif
 
 		DEBUG_MSG("dump loop start: local_rev = %ld, global_rev = %ld, list_idx = %d\n", local_rev, global_rev, list_idx);
 
+		/* In watch mode, wait for new revisions once all available ones have been dumped */
+		if (opts->watch_interval > 0 && global_rev > opts->end) {
+			int wait_ret;
+
+			if (opts->rotate_prefix != NULL) {
+				/* The checkpoint must not refer to unfinished output files */
+				if (dump_rotate_finish(output, opts, batch_first, local_rev-1, revpool)
+					|| (opts->state_dir != NULL && dump_state_save(session, opts, global_rev, local_rev, output, logs, list_idx, path_repo, property_storage, delta_ctx, revpool))) {
+					ret = 1;
+					apr_pool_destroy(revpool);
+					break;
+				}
+			} else if (output_flush(output) != 0) {
+				fprintf(stderr, _("ERROR: Unable to write dump output (%s)\n"), strerror(errno));
+				ret = 1;
+				apr_pool_destroy(revpool);
+				break;
+			}
+
+			wait_ret = dump_watch_wait(session, opts, logs, logs_fetched, &replay);
+			if (wait_ret != 0) {
+				/* Leaving watch mode on request is not an error */
+				ret = (wait_ret > 0);
+				apr_pool_destroy(revpool);
+				break;
+			}
+			batch_first = local_rev;
+
+			if (log_window != NULL) {
+				svn_pool_clear(log_window_pool);
+				log_window = log_window_create(session, global_rev, opts->end, opts->log_window_size, log_window_pool);
+				if (log_window == NULL) {
+					ret = 1;
+					apr_pool_destroy(revpool);
+					break;
+				}
+			}
+			if (opts->rotate_prefix != NULL) {
+				if (dump_rotate_start(output, opts, revpool)
+					|| (!(opts->flags & DF_NO_INCREMENTAL_HEADER) && dump_header(output, session, opts))) {
+					ret = 1;
+					apr_pool_destroy(revpool);
+					break;
+				}
+			}
+		}
+
+		/* A resumed dump may already be complete */
+		if (resume && global_rev > opts->end) {
+			L1(_("No new revisions to dump\n"));
+			apr_pool_destroy(revpool);
+			break;
+		}
+
+#if APR_HAS_THREADS
+		if (logs_fetched == 0 && next_log_pool != NULL) {
+			/* The log has already been fetched along with the diff */
+			APR_ARRAY_PUSH(logs, log_revision_t) = next_log;
+			list_idx = logs->nelts-1;
+			log_pool = next_log_pool;
+			next_log_pool = NULL;
+		} else
+#endif
 		if (logs_fetched == 0) {
 			log_revision_t log;
 			L2(_("Fetching log for original revision %ld... "), global_rev);
-			if (log_fetch_single(session, global_rev, opts->end, &log, revpool)) {
+			if (dump_fetch_log(session, &replay, log_window, global_rev, opts->end, &log, revpool)) {
 				ret = 1;
 				L2(_("failed\n"));
 				break;
@@ -477,7 +1438,8 @@ char dump(session_t *session, dump_options_t *opts)
 
 			/* Padd with empty revisions if neccessary */
 			while (local_rev < APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision) {
-				dump_padding_revision(padpool, local_rev);
+				rev_offset = output_tell(output);
+				dump_padding_revision(output, padpool, local_rev);
 				if (path_repo_commit(path_repo, local_rev, padpool) != 0) {
 					ret = 1;
 					break;
@@ -489,7 +1451,11 @@ char dump(session_t *session, dump_options_t *opts)
 				}
 				/* The first revision sets up the user prefix */
 				if (local_rev == 1) {
-					dump_create_user_prefix(opts, session->pool);
+					dump_create_user_prefix(output, opts, session->pool, 1);
+				}
+				if (revindex != NULL && revindex_add(revindex, local_rev, -1, rev_offset, output_tell(output) - rev_offset) != 0) {
+					ret = 1;
+					break;
 				}
 				++local_rev;
 
@@ -502,33 +1468,18 @@ char dump(session_t *session, dump_options_t *opts)
 		}
 
 		/* Dump the revision header */
+		rev_offset = output_tell(output);
 		if (!(opts->flags & DF_INITIAL_DRY_RUN)) {
-			dump_revision_header(revpool, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, opts);
+			dump_revision_header(output, revpool, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, opts);
 
 			/* The first revision sets up the user prefix */
 			if (local_rev == 1) {
-				dump_create_user_prefix(opts, session->pool);
+				dump_create_user_prefix(output, opts, session->pool, 1);
 			}
 		}
 
 		/* Determine the diff base */
-		diff_rev = global_rev - 1;
-		if (diff_rev < 0) {
-			diff_rev = 0;
-		}
-		if (/*(strlen(session->prefix) > 0) &&*/ diff_rev < opts->start) {
-#ifdef USE_SINGLEFILE_DUMP
-			/* TODO: This isn't working well with single files
-			 * and a revision range */
-			if (session->file) {
-				diff_rev = opts->end;
-			} else {
-				diff_rev = opts->start;
-			}
-#else
-			diff_rev = opts->start;
-#endif
-		}
+		diff_rev = dump_diff_base(session, opts, global_rev);
 		DEBUG_MSG("global = %ld, diff = %ld, start = %ld\n", global_rev, diff_rev, opts->start);
 
 		if (!(opts->flags & DF_INITIAL_DRY_RUN)) {
@@ -539,7 +1490,113 @@ char dump(session_t *session, dump_options_t *opts)
 
 		/* Setup the delta editor and run a diff */
 		delta_setup_editor(&delta_info, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, &editor, &editor_baton, revpool);
-		if (dump_do_diff(session, opts, diff_rev, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, (global_rev == opts->start), editor, editor_baton, revpool)) {
+#if APR_HAS_THREADS
+		current = prefetch;
+		prefetch = NULL;
+		if (current != NULL) {
+			/* The diff has been fetched in the background already */
+			if (dump_prefetch_wait(current) != 0) {
+				dump_prefetch_free(current);
+				ret = 1;
+				break;
+			}
+			prefetched = 1;
+		}
+#endif
+
+		/* Use the replay engine for everything but the base revision */
+		if (!prefetched && global_rev != opts->start && !(opts->flags & DF_INITIAL_DRY_RUN)) {
+			if (dump_replay_fetch(&replay, session, opts, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, &replay_path, revpool)) {
+				ret = 1;
+				break;
+			}
+		}
+
+#if APR_HAS_THREADS
+		/*
+		 * Start fetching the diff for the next revision while this one
+		 * is being dumped. The server will send the same diff regardless
+		 * of the local state, so it is recorded to a spool file and
+		 * replayed into the delta editor in the next iteration.
+		 */
+		if ((opts->flags & DF_PREFETCH) && APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision+1 <= opts->end) {
+			svn_revnum_t next_global = APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision+1;
+			log_revision_t *next_log_rev = NULL;
+
+			if (!prefetch_session_open) {
+				prefetch_session = session_clone(session);
+				if (session_open(&prefetch_session) || session_check_reparent(&prefetch_session, opts->start)) {
+					if (current != NULL) {
+						dump_prefetch_free(current);
+					}
+					session_free(&prefetch_session);
+					ret = 1;
+					break;
+				}
+				prefetch_session_open = 1;
+			}
+
+			if (logs_fetched) {
+				if (list_idx+1 < logs->nelts) {
+					next_log_rev = &APR_ARRAY_IDX(logs, list_idx+1, log_revision_t);
+				}
+			} else {
+				next_log_pool = svn_pool_create(session->pool);
+				L2(_("Fetching log for original revision %ld... "), next_global);
+				if (dump_fetch_log(session, &replay, log_window, next_global, opts->end, &next_log, next_log_pool)) {
+					L2(_("failed\n"));
+					if (current != NULL) {
+						dump_prefetch_free(current);
+					}
+					ret = 1;
+					break;
+				}
+				L2(_("done\n"));
+				next_log_rev = &next_log;
+			}
+
+			/* Revisions that will be replayed don't need to be prefetched */
+			if (next_log_rev != NULL && !dump_replay_eligible(&replay, next_log_rev->revision, revpool) && dump_prefetch_eligible(next_log_rev, revpool)) {
+				prefetch = dump_prefetch_start(&prefetch_session, opts, dump_diff_base(session, opts, next_global), next_log_rev->revision, (next_global == opts->start));
+				if (prefetch == NULL) {
+					if (current != NULL) {
+						dump_prefetch_free(current);
+					}
+					ret = 1;
+					break;
+				}
+			}
+		}
+#endif
+
+		if (replay_path != NULL) {
+			svn_error_t *err = spool_replay(replay_path, editor, editor_baton, revpool);
+			dump_replay_done(&replay, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision);
+			if (err) {
+				utils_handle_error(err, stderr, FALSE, "ERROR: ");
+				svn_error_clear(err);
+				ret = 1;
+				break;
+			}
+		} else
+#if APR_HAS_THREADS
+		if (current != NULL) {
+			svn_error_t *err = spool_replay(current->spool_path, editor, editor_baton, revpool);
+			dump_prefetch_free(current);
+			if (err) {
+				utils_handle_error(err, stderr, FALSE, "ERROR: ");
+				svn_error_clear(err);
+				ret = 1;
+				break;
+			}
+		} else
+#endif
+		/*
+		 * Copied files that are available locally are reported as being
+		 * present already, so their texts won't be sent again
+		 */
+		if ((global_rev != opts->start && delta_prepare_links(editor_baton, &links, revpool) != 0)
+			|| dump_do_diff(session, opts, diff_rev, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, (global_rev == opts->start), links, editor, editor_baton, revpool)) {
 			ret = 1;
 			break;
 		}
@@ -570,6 +1627,13 @@ char dump(session_t *session, dump_options_t *opts)
 			break;
 		}
 
+		if (revindex != NULL && !(opts->flags & DF_INITIAL_DRY_RUN)) {
+			if (revindex_add(revindex, local_rev, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, rev_offset, output_tell(output) - rev_offset) != 0) {
+				ret = 1;
+				break;
+			}
+		}
+
 		if (loglevel == 0 && !(opts->flags & DF_INITIAL_DRY_RUN)) {
 			if (show_local_rev) {
 				L0(_("* Dumped revision %ld (local %ld).\n"), APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, local_rev);
@@ -591,8 +1655,45 @@ char dump(session_t *session, dump_options_t *opts)
 		   are dumped dry */
 		opts->flags &= ~DF_INITIAL_DRY_RUN;
 
+		/* Checkpoint the dump state from time to time and after the last revision */
+		if (opts->state_dir != NULL && opts->rotate_prefix == NULL && (global_rev > opts->end || apr_time_now() - last_checkpoint >= STATE_INTERVAL)) {
+			if (dump_state_save(session, opts, global_rev, local_rev, output, logs, list_idx, path_repo, property_storage, delta_ctx, revpool)) {
+				ret = 1;
+				break;
+			}
+			last_checkpoint = apr_time_now();
+		}
+
 		apr_pool_destroy(revpool);
-	} while (global_rev <= opts->end);
+#if APR_HAS_THREADS
+		if (log_pool != NULL) {
+			svn_pool_destroy(log_pool);
+			log_pool = NULL;
+		}
+#endif
+	} while (global_rev <= opts->end || opts->watch_interval > 0);
+
+	if (log_window_pool != NULL) {
+		svn_pool_destroy(log_window_pool);
+	}
+	dump_replay_clear(&replay);
+	svn_pool_destroy(replay.pool);
+
+#if APR_HAS_THREADS
+	/* Clean up after errors */
+	if (prefetch != NULL) {
+		dump_prefetch_free(prefetch);
+	}
+	if (log_pool != NULL) {
+		svn_pool_destroy(log_pool);
+	}
+	if (next_log_pool != NULL) {
+		svn_pool_destroy(next_log_pool);
+	}
+	if (prefetch_session_open) {
+		session_free(&prefetch_session);
+	}
+#endif
 
 #ifdef DEBUG_PATH_REPO
 	if (!strlen(session->prefix) || (opts->flags & DF_KEEP_REVNUMS)) {
@@ -600,6 +1701,154 @@ char dump(session_t *session, dump_options_t *opts)
 	}
 #endif
 
-	delta_cleanup();
+	if (output_flush(output) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write dump output (%s)\n"), strerror(errno));
+		ret = 1;
+	}
+	if (revindex != NULL && revindex_close(revindex) != 0) {
+		ret = 1;
+	}
+
+	delta_cleanup(delta_ctx);
 	return ret;
 }
+
+
+/* Dumps the revision range using multiple worker processes */
+char dump_parallel(session_t *session, dump_options_t *opts)
+{
+#ifndef WIN32
+	apr_array_header_t *logs;
+	apr_pool_t *pool;
+	pid_t *pids;
+	char **paths, **index_paths;
+	output_t *output;
+	revindex_t *revindex = NULL;
+	apr_off_t index_base = 0;
+	svn_revnum_t *starts, *ends;
+	svn_revnum_t start = opts->start, end = opts->end;
+	int i, jobs = opts->jobs;
+	char ret = 0;
+
+	if (jobs <= 1) {
+		return dump(session, opts);
+	}
+
+	/*
+	 * All shards except the first one are bootstrapped like incremental
+	 * dumps, which will only yield the same output if the serial dump
+	 * would have been based on the full history, too.
+	 */
+	if (!(opts->flags & DF_INCREMENTAL) && (opts->start != 0)) {
+		fprintf(stderr, _("ERROR: --jobs requires --incremental if the revision range does not start at 0\n"));
+		return 1;
+	}
+	if (session->flags & SF_OBFUSCATE) {
+		fprintf(stderr, _("ERROR: --jobs can't be used together with --obfuscate\n"));
+		return 1;
+	}
+
+	/* Determine the revisions that will be dumped */
+	if (dump_determine_end(session, &end)) {
+		return 1;
+	}
+	if ((start == 0) && (strlen(session->prefix) > 0)) {
+		if (log_get_range(session, &start, &end)) {
+			return 1;
+		}
+	}
+
+	pool = svn_pool_create(session->pool);
+	logs = apr_array_make(pool, 0, sizeof(log_revision_t));
+	if (log_fetch_all(session, start, end, logs)) {
+		svn_pool_destroy(pool);
+		return 1;
+	}
+	if (logs->nelts < jobs) {
+		jobs = logs->nelts;
+	}
+	if (jobs <= 1) {
+		svn_pool_destroy(pool);
+		return dump(session, opts);
+	}
+
+	/* Split the range evenly by the number of revisions and start the workers */
+	pids = apr_pcalloc(pool, jobs * sizeof(pid_t));
+	paths = apr_pcalloc(pool, jobs * sizeof(char *));
+	index_paths = apr_pcalloc(pool, jobs * sizeof(char *));
+	starts = apr_pcalloc(pool, jobs * sizeof(svn_revnum_t));
+	ends = apr_pcalloc(pool, jobs * sizeof(svn_revnum_t));
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < jobs; i++) {
+		dump_options_t shard_opts = *opts;
+		int first = (int)(((apr_int64_t)i * logs->nelts) / jobs);
+		int last = (int)(((apr_int64_t)(i+1) * logs->nelts) / jobs) - 1;
+
+		shard_opts.jobs = 1;
+		shard_opts.temp_dir = apr_psprintf(pool, "%s/job%d", opts->temp_dir, i);
+		shard_opts.end = APR_ARRAY_IDX(logs, last, log_revision_t).revision;
+		if (i > 0) {
+			shard_opts.start = APR_ARRAY_IDX(logs, first, log_revision_t).revision;
+			shard_opts.flags |= (DF_INCREMENTAL | DF_NO_INCREMENTAL_HEADER);
+		}
+		starts[i] = shard_opts.start;
+		ends[i] = shard_opts.end;
+		paths[i] = apr_psprintf(pool, "%s/job%d.dump", opts->temp_dir, i);
+		if (opts->index_file != NULL) {
+			index_paths[i] = apr_psprintf(pool, "%s/job%d.idx", opts->temp_dir, i);
+			shard_opts.index_file = index_paths[i];
+		}
+
+		DEBUG_MSG("dump_parallel: shard %d: %ld:%ld\n", i, shard_opts.start, shard_opts.end);
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			dump_run_shard(session, &shard_opts, paths[i]);
+		} else if (pids[i] < 0) {
+			fprintf(stderr, _("ERROR: Unable to start worker process\n"));
+			ret = 1;
+			break;
+		}
+	}
+	L1(_("Started %d worker processes\n"), i);
+
+	/* Concatenate the shards in order as soon as they are finished.
+	   With --compress, the shards consist of complete gzip members and
+	   are concatenated as-is. */
+	output = output_create_stdout(pool);
+	if (ret == 0 && opts->index_file != NULL) {
+		revindex = revindex_create(opts->index_file, pool);
+		if (revindex == NULL) {
+			ret = 1;
+		}
+	}
+	for (i = 0; i < jobs && pids[i] > 0; i++) {
+		int status;
+		if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, _("ERROR: Worker process for revisions %ld:%ld failed\n"), starts[i], ends[i]);
+			ret = 1;
+		}
+		if (ret == 0) {
+			ret = dump_append_file(output, paths[i]);
+		}
+		if (ret == 0 && revindex != NULL && revindex_append(revindex, index_paths[i], &index_base, pool) != 0) {
+			ret = 1;
+		}
+		apr_file_remove(paths[i], pool);
+		if (index_paths[i] != NULL) {
+			apr_file_remove(index_paths[i], pool);
+		}
+	}
+	if (revindex != NULL && revindex_close(revindex) != 0) {
+		ret = 1;
+	}
+
+	svn_pool_destroy(pool);
+	return ret;
+#else /* !WIN32 */
+	if (opts->jobs > 1) {
+		fprintf(stderr, _("WARNING: --jobs is not supported on this platform, ignoring\n"));
+	}
+	return dump(session, opts);
+#endif /* !WIN32 */
+}
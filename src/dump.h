@@ -40,7 +40,10 @@ enum dump_flags {
 	DF_INCREMENTAL = 0x04,
 	DF_INITIAL_DRY_RUN = 0x08,
 	DF_NO_INCREMENTAL_HEADER = 0x10,
-	DF_DRY_RUN = 0x20
+	DF_DRY_RUN = 0x20,
+	DF_PREFETCH = 0x40,
+	DF_REPLAY = 0x80,
+	DF_COMPRESS = 0x100
 };
 
 /* Data structure to bundle information related to the dumping process */
@@ -51,6 +54,18 @@ typedef struct {
 	svn_revnum_t  end;
 	int           flags;
 	int           dump_format;
+	int           jobs;
+	int           log_window_size;
+	char          *index_file;
+	char          *state_dir;
+	int           watch_interval;
+	char          *rotate_prefix;
+	int           small_text_size;
+	int           delta_threads;
+	int           delta_format;       /* svndiff version */
+	int           delta_compression;
+	int           path_snapshot_size;
+	int           path_cache_size;    /* In MiB */
 } dump_options_t;
 
 
@@ -63,5 +78,8 @@ extern void dump_options_free(dump_options_t *opts);
 /* Start the dumping process, using the given session and options */
 extern char dump(session_t *session, dump_options_t *opts);
 
+/* Dumps the revision range using multiple worker processes */
+extern char dump_parallel(session_t *session, dump_options_t *opts);
+
 
 #endif
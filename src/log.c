@@ -25,8 +25,13 @@
 #include <svn_pools.h>
 #include <svn_ra.h>
 
+#if APR_HAS_THREADS
+	#include <apr_thread_proc.h>
+#endif
+
 #include "main.h"
 #include "logger.h"
+#include "utils.h"
 
 #include "log.h"
 
@@ -52,6 +57,36 @@ typedef struct {
 } log_receiver_list_baton_t;
 
 
+/* A batch of revision logs fetched with a single request */
+typedef struct {
+	session_t	*session;
+	svn_revnum_t	start;
+	svn_revnum_t	end;
+	int		limit;
+	apr_array_header_t *list;
+	apr_pool_t	*pool;
+#if APR_HAS_THREADS
+	apr_thread_t	*thread;
+#endif
+	char		ret;
+} log_batch_t;
+
+
+/* A window of revision logs */
+struct log_window_t {
+	session_t	*session;
+	session_t	async_session;
+	char		async;
+	svn_revnum_t	end;
+	int		size;
+
+	log_batch_t	*current;
+	int		index;
+	log_batch_t	*retired;
+	log_batch_t	*pending;
+};
+
+
 /* A baton for log_receiver_revnum() */
 typedef struct {
 	svn_revnum_t revnum;
@@ -154,6 +189,23 @@ static svn_error_t *log_receiver_list(void *baton, apr_hash_t *changed_paths, sv
 }
 
 
+/* Callback for svn_ra_get_log() */
+static svn_error_t *log_receiver_batch(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
+{
+	log_batch_t *batch = (log_batch_t *)baton;
+	log_revision_t log;
+	log_receiver_baton_t receiver_baton;
+
+	receiver_baton.log = &log;
+	receiver_baton.session = batch->session;
+	receiver_baton.pool = batch->pool;
+	SVN_ERR(log_receiver(&receiver_baton, changed_paths, revision, author, date, message, pool));
+
+	APR_ARRAY_PUSH(batch->list, log_revision_t) = log;
+	return SVN_NO_ERROR;
+}
+
+
 /* Callback for svn_ra_get_log() */
 static svn_error_t *log_receiver_revnum(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
 {
@@ -163,6 +215,130 @@ static svn_error_t *log_receiver_revnum(void *baton, apr_hash_t *changed_paths,
 }
 
 
+/* Creates a new batch for fetching logs in the given range */
+static log_batch_t *log_batch_create(session_t *session, svn_revnum_t start, svn_revnum_t end, int limit)
+{
+	apr_pool_t *pool = svn_pool_create(NULL);
+	log_batch_t *batch = apr_pcalloc(pool, sizeof(log_batch_t));
+
+	batch->session = session;
+	batch->start = start;
+	batch->end = end;
+	batch->limit = limit;
+	batch->list = apr_array_make(pool, (limit < 64 ? limit : 64), sizeof(log_revision_t));
+	batch->pool = pool;
+	batch->ret = 1;
+	return batch;
+}
+
+
+/* Fetches the logs of a batch */
+static char log_batch_fetch(log_batch_t *batch)
+{
+	svn_error_t *err;
+	apr_array_header_t *paths;
+	apr_pool_t *subpool;
+
+	/* We just need the root */
+	subpool = svn_pool_create(batch->pool);
+	paths = apr_array_make(subpool, 1, sizeof (const char *));
+	APR_ARRAY_PUSH(paths, const char *) = svn_path_canonicalize(".", subpool);
+
+	DEBUG_MSG("log_batch_fetch: fetching %d logs in %ld:%ld\n", batch->limit, batch->start, batch->end);
+	if ((err = svn_ra_get_log(batch->session->ra, paths, batch->start, batch->end, batch->limit, TRUE, TRUE, log_receiver_batch, batch, subpool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(subpool);
+		batch->ret = 1;
+		return 1;
+	}
+
+	svn_pool_destroy(subpool);
+	batch->ret = 0;
+	return 0;
+}
+
+
+#if APR_HAS_THREADS
+
+/* Thread function for fetching a batch in the background */
+static void * APR_THREAD_FUNC log_batch_thread(apr_thread_t *thread, void *data)
+{
+	log_batch_fetch((log_batch_t *)data);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+#endif
+
+
+/* Waits for a batch that is being fetched in the background */
+static char log_batch_wait(log_batch_t *batch)
+{
+#if APR_HAS_THREADS
+	if (batch->thread != NULL) {
+		apr_status_t retval;
+		apr_thread_join(&retval, batch->thread);
+		batch->thread = NULL;
+	}
+#endif
+	return batch->ret;
+}
+
+
+/* Frees a batch */
+static void log_batch_free(log_batch_t *batch)
+{
+	if (batch != NULL) {
+		log_batch_wait(batch);
+		svn_pool_destroy(batch->pool);
+	}
+}
+
+
+/* Starts fetching the batch following the current one */
+static void log_window_refill(log_window_t *win)
+{
+	svn_revnum_t start;
+
+	if (win->current->list->nelts == 0) {
+		return;
+	}
+	start = APR_ARRAY_IDX(win->current->list, win->current->list->nelts-1, log_revision_t).revision + 1;
+	if (start > win->end) {
+		return;
+	}
+
+	win->pending = log_batch_create((win->async ? &win->async_session : win->session), start, win->end, win->size);
+#if APR_HAS_THREADS
+	if (win->async) {
+		if (apr_thread_create(&win->pending->thread, NULL, log_batch_thread, win->pending, win->pending->pool) == APR_SUCCESS) {
+			return;
+		}
+		win->pending->thread = NULL;
+		win->pending->session = win->session;
+	}
+#endif
+	/* The batch will be fetched synchronously on demand */
+	win->pending->ret = -1;
+}
+
+
+/* Pool cleanup function for log windows */
+static apr_status_t log_window_cleanup(void *data)
+{
+	log_window_t *win = (log_window_t *)data;
+
+	log_batch_free(win->pending);
+	log_batch_free(win->current);
+	log_batch_free(win->retired);
+	if (win->async) {
+		session_free(&win->async_session);
+	}
+	return APR_SUCCESS;
+}
+
+
 /*---------------------------------------------------------------------------*/
 /* Global functions                                                          */
 /*---------------------------------------------------------------------------*/
@@ -269,3 +445,84 @@ char log_fetch_all(session_t *session, svn_revnum_t start, svn_revnum_t end, apr
 	svn_pool_destroy(pool);
 	return 0;
 }
+
+
+/* Creates a new log window for the given range */
+log_window_t *log_window_create(session_t *session, svn_revnum_t start, svn_revnum_t end, int size, apr_pool_t *pool)
+{
+	log_window_t *win = apr_pcalloc(pool, sizeof(log_window_t));
+
+	win->session = session;
+	win->end = end;
+	win->size = (size > 0 ? size : 1);
+
+	/*
+	 * The next window is fetched in the background using a separate
+	 * session. This is not possible when obfuscating paths, as the
+	 * obfuscation data is kept in the main session.
+	 */
+#if APR_HAS_THREADS
+	if (!(session->flags & SF_OBFUSCATE)) {
+		win->async_session = session_clone(session);
+		if (session_open(&win->async_session) == 0) {
+			win->async = 1;
+		} else {
+			session_free(&win->async_session);
+		}
+	}
+#endif
+
+	apr_pool_cleanup_register(pool, win, log_window_cleanup, apr_pool_cleanup_null);
+
+	/* Fetch the first window directly */
+	win->current = log_batch_create(session, start, end, win->size);
+	if (log_batch_fetch(win->current)) {
+		return NULL;
+	}
+	log_window_refill(win);
+	return win;
+}
+
+
+/* Returns the next revision log from the window. The log remains valid
+   until this function has been called two more times */
+char log_window_next(log_window_t *win, log_revision_t *log)
+{
+	if (win->index >= win->current->list->nelts) {
+		char ret;
+
+		if (win->pending == NULL) {
+			fprintf(stderr, _("ERROR: No more revision logs available\n"));
+			return 1;
+		}
+
+		L2(_("Fetching next log window... "));
+		if (win->pending->ret == -1) {
+			ret = log_batch_fetch(win->pending);
+		} else {
+			ret = log_batch_wait(win->pending);
+		}
+		if (ret != 0) {
+			L2(_("failed\n"));
+			return 1;
+		}
+		L2(_("done\n"));
+
+		/* Keep the previous window alive for a while */
+		log_batch_free(win->retired);
+		win->retired = win->current;
+		win->current = win->pending;
+		win->pending = NULL;
+		win->index = 0;
+
+		if (win->current->list->nelts == 0) {
+			fprintf(stderr, _("ERROR: No more revision logs available\n"));
+			return 1;
+		}
+		log_window_refill(win);
+	}
+
+	*log = APR_ARRAY_IDX(win->current->list, win->index, log_revision_t);
+	++win->index;
+	return 0;
+}
@@ -43,6 +43,8 @@ typedef struct {
 	apr_hash_t		*changed_paths;
 } log_revision_t;
 
+typedef struct log_window_t log_window_t;
+
 
 /* Determines the first and last revision of the session root */
 extern char log_get_range(session_t *session, svn_revnum_t *start, svn_revnum_t *end);
@@ -53,5 +55,12 @@ extern char log_fetch_single(session_t *session, svn_revnum_t rev, svn_revnum_t
 /* Fetches all revision logs for a given revision range */
 extern char log_fetch_all(session_t *session, svn_revnum_t start, svn_revnum_t end, apr_array_header_t *list);
 
+/* Creates a new log window for the given range */
+extern log_window_t *log_window_create(session_t *session, svn_revnum_t start, svn_revnum_t end, int size, apr_pool_t *pool);
+
+/* Returns the next revision log from the window. The log remains valid
+   until this function has been called two more times */
+extern char log_window_next(log_window_t *win, log_revision_t *log);
+
 
 #endif
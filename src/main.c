@@ -33,10 +33,13 @@
 
 #include <svn_cmdline.h>
 #include <svn_path.h>
+#include <svn_version.h>
 
 #include "main.h"
 #include "dump.h"
 #include "logger.h"
+#include "output.h"
+#include "revindex.h"
 #include "utils.h"
 
 
@@ -79,6 +82,25 @@ static void print_usage()
 	printf(_("    --no-incremental-header   don't print the dumpfile header when dumping\n"));
 	printf(_("                              with --incremental and not starting at\n"));
 	printf(_("                              revision 0\n"));
+	printf(_("    --prefetch                fetch the next revision in the background\n"));
+	printf(_("    --jobs ARG                dump using ARG worker processes\n"));
+	printf(_("    --log-window-size ARG     fetch revision logs in batches of ARG\n"));
+	printf(_("    --replay                  fetch changes by replaying revisions if possible\n"));
+	printf(_("    --compress                write gzip-compressed output\n"));
+	printf(_("    --index-file ARG          write an index of revision offsets to ARG\n"));
+	printf(_("    --extract ARG             extract revisions from the dumpfile ARG using\n" \
+	         "                              the index given by --index-file\n"));
+	printf(_("    --state-dir ARG           keep resumable state in directory ARG\n"));
+	printf(_("    --watch ARG               keep running and check for new revisions every\n" \
+	         "                              ARG seconds\n"));
+	printf(_("    --rotate ARG              write the revisions of each check to a new file\n" \
+	         "                              ARG-X-Y instead of standard output\n"));
+	printf(_("    --small-text-size ARG     keep file contents of up to ARG bytes in memory\n"));
+	printf(_("    --delta-threads ARG       compute deltas using ARG threads\n"));
+	printf(_("    --delta-format ARG        use svndiff version ARG (0, 1 or 2) for deltas\n"));
+	printf(_("    --delta-compression ARG   compress deltas using level ARG (0-9)\n"));
+	printf(_("    --path-snapshot-size ARG  snapshot the path tree after ARG bytes of changes\n"));
+	printf(_("    --path-cache-size ARG     cache path trees using up to ARG MiB of memory\n"));
 	printf("\n");
 	printf(_("Subversion compatibility options:\n"));
 	printf(_("    -u [--username] ARG       specify a username ARG\n"));
@@ -156,6 +178,7 @@ int main(int argc, char **argv)
 {
 	char ret = 0;
 	const char *tdir = NULL;
+	const char *extract_file = NULL;
 	int i;
 	session_t session;
 	dump_options_t opts;
@@ -218,6 +241,12 @@ int main(int argc, char **argv)
 			opts.flags |= DF_USE_DELTAS;
 		} else if (!strcmp(argv[i], "--incremental")) {
 			opts.flags |= DF_INCREMENTAL;
+		} else if (!strcmp(argv[i], "--prefetch")) {
+			opts.flags |= DF_PREFETCH;
+		} else if (!strcmp(argv[i], "--replay")) {
+			opts.flags |= DF_REPLAY;
+		} else if (!strcmp(argv[i], "--compress")) {
+			opts.flags |= DF_COMPRESS;
 		} else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--revision")) {
 			if (i+1 >= argc) {
 				print_missing_arg(argv[i]);
@@ -249,6 +278,135 @@ int main(int argc, char **argv)
 				goto failure;
 			}
 			session.config_dir = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--jobs")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.jobs = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.jobs < 1) {
+				fprintf(stderr, _("ERROR: invalid number of jobs '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--log-window-size")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.log_window_size = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.log_window_size < 0) {
+				fprintf(stderr, _("ERROR: invalid log window size '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--index-file")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.index_file = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--extract")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			extract_file = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--state-dir")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.state_dir = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--watch")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.watch_interval = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.watch_interval < 1) {
+				fprintf(stderr, _("ERROR: invalid watch interval '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--rotate")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.rotate_prefix = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--small-text-size")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.small_text_size = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.small_text_size < 0) {
+				fprintf(stderr, _("ERROR: invalid text size '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--delta-threads")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.delta_threads = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.delta_threads < 1) {
+				fprintf(stderr, _("ERROR: invalid number of threads '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--delta-format")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.delta_format = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.delta_format < 0 || opts.delta_format > 2) {
+				fprintf(stderr, _("ERROR: invalid delta format '%s'.\n"), argv[i]);
+				goto failure;
+			}
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR < 10)
+			if (opts.delta_format == 2) {
+				fprintf(stderr, _("ERROR: svndiff version 2 requires Subversion 1.10 or later.\n"));
+				goto failure;
+			}
+#endif
+		} else if (!strcmp(argv[i], "--delta-compression")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.delta_compression = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.delta_compression < 0 || opts.delta_compression > 9) {
+				fprintf(stderr, _("ERROR: invalid compression level '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--path-snapshot-size")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.path_snapshot_size = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.path_snapshot_size < 0) {
+				fprintf(stderr, _("ERROR: invalid snapshot size '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--path-cache-size")) {
+			char *end;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.path_cache_size = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || opts.path_cache_size < 0) {
+				fprintf(stderr, _("ERROR: invalid cache size '%s'.\n"), argv[i]);
+				goto failure;
+			}
 		} else if (!strcmp(argv[i], "--prefix")) {
 			if (i+1 >= argc) {
 				print_missing_arg(argv[i]);
@@ -296,12 +454,66 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Extract revisions from an existing dumpfile instead of dumping */
+	if (extract_file != NULL) {
+		output_t *output;
+
+		if (opts.index_file == NULL) {
+			fprintf(stderr, _("ERROR: --extract requires --index-file.\n"));
+			goto failure;
+		}
+		output = output_create_stdout(session.pool);
+		if (revindex_extract(opts.index_file, extract_file, opts.start, opts.end, output, session.pool) != 0) {
+			goto failure;
+		}
+		if (output_flush(output) != 0) {
+			fprintf(stderr, _("ERROR: Unable to write dump output\n"));
+			goto failure;
+		}
+		ret = 0;
+		goto finish;
+	}
+
 	/* URL given ? */
 	if (session.url == NULL) {
 		print_usage();
 		goto failure;
 	}
 
+	if (opts.rotate_prefix != NULL) {
+		if (opts.watch_interval <= 0) {
+			fprintf(stderr, _("ERROR: --rotate requires --watch.\n"));
+			goto failure;
+		}
+		if (opts.index_file != NULL) {
+			fprintf(stderr, _("ERROR: --rotate can't be used together with --index-file\n"));
+			goto failure;
+		}
+	}
+	if (opts.watch_interval > 0 && opts.jobs > 1) {
+		fprintf(stderr, _("ERROR: --watch can't be used together with --jobs\n"));
+		goto failure;
+	}
+
+	/* A state directory is used instead of a temporary directory */
+	if (opts.state_dir != NULL) {
+		if (opts.jobs > 1) {
+			fprintf(stderr, _("ERROR: --state-dir can't be used together with --jobs\n"));
+			goto failure;
+		}
+		if (opts.index_file != NULL) {
+			fprintf(stderr, _("ERROR: --state-dir can't be used together with --index-file\n"));
+			goto failure;
+		}
+		opts.state_dir = utils_canonicalize_pstrdup(session.pool, opts.state_dir);
+		if (apr_dir_make_recursive(opts.state_dir, APR_UREAD | APR_UWRITE | APR_UEXECUTE, session.pool) != APR_SUCCESS) {
+			fprintf(stderr, _("ERROR: Unable to create state directory %s.\n"), opts.state_dir);
+			goto failure;
+		}
+		opts.temp_dir = opts.state_dir;
+		goto work;
+	}
+
 	/* Generate temporary directory */
 #ifndef WIN32
 	tdir = getenv("TMPDIR");
@@ -333,19 +545,24 @@ int main(int argc, char **argv)
 #endif /* !WIN32 */
 
 	/* Do the real work */
+work:
 	if (session_open(&session) == 0) {
-		ret = dump(&session, &opts);
+		ret = dump_parallel(&session, &opts);
 		session_close(&session);
 
 		/* Clean up temporary directory on success */
 #ifndef DUMP_DEBUG
-		if (ret == 0) {
+		if (opts.state_dir != NULL) {
+			if (ret != 0) {
+				fprintf(stderr, _("NOTE: Run again with --state-dir %s to resume the dump\n"), opts.state_dir);
+			}
+		} else if (ret == 0) {
 			utils_rrmdir(session.pool, opts.temp_dir, 1);
 		} else {
 			fprintf(stderr, _("NOTE: Please remove the temporary directory %s manually\n"), opts.temp_dir);
 		}
 #endif
-	} else {
+	} else if (opts.state_dir == NULL) {
 		utils_rrmdir(session.pool, opts.temp_dir, 1);
 	}
 
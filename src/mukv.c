@@ -39,6 +39,7 @@ struct mukv_t {
 	rhash_t *index;
 	char *path;
 	FILE *file;
+	int flags;
 };
 
 typedef struct {
@@ -48,24 +49,29 @@ typedef struct {
 
 
 /* Opens a file to be used for random-accesible storage */
-mukv_t *mukv_open(const char *path, apr_pool_t *pool)
+mukv_t *mukv_open(const char *path, int flags, apr_pool_t *pool)
 {
 	mukv_t *kv = apr_palloc(pool, sizeof(mukv_t));
 	kv->index = rhash_make(pool);
 	kv->path = apr_pstrdup(pool, path);
-	if ((kv->file = fopen(path, "w+")) == NULL) {
+	kv->flags = flags;
+	if ((kv->file = fopen(path, (flags & MUKV_RESUME) ? "r+b" : "w+b")) == NULL) {
 		return NULL;
 	}
 	return kv;
 }
 
-/* Closes the storage and sends it into oblivion */
+/* Closes the storage and sends it into oblivion (unless it's persistent) */
 int mukv_close(mukv_t *kv)
 {
 	rhash_clear(kv->index);
 
+	if (fclose(kv->file) != 0) {
+		return errno;
+	}
+
 	/* Goodbye, data */
-	if (fclose(kv->file) != 0 || unlink(kv->path) != 0) {
+	if (!(kv->flags & MUKV_PERSISTENT) && unlink(kv->path) != 0) {
 		return errno;
 	}
 	return 0;
@@ -131,3 +137,62 @@ int mukv_exists(mukv_t *kv, mdatum_t key)
 {
 	return (rhash_get(kv->index, key.dptr, key.dsize) != NULL);
 }
+
+/* Flushes the data file and saves the index to a state file */
+int mukv_save(mukv_t *kv, state_file_t *sf)
+{
+	apr_hash_index_t *hi;
+	apr_pool_t *pool;
+	int ret = 0;
+
+	if (fflush(kv->file) != 0) {
+		return -1;
+	}
+
+	if (state_write_int(sf, rhash_count(kv->index)) != 0) {
+		return -1;
+	}
+	apr_pool_create(&pool, NULL);
+	for (hi = rhash_first(pool, kv->index); hi && ret == 0; hi = rhash_next(hi)) {
+		const void *key;
+		apr_ssize_t klen;
+		entry_t *entry;
+
+		rhash_this(hi, &key, &klen, (void **)&entry);
+		if (state_write_data(sf, key, klen) != 0
+			|| state_write_int(sf, entry->off) != 0
+			|| state_write_int(sf, entry->size) != 0) {
+			ret = -1;
+		}
+	}
+	apr_pool_destroy(pool);
+	return ret;
+}
+
+/* Loads the index from a state file */
+int mukv_load(mukv_t *kv, state_file_t *sf, apr_pool_t *pool)
+{
+	apr_int64_t n, klen, v;
+	entry_t entry;
+	char *key;
+
+	rhash_clear(kv->index);
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	while (n-- > 0) {
+		if (state_read_data(sf, &key, &klen, pool) != 0 || key == NULL) {
+			return -1;
+		}
+		if (state_read_int(sf, &v) != 0) {
+			return -1;
+		}
+		entry.off = (long)v;
+		if (state_read_int(sf, &v) != 0) {
+			return -1;
+		}
+		entry.size = (size_t)v;
+		rhash_set(kv->index, key, (apr_ssize_t)klen, &entry, sizeof(entry_t));
+	}
+	return 0;
+}
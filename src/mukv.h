@@ -27,6 +27,13 @@
 
 #include <apr_pools.h>
 
+#include "state.h"
+
+
+/* Flags for mukv_open() */
+#define MUKV_PERSISTENT 0x01  /* Keep the data file on close */
+#define MUKV_RESUME     0x02  /* Keep the data of an existing file */
+
 
 typedef struct mukv_t mukv_t;
 
@@ -37,9 +44,9 @@ typedef struct {
 
 
 /* Opens a file to be used for random-accesible storage */
-extern mukv_t *mukv_open(const char *path, apr_pool_t *pool);
+extern mukv_t *mukv_open(const char *path, int flags, apr_pool_t *pool);
 
-/* Closes the storage and sends it into oblivion */
+/* Closes the storage and sends it into oblivion (unless it's persistent) */
 extern int mukv_close(mukv_t *kv);
 
 /* Stores a record */
@@ -54,5 +61,11 @@ extern int mukv_delete(mukv_t *kv, mdatum_t key);
 /* Checks whether a record exists */
 extern int mukv_exists(mukv_t *kv, mdatum_t key);
 
+/* Flushes the data file and saves the index to a state file */
+extern int mukv_save(mukv_t *kv, state_file_t *sf);
+
+/* Loads the index from a state file */
+extern int mukv_load(mukv_t *kv, state_file_t *sf, apr_pool_t *pool);
+
 
 #endif /* MUKV_H_ */
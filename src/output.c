@@ -0,0 +1,890 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: output.c
+ *      desc: Buffered writer for the dump output
+ */
+
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#ifdef WIN32
+	#include <io.h>
+#else
+	#include <sys/types.h>
+	#include <unistd.h>
+#endif
+
+#include <svn_pools.h>
+
+#include <apr_strings.h>
+#if APR_HAS_THREADS
+	#include <apr_thread_cond.h>
+	#include <apr_thread_mutex.h>
+	#include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+
+#ifdef HAVE_SYS_UIO_H
+	#include <sys/uio.h>
+#endif
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+	#include <sys/sendfile.h>
+	#define USE_SENDFILE
+#endif
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+	#include <zlib.h>
+	#define USE_ZLIB
+#endif
+
+#include "output.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local definitions                                                         */
+/*---------------------------------------------------------------------------*/
+
+
+/* Size of the output buffer */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/* Size of the stack buffer for formatted output */
+#define OUTPUT_FORMAT_SIZE 512
+
+/* Maximum number of bytes transferred by a single sendfile() call */
+#define OUTPUT_SENDFILE_CHUNK (1 << 30)
+
+/* Size of the independently compressed chunks */
+#define OUTPUT_COMPRESS_CHUNK_SIZE (1024 * 1024)
+
+/* Maximum number of compression threads */
+#define OUTPUT_COMPRESS_MAX_THREADS 32
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+#ifdef WIN32
+	#define open _open
+	#define read _read
+	#define close _close
+	#define lseek _lseeki64
+	#define ftruncate _chsize_s
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+#ifdef USE_ZLIB
+
+/* Chunk states */
+enum {
+	CHUNK_FREE = 0,
+	CHUNK_FILLED,
+	CHUNK_BUSY,
+	CHUNK_DONE
+};
+
+/* A chunk of output that is compressed to a single gzip member */
+typedef struct {
+	char *in;
+	apr_size_t in_len;
+	unsigned char *out;
+	apr_size_t out_len;
+	apr_size_t out_size;
+	int state;
+	char failed;
+} output_chunk_t;
+
+/* Compression state. Chunks are used as a ring buffer: The main thread
+   fills the chunk at head, workers compress chunks starting at next and
+   the writer writes them out in order, starting at tail. */
+typedef struct {
+	output_chunk_t *chunks;
+	int nchunks;
+	int head;
+	int next;
+	int tail;
+	int level;
+	int error;
+#if APR_HAS_THREADS
+	apr_pool_t *pool;  /* Separate pool, see output_compress() */
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+	apr_thread_t **workers;
+	int nworkers;
+	apr_thread_t *writer;
+	char shutdown;
+#endif
+} output_compressor_t;
+
+#endif /* USE_ZLIB */
+
+
+struct output_t {
+	int fd;
+	int base_fd;  /* Descriptor given on creation, used when no file is open */
+	char *buffer;
+	apr_size_t size;
+	apr_size_t used;
+	int error;  /* Sticky errno value of the first failed write */
+	apr_off_t offset;  /* Number of bytes written so far */
+	apr_pool_t *pool;
+#ifdef USE_ZLIB
+	output_compressor_t *comp;
+#endif
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Writes a block of data to the given file descriptor */
+static int output_write_fd(int fd, const char *data, apr_size_t len)
+{
+	while (len > 0) {
+#ifdef WIN32
+		int n = _write(fd, data, (unsigned int)(len > 0x40000000 ? 0x40000000 : len));
+#else
+		ssize_t n = write(fd, data, len);
+#endif
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/* Writes two blocks of data to the given file descriptor */
+static int output_write2_fd(int fd, const char *a, apr_size_t alen, const char *b, apr_size_t blen)
+{
+#ifdef HAVE_WRITEV
+	struct iovec iov[2];
+
+	while (alen > 0) {
+		ssize_t n;
+
+		iov[0].iov_base = (void *)a;
+		iov[0].iov_len = alen;
+		iov[1].iov_base = (void *)b;
+		iov[1].iov_len = blen;
+		n = writev(fd, iov, 2);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		if ((apr_size_t)n >= alen) {
+			n -= alen;
+			alen = 0;
+			b += n;
+			blen -= n;
+		} else {
+			a += n;
+			alen -= n;
+		}
+	}
+#else
+	if (output_write_fd(fd, a, alen) != 0) {
+		return -1;
+	}
+#endif
+	return output_write_fd(fd, b, blen);
+}
+
+
+#ifdef USE_ZLIB
+
+/* Compresses a chunk to a complete gzip member */
+static void output_compress_chunk(output_chunk_t *chunk, int level)
+{
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		chunk->failed = 1;
+		return;
+	}
+
+	z.next_in = (Bytef *)chunk->in;
+	z.avail_in = (uInt)chunk->in_len;
+	z.next_out = chunk->out;
+	z.avail_out = (uInt)chunk->out_size;
+	ret = deflate(&z, Z_FINISH);
+	chunk->out_len = chunk->out_size - z.avail_out;
+	chunk->failed = (ret != Z_STREAM_END);
+	deflateEnd(&z);
+}
+
+
+/* Writes a compressed chunk, recording the first error */
+static void output_write_chunk(output_t *out, output_chunk_t *chunk, int *error)
+{
+	if (*error) {
+		return;
+	}
+	if (chunk->failed) {
+		*error = ENOMEM;
+	} else if (output_write_fd(out->fd, (const char *)chunk->out, chunk->out_len) != 0) {
+		*error = errno;
+	}
+}
+
+
+#if APR_HAS_THREADS
+
+/* Compression thread main loop */
+static void * APR_THREAD_FUNC output_compress_thread(apr_thread_t *thread, void *data)
+{
+	output_compressor_t *comp = (output_compressor_t *)data;
+
+	apr_thread_mutex_lock(comp->mutex);
+	while (1) {
+		output_chunk_t *chunk;
+
+		while (!comp->shutdown && comp->chunks[comp->next].state != CHUNK_FILLED) {
+			apr_thread_cond_wait(comp->cond, comp->mutex);
+		}
+		if (comp->chunks[comp->next].state != CHUNK_FILLED) {
+			break;
+		}
+		chunk = &comp->chunks[comp->next];
+		chunk->state = CHUNK_BUSY;
+		comp->next = (comp->next + 1) % comp->nchunks;
+		apr_thread_mutex_unlock(comp->mutex);
+
+		output_compress_chunk(chunk, comp->level);
+
+		apr_thread_mutex_lock(comp->mutex);
+		chunk->state = CHUNK_DONE;
+		apr_thread_cond_broadcast(comp->cond);
+	}
+	apr_thread_mutex_unlock(comp->mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+/* Writer thread main loop, writing compressed chunks in order */
+static void * APR_THREAD_FUNC output_writer_thread(apr_thread_t *thread, void *data)
+{
+	output_t *out = (output_t *)data;
+	output_compressor_t *comp = out->comp;
+	int error = 0;
+
+	apr_thread_mutex_lock(comp->mutex);
+	while (1) {
+		output_chunk_t *chunk;
+
+		while (!comp->shutdown && comp->chunks[comp->tail].state != CHUNK_DONE) {
+			apr_thread_cond_wait(comp->cond, comp->mutex);
+		}
+		if (comp->chunks[comp->tail].state != CHUNK_DONE) {
+			break;
+		}
+		chunk = &comp->chunks[comp->tail];
+		apr_thread_mutex_unlock(comp->mutex);
+
+		output_write_chunk(out, chunk, &error);
+
+		apr_thread_mutex_lock(comp->mutex);
+		if (error && !comp->error) {
+			comp->error = error;
+		}
+		chunk->state = CHUNK_FREE;
+		comp->tail = (comp->tail + 1) % comp->nchunks;
+		apr_thread_cond_broadcast(comp->cond);
+	}
+	apr_thread_mutex_unlock(comp->mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/* Hands the current chunk over for compression and switches to the next one */
+static void output_submit_chunk(output_t *out)
+{
+	output_compressor_t *comp = out->comp;
+	output_chunk_t *chunk = &comp->chunks[comp->head];
+
+	chunk->in_len = out->used;
+#if APR_HAS_THREADS
+	if (comp->nworkers > 0) {
+		apr_thread_mutex_lock(comp->mutex);
+		chunk->state = CHUNK_FILLED;
+		comp->head = (comp->head + 1) % comp->nchunks;
+		apr_thread_cond_broadcast(comp->cond);
+
+		/* This only blocks if all workers are busy */
+		while (comp->chunks[comp->head].state != CHUNK_FREE) {
+			apr_thread_cond_wait(comp->cond, comp->mutex);
+		}
+		if (comp->error && !out->error) {
+			out->error = comp->error;
+		}
+		apr_thread_mutex_unlock(comp->mutex);
+	} else
+#endif
+	{
+		output_compress_chunk(chunk, comp->level);
+		output_write_chunk(out, chunk, &comp->error);
+		out->error = comp->error;
+	}
+
+	out->buffer = comp->chunks[comp->head].in;
+	out->used = 0;
+}
+
+
+/* Waits until all submitted chunks have been written */
+static void output_drain(output_t *out)
+{
+#if APR_HAS_THREADS
+	output_compressor_t *comp = out->comp;
+
+	if (comp->nworkers > 0) {
+		apr_thread_mutex_lock(comp->mutex);
+		while (comp->tail != comp->head) {
+			apr_thread_cond_wait(comp->cond, comp->mutex);
+		}
+		if (comp->error && !out->error) {
+			out->error = comp->error;
+		}
+		apr_thread_mutex_unlock(comp->mutex);
+	}
+#else
+	(void)out;
+#endif
+}
+
+
+/* Pool cleanup function, finishing compression and stopping all threads */
+static apr_status_t output_compress_cleanup(void *data)
+{
+	output_t *out = (output_t *)data;
+#if APR_HAS_THREADS
+	output_compressor_t *comp = out->comp;
+	apr_status_t retval;
+	int i;
+#endif
+
+	output_flush(out);
+#if APR_HAS_THREADS
+	if (comp->nworkers > 0) {
+		apr_thread_mutex_lock(comp->mutex);
+		comp->shutdown = 1;
+		apr_thread_cond_broadcast(comp->cond);
+		apr_thread_mutex_unlock(comp->mutex);
+
+		for (i = 0; i < comp->nworkers; i++) {
+			apr_thread_join(&retval, comp->workers[i]);
+		}
+		apr_thread_join(&retval, comp->writer);
+	}
+	svn_pool_destroy(comp->pool);
+#endif
+
+	out->comp = NULL;
+	out->used = 0;
+	return APR_SUCCESS;
+}
+
+#endif /* USE_ZLIB */
+
+
+/* Pool cleanup function, writing any pending data */
+static apr_status_t output_cleanup(void *data)
+{
+	output_t *out = data;
+
+	output_flush(out);
+	if (out->fd != out->base_fd) {
+		close(out->fd);
+		out->fd = out->base_fd;
+	}
+	return APR_SUCCESS;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new writer for the given file descriptor */
+output_t *output_create(int fd, apr_pool_t *pool)
+{
+	output_t *out = apr_pcalloc(pool, sizeof(output_t));
+	out->fd = fd;
+	out->base_fd = fd;
+	out->size = OUTPUT_BUFFER_SIZE;
+	out->buffer = apr_palloc(pool, out->size);
+	out->pool = pool;
+	apr_pool_cleanup_register(pool, out, output_cleanup, apr_pool_cleanup_null);
+	return out;
+}
+
+
+/* Creates a new writer for the standard output */
+output_t *output_create_stdout(apr_pool_t *pool)
+{
+	/* Make sure nothing written through stdio gets reordered */
+	fflush(stdout);
+#ifdef WIN32
+	return output_create(_fileno(stdout), pool);
+#else
+	return output_create(STDOUT_FILENO, pool);
+#endif
+}
+
+
+/* Enables gzip compression of all subsequent output, using the given
+   number of threads (or an automatically determined number if zero) */
+int output_compress(output_t *out, int threads)
+{
+#ifdef USE_ZLIB
+	output_compressor_t *comp;
+	apr_size_t out_size;
+	int i;
+
+	if (output_flush(out) != 0) {
+		return -1;
+	}
+
+	if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (threads <= 0) {
+			threads = 2;
+		}
+	}
+	if (threads > OUTPUT_COMPRESS_MAX_THREADS) {
+		threads = OUTPUT_COMPRESS_MAX_THREADS;
+	}
+
+	comp = apr_pcalloc(out->pool, sizeof(output_compressor_t));
+	comp->level = Z_DEFAULT_COMPRESSION;
+#if APR_HAS_THREADS
+	comp->nchunks = 2 * threads + 1;
+#else
+	comp->nchunks = 1;
+#endif
+	comp->chunks = apr_pcalloc(out->pool, comp->nchunks * sizeof(output_chunk_t));
+
+	/* Make room for the gzip header and trailer, too */
+	out_size = compressBound(OUTPUT_COMPRESS_CHUNK_SIZE) + 32;
+	for (i = 0; i < comp->nchunks; i++) {
+		comp->chunks[i].in = apr_palloc(out->pool, OUTPUT_COMPRESS_CHUNK_SIZE);
+		comp->chunks[i].out = apr_palloc(out->pool, out_size);
+		comp->chunks[i].out_size = out_size;
+	}
+
+#if APR_HAS_THREADS
+	/* The threads are managed by a pool of their own, so they're still
+	   around when the cleanup function of the output pool runs */
+	comp->pool = svn_pool_create(NULL);
+	if (apr_thread_mutex_create(&comp->mutex, APR_THREAD_MUTEX_DEFAULT, comp->pool) != APR_SUCCESS
+		|| apr_thread_cond_create(&comp->cond, comp->pool) != APR_SUCCESS) {
+		svn_pool_destroy(comp->pool);
+		return -1;
+	}
+	comp->workers = apr_pcalloc(comp->pool, threads * sizeof(apr_thread_t *));
+	out->comp = comp;
+	apr_pool_cleanup_register(out->pool, out, output_compress_cleanup, apr_pool_cleanup_null);
+
+	/* The main thread only fills chunks, the rest is done in the background.
+	   Compression is done inline if no threads can be started. */
+	for (i = 0; i < threads; i++) {
+		if (apr_thread_create(&comp->workers[i], NULL, output_compress_thread, comp, comp->pool) != APR_SUCCESS) {
+			break;
+		}
+		++comp->nworkers;
+	}
+	if (comp->nworkers > 0 && apr_thread_create(&comp->writer, NULL, output_writer_thread, out, comp->pool) != APR_SUCCESS) {
+		apr_status_t retval;
+
+		apr_thread_mutex_lock(comp->mutex);
+		comp->shutdown = 1;
+		apr_thread_cond_broadcast(comp->cond);
+		apr_thread_mutex_unlock(comp->mutex);
+		for (i = 0; i < comp->nworkers; i++) {
+			apr_thread_join(&retval, comp->workers[i]);
+		}
+		comp->nworkers = 0;
+	}
+#else
+	out->comp = comp;
+	apr_pool_cleanup_register(out->pool, out, output_compress_cleanup, apr_pool_cleanup_null);
+#endif
+
+	out->buffer = comp->chunks[comp->head].in;
+	out->size = OUTPUT_COMPRESS_CHUNK_SIZE;
+	out->used = 0;
+	return 0;
+#else
+	(void)out;
+	(void)threads;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/* Writes a block of data */
+int output_write(output_t *out, const char *data, apr_size_t len)
+{
+	if (out->error) {
+		return -1;
+	}
+	out->offset += len;
+
+#ifdef USE_ZLIB
+	if (out->comp != NULL) {
+		while (len > 0) {
+			apr_size_t n = out->size - out->used;
+			if (n > len) {
+				n = len;
+			}
+			memcpy(out->buffer + out->used, data, n);
+			out->used += n;
+			data += n;
+			len -= n;
+			if (out->used == out->size) {
+				output_submit_chunk(out);
+			}
+		}
+		return (out->error ? -1 : 0);
+	}
+#endif
+
+	if (len <= out->size - out->used) {
+		memcpy(out->buffer + out->used, data, len);
+		out->used += len;
+		return 0;
+	}
+
+	/* Send the buffer contents and the new data in a single call */
+	if (output_write2_fd(out->fd, out->buffer, out->used, data, len) != 0) {
+		out->error = errno;
+		return -1;
+	}
+	out->used = 0;
+	return 0;
+}
+
+
+/* Writes a string */
+int output_puts(output_t *out, const char *str)
+{
+	return output_write(out, str, strlen(str));
+}
+
+
+/* Writes a formatted string */
+int output_printf(output_t *out, const char *fmt, ...)
+{
+	char buf[OUTPUT_FORMAT_SIZE];
+	apr_size_t len;
+	apr_pool_t *pool;
+	char *str;
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	len = apr_vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len + 1 < sizeof(buf)) {
+		return output_write(out, buf, len);
+	}
+
+	/* The result might have been truncated, so format it again */
+	pool = svn_pool_create(out->pool);
+	va_start(ap, fmt);
+	str = apr_pvsprintf(pool, fmt, ap);
+	va_end(ap);
+	ret = output_write(out, str, strlen(str));
+	svn_pool_destroy(pool);
+	return ret;
+}
+
+
+/* Writes the contents of the given file, bypassing the buffer if possible */
+int output_file(output_t *out, const char *path)
+{
+	return output_file_range(out, path, 0, -1);
+}
+
+
+/* Writes length bytes starting at offset of the given file, or everything
+   after offset if length is negative */
+int output_file_range(output_t *out, const char *path, apr_off_t offset, apr_off_t length)
+{
+	int fd, err = 0;
+	long n;
+
+#ifdef USE_ZLIB
+	if (out->comp == NULL)
+#endif
+	{
+		if (output_flush(out) != 0) {
+			return -1;
+		}
+	}
+	if (out->error) {
+		errno = out->error;
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDONLY | O_BINARY)) < 0) {
+		return -1;
+	}
+	if (offset > 0 && lseek(fd, offset, SEEK_SET) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+#ifdef USE_ZLIB
+	/* Compressed output: Read directly into the current chunk */
+	if (out->comp != NULL) {
+		while (!out->error && length != 0) {
+			apr_size_t count = out->size - out->used;
+			if (length > 0 && (apr_off_t)count > length) {
+				count = (apr_size_t)length;
+			}
+			if ((n = read(fd, out->buffer + out->used, count)) == 0) {
+				break;
+			} else if (n < 0) {
+				if (errno != EINTR) {
+					err = errno;
+					break;
+				}
+				continue;
+			}
+			out->used += n;
+			out->offset += n;
+			if (length > 0) {
+				length -= n;
+			}
+			if (out->used == out->size) {
+				output_submit_chunk(out);
+			}
+		}
+		close(fd);
+		if (err || out->error) {
+			errno = (err ? err : out->error);
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USE_SENDFILE
+	/* Let the kernel copy the data if the output supports it */
+	n = 1;
+	while (length != 0) {
+		apr_size_t count = OUTPUT_SENDFILE_CHUNK;
+		if (length > 0 && (apr_off_t)count > length) {
+			count = (apr_size_t)length;
+		}
+		if ((n = sendfile(out->fd, fd, NULL, count)) == 0) {
+			break;
+		} else if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EINVAL && errno != ENOSYS) {
+				err = errno;
+			}
+			break;
+		}
+		out->offset += n;
+		if (length > 0) {
+			length -= n;
+		}
+	}
+	if (n >= 0) {
+		close(fd);
+		return 0;
+	}
+#endif
+
+	/* Plain copy, using the (empty) output buffer */
+	while (!err && length != 0) {
+		apr_size_t count = out->size;
+		if (length > 0 && (apr_off_t)count > length) {
+			count = (apr_size_t)length;
+		}
+		if ((n = read(fd, out->buffer, count)) == 0) {
+			break;
+		} else if (n < 0) {
+			if (errno != EINTR) {
+				err = errno;
+			}
+		} else if (output_write_fd(out->fd, out->buffer, n) != 0) {
+			err = errno;
+			out->error = err;
+		} else {
+			out->offset += n;
+			if (length > 0) {
+				length -= n;
+			}
+		}
+	}
+
+	close(fd);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Returns the number of bytes written so far (before compression) */
+apr_off_t output_tell(output_t *out)
+{
+	return out->offset;
+}
+
+
+/* Returns the position in the underlying file after flushing the output,
+   or -1 if it isn't seekable */
+apr_off_t output_position(output_t *out)
+{
+	if (output_flush(out) != 0) {
+		return -1;
+	}
+	return (apr_off_t)lseek(out->fd, 0, SEEK_CUR);
+}
+
+
+/* Discards everything after the given position in the underlying file and
+   continues writing there. Fails if the file is shorter */
+int output_truncate(output_t *out, apr_off_t position)
+{
+	apr_off_t size;
+
+	if (output_flush(out) != 0) {
+		return -1;
+	}
+	if ((size = (apr_off_t)lseek(out->fd, 0, SEEK_END)) < 0) {
+		return -1;
+	}
+	if (size < position) {
+		errno = ERANGE;
+		return -1;
+	}
+	if (size > position && ftruncate(out->fd, position) != 0) {
+		return -1;
+	}
+	if (lseek(out->fd, position, SEEK_SET) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Redirects all subsequent output to the given file, which will be
+   truncated. A previously opened file will be closed */
+int output_open_file(output_t *out, const char *path)
+{
+	int fd;
+
+	if (output_close_file(out) != 0) {
+		return -1;
+	}
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644)) < 0) {
+		return -1;
+	}
+	out->fd = fd;
+	return 0;
+}
+
+
+/* Closes a file opened by output_open_file(), returning to the original output */
+int output_close_file(output_t *out)
+{
+	int ret;
+
+	if (out->fd == out->base_fd) {
+		return output_flush(out);
+	}
+	ret = output_flush(out);
+	if (close(out->fd) != 0 && ret == 0) {
+		ret = -1;
+	}
+	out->fd = out->base_fd;
+	return ret;
+}
+
+
+/* Writes all buffered data and reports previous write errors */
+int output_flush(output_t *out)
+{
+#ifdef USE_ZLIB
+	if (out->comp != NULL) {
+		if (!out->error && out->used > 0) {
+			output_submit_chunk(out);
+		}
+		output_drain(out);
+		if (out->error) {
+			errno = out->error;
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+	if (!out->error && out->used > 0) {
+		if (output_write_fd(out->fd, out->buffer, out->used) != 0) {
+			out->error = errno;
+		}
+		out->used = 0;
+	}
+	if (out->error) {
+		errno = out->error;
+		return -1;
+	}
+	return 0;
+}
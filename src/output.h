@@ -0,0 +1,83 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: output.h
+ *      desc: Buffered writer for the dump output
+ */
+
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+
+#include <apr_pools.h>
+
+
+/* Output writer (opaque) */
+typedef struct output_t output_t;
+
+
+/* Creates a new writer for the given file descriptor */
+extern output_t *output_create(int fd, apr_pool_t *pool);
+
+/* Creates a new writer for the standard output */
+extern output_t *output_create_stdout(apr_pool_t *pool);
+
+/* Enables gzip compression of all subsequent output, using the given
+   number of threads (or an automatically determined number if zero) */
+extern int output_compress(output_t *out, int threads);
+
+/* Writes a block of data */
+extern int output_write(output_t *out, const char *data, apr_size_t len);
+
+/* Writes a string */
+extern int output_puts(output_t *out, const char *str);
+
+/* Writes a formatted string */
+extern int output_printf(output_t *out, const char *fmt, ...);
+
+/* Writes the contents of the given file, bypassing the buffer if possible */
+extern int output_file(output_t *out, const char *path);
+
+/* Writes length bytes starting at offset of the given file, or everything
+   after offset if length is negative */
+extern int output_file_range(output_t *out, const char *path, apr_off_t offset, apr_off_t length);
+
+/* Returns the number of bytes written so far (before compression) */
+extern apr_off_t output_tell(output_t *out);
+
+/* Redirects all subsequent output to the given file, which will be
+   truncated. A previously opened file will be closed */
+extern int output_open_file(output_t *out, const char *path);
+
+/* Closes a file opened by output_open_file(), returning to the original output */
+extern int output_close_file(output_t *out);
+
+/* Returns the position in the underlying file after flushing the output,
+   or -1 if it isn't seekable */
+extern apr_off_t output_position(output_t *out);
+
+/* Discards everything after the given position in the underlying file and
+   continues writing there. Fails if the file is shorter */
+extern int output_truncate(output_t *out, apr_off_t position);
+
+/* Writes all buffered data and reports previous write errors */
+extern int output_flush(output_t *out);
+
+
+#endif
@@ -22,6 +22,7 @@
 
 
 #include <assert.h>
+#include <errno.h>
 
 #include <apr_tables.h>
 
@@ -32,6 +33,7 @@
 #include "delta.h"
 #include "logger.h"
 #include "mukv.h"
+#include "path_tree.h"
 #include "utils.h"
 
 #include "critbit89/critbit.h"
@@ -42,18 +44,16 @@
 #include "path_repo.h"
 
 
-#define SNAPSHOT_INTERVAL (1<<10)  /* Interval for full-tree snapshots */
-#define CACHE_SIZE 4               /* Number of cached full trees */
-
-
 /*---------------------------------------------------------------------------*/
 /* Local data structures                                                     */
 /*---------------------------------------------------------------------------*/
 
 
 typedef struct {
-	svn_revnum_t revision;
-	cb_tree_t tree;
+	svn_revnum_t revision;  /* -1 if unused, in which case the tree is empty */
+	path_tree_t tree;
+	apr_size_t size;        /* Memory allocated for the tree when rolling it forward */
+	unsigned long used;     /* Time of last use */
 } pr_cache_entry_t;
 
 
@@ -63,6 +63,21 @@ typedef struct {
 } pr_delta_entry_t;
 
 
+/* Lifetime of a path, stored along with it in the lifetime index */
+typedef struct {
+	svn_revnum_t *revs;  /* Revisions of alternating additions and deletions */
+	int nrevs;
+	int size;
+} pr_lifetime_t;
+
+
+/* Baton for pr_lifetime_save_cb() */
+typedef struct {
+	state_file_t *sf;
+	int err;
+} pr_save_baton_t;
+
+
 struct path_repo_t {
 	apr_pool_t *pool;
 	mukv_t *db;
@@ -70,11 +85,37 @@ struct path_repo_t {
 	apr_pool_t *delta_pool;
 	apr_array_header_t *delta;
 	int delta_len;
-	cb_tree_t tree;
+	path_tree_t tree;
 	svn_revnum_t head;
 
-	apr_array_header_t *cache;   /* FIFO cache */
-	int cache_index;
+	/*
+	 * The tree is kept as a snapshot once the deltas stored since the last
+	 * snapshot would exceed snapshot_size bytes, so reconstructing a tree
+	 * never needs to apply more than that. Snapshots share all unchanged
+	 * paths with each other and with the current tree.
+	 */
+	apr_array_header_t *commits;   /* Revisions with stored data, ascending */
+	apr_array_header_t *snapshots; /* Indexes of snapshots in commits, ascending */
+	apr_array_header_t *snapshot_trees; /* Trees of the snapshots */
+	apr_size_t snapshot_size;
+	apr_size_t replay_len;         /* Bytes stored since the last snapshot */
+
+	/*
+	 * The lifetime index records the revisions in which each path has been
+	 * added and deleted, so checking whether a path exists doesn't require
+	 * a full tree.
+	 */
+	cb_tree_t lifetimes;
+
+	/*
+	 * Trees of recently used revisions are cached. The least recently used
+	 * ones are evicted once the trees use more memory than cache_size.
+	 */
+	apr_array_header_t *cache;
+	apr_size_t cache_size;
+	unsigned long cache_clock;
+	int cache_hits;
+	int cache_misses;
 
 #ifdef USE_SNAPPY
 	struct snappy_env snappy_env;
@@ -83,8 +124,6 @@ struct path_repo_t {
 #ifdef DEBUG
 	size_t delta_bytes;
 	size_t delta_bytes_raw;
-	int cache_hits;
-	int cache_misses;
 	apr_time_t recon_time;
 	apr_time_t store_time;
 #endif
@@ -96,6 +135,92 @@ struct path_repo_t {
 /*---------------------------------------------------------------------------*/
 
 
+/* Frees the revisions of a lifetime index entry */
+static int pr_lifetime_free_cb(const char *path, void *baton)
+{
+	pr_lifetime_t *lt = cb_tree_data(path);
+
+	(void)baton;
+	free(lt->revs);
+	return 0;
+}
+
+
+/* Records the addition or deletion of a path in the lifetime index */
+static int pr_lifetime_record(path_repo_t *repo, const char *path, char action, svn_revnum_t revision)
+{
+	void *data;
+	pr_lifetime_t *lt;
+
+	if (cb_tree_insert_data(&repo->lifetimes, path, sizeof(pr_lifetime_t), &data) == ENOMEM) {
+		return -1;
+	}
+	lt = data;
+
+	/* Additions and deletions must alternate */
+	if ((action == '+') != (lt->nrevs % 2 == 0)) {
+		return 0;
+	}
+
+	/* Changes that cancel each other out in a single revision are dropped */
+	if (lt->nrevs > 0 && lt->revs[lt->nrevs-1] == revision) {
+		--lt->nrevs;
+		return 0;
+	}
+
+	if (lt->nrevs >= lt->size) {
+		int size = (lt->size > 0 ? lt->size * 2 : 2);
+		svn_revnum_t *revs = realloc(lt->revs, size * sizeof(svn_revnum_t));
+		if (revs == NULL) {
+			return -1;
+		}
+		lt->revs = revs;
+		lt->size = size;
+	}
+	lt->revs[lt->nrevs++] = revision;
+	return 0;
+}
+
+
+/* Checks if a path exists at the given revision using the lifetime index */
+static int pr_lifetime_exists(path_repo_t *repo, const char *path, svn_revnum_t revision)
+{
+	pr_lifetime_t *lt = cb_tree_get_data(&repo->lifetimes, path);
+	int lo = 0, hi;
+
+	if (lt == NULL) {
+		return 0;
+	}
+
+	/* The path exists if an odd number of changes happened up to the revision */
+	hi = lt->nrevs;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lt->revs[mid] <= revision) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo % 2 == 1);
+}
+
+
+/* Writes a lifetime index entry to a state file */
+static int pr_lifetime_save_cb(const char *path, void *baton)
+{
+	pr_save_baton_t *sb = baton;
+	pr_lifetime_t *lt = cb_tree_data(path);
+
+	if (state_write_string(sb->sf, path) != 0
+		|| state_write_data(sb->sf, lt->revs, lt->nrevs * sizeof(svn_revnum_t)) != 0) {
+		sb->err = 1;
+		return 1;
+	}
+	return 0;
+}
+
+
 /* Clears remaining memory of the path repo */
 static apr_status_t pr_cleanup(void *data)
 {
@@ -103,20 +228,23 @@ static apr_status_t pr_cleanup(void *data)
 	int i;
 
 #ifdef DEBUG
-	L1("path_repo: snapshot interval:   %d\n", SNAPSHOT_INTERVAL);
-	L1("path_repo: cache size:          %d\n", CACHE_SIZE);
+	L1("path_repo: snapshot size:       %d kB\n", repo->snapshot_size / 1024);
+	L1("path_repo: snapshots:           %d of %d\n", repo->snapshots->nelts, repo->commits->nelts);
 	L1("path_repo: stored deltas:       %d kB\n", repo->delta_bytes / 1024);
 	L1("path_repo: stored deltas (raw): %d kB\n", repo->delta_bytes_raw / 1024);
 	L1("path_repo: total recon time:    %ld ms\n", apr_time_msec(repo->recon_time));
 	L1("path_repo: total store time:    %ld ms\n", apr_time_msec(repo->store_time));
-	L1("path_repo: cache miss rate:     %.2f%% (%d of %d)\n", 100.0f*repo->cache_misses / (repo->cache_hits+repo->cache_misses), repo->cache_misses, (repo->cache_hits+repo->cache_misses));
 #endif
+	L1(_("Path tree cache: %d hits, %d misses, up to %d trees\n"), repo->cache_hits, repo->cache_misses, repo->cache->nelts);
 
-	cb_tree_clear(&repo->tree);
+	cb_tree_walk_prefixed(&repo->lifetimes, "", pr_lifetime_free_cb, NULL);
+	cb_tree_clear(&repo->lifetimes);
+	path_tree_clear(&repo->tree);
+	for (i = 0; i < repo->snapshot_trees->nelts; i++) {
+		path_tree_clear(&APR_ARRAY_IDX(repo->snapshot_trees, i, path_tree_t));
+	}
 	for (i = 0; i < repo->cache->nelts; i++) {
-		if (APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree.root) {
-			cb_tree_clear(&APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree);
-		}
+		path_tree_clear(&APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree);
 	}
 
 	mukv_close(repo->db);
@@ -129,15 +257,33 @@ static apr_status_t pr_cleanup(void *data)
 
 
 /* Initializes the revision cache */
-static void pr_cache_init(path_repo_t *repo, int size)
+static void pr_cache_init(path_repo_t *repo, apr_size_t size)
 {
+	repo->cache = apr_array_make(repo->pool, 0, sizeof(pr_cache_entry_t));
+	repo->cache_size = size;
+	repo->cache_clock = 0;
+}
+
+
+/* Returns the approximate memory used by the cached trees */
+static apr_size_t pr_cache_size(path_repo_t *repo)
+{
+	apr_size_t size = 0;
 	int i;
-	repo->cache = apr_array_make(repo->pool, size, sizeof(pr_cache_entry_t));
-	for (i = 0; i < size; i++) {
-		APR_ARRAY_PUSH(repo->cache, pr_cache_entry_t).revision = -1;
-		APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree = cb_tree_make();
+
+	for (i = 0; i < repo->cache->nelts; i++) {
+		size += APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).size;
 	}
-	repo->cache_index = 0;
+	return size;
+}
+
+
+/* Removes a tree from the cache */
+static void pr_cache_evict(pr_cache_entry_t *entry)
+{
+	path_tree_clear(&entry->tree);
+	entry->revision = -1;
+	entry->size = 0;
 }
 
 
@@ -156,110 +302,114 @@ static int pr_tree_to_array_cb(const char *elem, void *arg) {
 }
 
 /* Returns all children of path in the given tree as an array */
-static apr_array_header_t *pr_tree_to_array(cb_tree_t *tree, const char *path, apr_pool_t *pool)
+static apr_array_header_t *pr_tree_to_array(path_tree_t *tree, const char *path, apr_pool_t *pool)
 {
 	struct pr_ttoa_data data;
 	data.arr = apr_array_make(pool, 0, sizeof(char *));
 	data.pool = pool;
 	data.path_len = strlen(path);
-	if (cb_tree_walk_prefixed(tree, path, pr_tree_to_array_cb, &data) != 0) {
+	if (path_tree_walk_prefixed(tree, path, pr_tree_to_array_cb, &data) != 0) {
 		return NULL;
 	}
 	return data.arr;
 }
 
 
-/* Encodes a whole tree to a series of add operations */
-static int pr_encode(cb_tree_t *tree, char **data, size_t *len, apr_pool_t *pool)
+/* Applies a serialized tree delta to a tree */
+static int pr_delta_apply(path_tree_t *tree, apr_size_t *size, const char *data, int len, apr_pool_t *pool)
 {
-	int i;
-	char *dptr;
-	apr_array_header_t *arr = pr_tree_to_array(tree, "", pool);
-	if (arr == NULL) {
-		return -1;
+	const char *dptr = data;
+	while (dptr - data < len) {
+		if ((*dptr == '+' ? path_tree_insert(tree, dptr+1, size) : path_tree_delete(tree, dptr+1, size)) < 0) {
+			return -1;
+		}
+		dptr += 2 + strlen(dptr+1);
 	}
+	return 0;
+}
 
-	/* Compute length */
-	*len = 0;
-	for (i = 0; i < arr->nelts; i++) {
-		*len += 2 + strlen(APR_ARRAY_IDX(arr, i, char *));
-	}
 
-	/* Encode */
-	*data = apr_palloc(pool, *len);
-	dptr = *data;
-	for (i = 0; i < arr->nelts; i++) {
-		*dptr++ = '+';
-		strcpy(dptr, APR_ARRAY_IDX(arr, i, char *));
-		dptr += strlen(APR_ARRAY_IDX(arr, i, char *));
-		*dptr++ = '\0';
+/* Returns the index of the last stored revision up to the given one, or -1 */
+static int pr_commit_index(path_repo_t *repo, svn_revnum_t revision)
+{
+	int lo = 0, hi = repo->commits->nelts;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (APR_ARRAY_IDX(repo->commits, mid, svn_revnum_t) <= revision) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
-	return 0;
+	return lo - 1;
 }
 
 
-/* Applies a serialized tree delta to a tree */
-static int pr_delta_apply(cb_tree_t *tree, const char *data, int len, apr_pool_t *pool)
+/* Returns the position of the last snapshot up to the given revision in the
+   list of snapshots, or -1 if there is none */
+static int pr_snapshot_index(path_repo_t *repo, svn_revnum_t revision)
 {
-	const char *dptr = data;
-	while (dptr - data < len) {
-		if (*dptr == '+') {
-			cb_tree_insert(tree, dptr+1);
+	int lo = 0, hi = repo->snapshots->nelts;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (APR_ARRAY_IDX(repo->commits, APR_ARRAY_IDX(repo->snapshots, mid, int), svn_revnum_t) <= revision) {
+			lo = mid + 1;
 		} else {
-			cb_tree_delete(tree, dptr+1);
+			hi = mid;
 		}
-		dptr += 2 + strlen(dptr+1);
 	}
-	return 0;
+	return lo - 1;
 }
 
 
-/* Reconstructs a tree for the given revision */
-static int pr_reconstruct(path_repo_t *repo, cb_tree_t *tree, svn_revnum_t revision, apr_pool_t *pool)
+/* Applies the stored data starting at the given index up to the given revision */
+static int pr_replay(path_repo_t *repo, path_tree_t *tree, apr_size_t *size, int first, svn_revnum_t revision, apr_pool_t *pool)
 {
 	mdatum_t key, val;
 	svn_revnum_t r;
 	char *dptr;
 	size_t dsize;
+	int i, ret;
 #ifdef DEBUG
 	apr_time_t start = apr_time_now();
 #endif
 
-	/* Start at position of last snapshot and apply deltas */
-	r = (revision & ~(SNAPSHOT_INTERVAL-1));
-	while (r <= revision) {
+	for (i = first; i < repo->commits->nelts; i++) {
+		r = APR_ARRAY_IDX(repo->commits, i, svn_revnum_t);
+		if (r > revision) {
+			break;
+		}
 		key.dptr = apr_itoa(pool, r);
 		key.dsize = strlen(key.dptr);
 
-		if (mukv_exists(repo->db, key)) {
-			val = mukv_fetch(repo->db, key, pool);
-			if (val.dptr == NULL) {
-				fprintf(stderr, _("Error fetching tree delta for revision %ld\n"), r);
-				return -1;
-			}
+		val = mukv_fetch(repo->db, key, pool);
+		if (val.dptr == NULL) {
+			fprintf(stderr, _("Error fetching tree delta for revision %ld\n"), r);
+			return -1;
+		}
 #ifdef USE_SNAPPY
-			if (!snappy_uncompressed_length(val.dptr, val.dsize, &dsize)) {
-				return -1;
-			}
-			dptr = malloc(dsize);
-			if (snappy_uncompress(val.dptr, val.dsize, dptr) != 0) {
-				free(dptr);
-				return -1;
-			}
+		if (!snappy_uncompressed_length(val.dptr, val.dsize, &dsize)) {
+			return -1;
+		}
+		dptr = malloc(dsize);
+		if (snappy_uncompress(val.dptr, val.dsize, dptr) != 0) {
+			free(dptr);
+			return -1;
+		}
 #else
-			dptr = val.dptr;
-			dsize = val.dsize;
+		dptr = val.dptr;
+		dsize = val.dsize;
 #endif
-			if (pr_delta_apply(tree, dptr, dsize, pool) != 0) {
-				fprintf(stderr, _("Error applying tree delta for revision %ld\n"), r);
-				return -1;
-			}
-
+		ret = pr_delta_apply(tree, size, dptr, dsize, pool);
 #ifdef USE_SNAPPY
-			free(dptr);
+		free(dptr);
 #endif
+		if (ret != 0) {
+			fprintf(stderr, _("Error applying tree delta for revision %ld\n"), r);
+			return -1;
 		}
-		++r;
 	}
 
 #ifdef DEBUG
@@ -269,43 +419,150 @@ static int pr_reconstruct(path_repo_t *repo, cb_tree_t *tree, svn_revnum_t revis
 }
 
 
+#ifdef DEBUG
+
+/* Reconstructs a tree for the given revision, replacing the given one */
+static int pr_reconstruct(path_repo_t *repo, path_tree_t *tree, svn_revnum_t revision, apr_pool_t *pool)
+{
+	int snapshot = pr_snapshot_index(repo, revision);
+
+	/* Start with the last snapshot and apply deltas */
+	path_tree_clear(tree);
+	if (snapshot < 0) {
+		return pr_replay(repo, tree, NULL, 0, revision, pool);
+	}
+	*tree = path_tree_copy(&APR_ARRAY_IDX(repo->snapshot_trees, snapshot, path_tree_t));
+	return pr_replay(repo, tree, NULL, APR_ARRAY_IDX(repo->snapshots, snapshot, int) + 1, revision, pool);
+}
+
+#endif /* DEBUG */
+
+
 /* Returns a tree for the given revision */
-static cb_tree_t *pr_tree(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
+static path_tree_t *pr_tree(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 {
-	cb_tree_t *tree;
-	int i;
+	pr_cache_entry_t *entry;
+	path_tree_t *base = NULL, tree;
+	svn_revnum_t base_rev = -1;
+	int i, first, last, slot = -1, lru = -1;
+
+	/*
+	 * Revisions without stored data share the tree of the last revision
+	 * that has some. A cached tree of revision -1 is always empty.
+	 */
+	last = pr_commit_index(repo, revision);
+	revision = (last >= 0 ? APR_ARRAY_IDX(repo->commits, last, svn_revnum_t) : -1);
 
 	/* Check if tree is cached */
 	for (i = 0; i < repo->cache->nelts; i++) {
-		if (APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).revision == revision) {
-			tree = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree;
-#ifdef DEBUG
+		entry = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t);
+		if (entry->revision == revision) {
 			repo->cache_hits++;
-#endif
-			break;
+			entry->used = ++repo->cache_clock;
+			return &entry->tree;
+		}
+		if (entry->revision < 0) {
+			slot = i;
+		} else if (lru < 0 || entry->used < APR_ARRAY_IDX(repo->cache, lru, pr_cache_entry_t).used) {
+			lru = i;
 		}
 	}
+	repo->cache_misses++;
 
-	/* Reconstruct tree if needed */
-	if (i >= repo->cache->nelts) {
-#ifdef DEBUG
-		repo->cache_misses++;
-#endif
-		tree = &APR_ARRAY_IDX(repo->cache, repo->cache_index, pr_cache_entry_t).tree;
-		if (tree->root != NULL) {
-			cb_tree_clear(tree);
+	/* Use a free cache entry, or the least recently used one if the cache is full */
+	if (slot < 0) {
+		if (lru >= 0 && pr_cache_size(repo) >= repo->cache_size) {
+			slot = lru;
+		} else {
+			entry = &APR_ARRAY_PUSH(repo->cache, pr_cache_entry_t);
+			entry->revision = -1;
+			entry->tree = path_tree_make();
+			entry->size = 0;
+			slot = repo->cache->nelts - 1;
 		}
-		if (pr_reconstruct(repo, tree, revision, pool) != 0) {
-			return NULL;
+	}
+
+	/* Look for the closest tree before the requested one */
+	for (i = 0; i < repo->cache->nelts; i++) {
+		entry = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t);
+		if (entry->revision > base_rev && entry->revision < revision) {
+			base = &entry->tree;
+			base_rev = entry->revision;
 		}
+	}
 
-		APR_ARRAY_IDX(repo->cache, repo->cache_index, pr_cache_entry_t).revision = revision;
-		if (++repo->cache_index >= repo->cache->nelts) {
-			repo->cache_index = 0;
+	/* The last snapshot up to the requested revision can be used as well */
+	if ((i = pr_snapshot_index(repo, revision)) >= 0) {
+		svn_revnum_t snapshot = APR_ARRAY_IDX(repo->commits, APR_ARRAY_IDX(repo->snapshots, i, int), svn_revnum_t);
+		if (snapshot > base_rev) {
+			base = &APR_ARRAY_IDX(repo->snapshot_trees, i, path_tree_t);
+			base_rev = snapshot;
 		}
 	}
 
-	return tree;
+	/* The current tree can be used, too, if nothing has been scheduled */
+	if (repo->delta->nelts == 0 && (i = pr_commit_index(repo, repo->head)) >= 0) {
+		svn_revnum_t head = APR_ARRAY_IDX(repo->commits, i, svn_revnum_t);
+		if (head > base_rev && head <= revision) {
+			base = &repo->tree;
+			base_rev = head;
+		}
+	}
+
+	/*
+	 * Roll a copy of the closest tree forward. Copying a tree is cheap, and
+	 * only the paths changed while rolling forward are allocated for the new
+	 * tree. If the closest tree is about to be evicted anyway, it is rolled
+	 * forward in place.
+	 */
+	tree = (base != NULL ? path_tree_copy(base) : path_tree_make());
+	first = (base != NULL ? pr_commit_index(repo, base_rev) + 1 : 0);
+	entry = &APR_ARRAY_IDX(repo->cache, slot, pr_cache_entry_t);
+	pr_cache_evict(entry);
+	entry->tree = tree;
+	if (pr_replay(repo, &entry->tree, &entry->size, first, revision, pool) != 0) {
+		pr_cache_evict(entry);
+		return NULL;
+	}
+	entry->revision = revision;
+	entry->used = ++repo->cache_clock;
+
+	/* Evict the least recently used trees while the cache is too large */
+	while (pr_cache_size(repo) > repo->cache_size) {
+		lru = -1;
+		for (i = 0; i < repo->cache->nelts; i++) {
+			pr_cache_entry_t *e = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t);
+			if (i != slot && e->revision >= 0 && (lru < 0 || e->used < APR_ARRAY_IDX(repo->cache, lru, pr_cache_entry_t).used)) {
+				lru = i;
+			}
+		}
+		if (lru < 0) {
+			break;
+		}
+		pr_cache_evict(&APR_ARRAY_IDX(repo->cache, lru, pr_cache_entry_t));
+	}
+	return &entry->tree;
+}
+
+
+/* Replaces a cached tree of the previous head by the current tree, which
+   will be up to date once the scheduled actions have been committed */
+static void pr_cache_forward(path_repo_t *repo, svn_revnum_t head, svn_revnum_t revision)
+{
+	int i;
+
+	for (i = 0; i < repo->cache->nelts; i++) {
+		pr_cache_entry_t *entry = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t);
+		if (entry->revision != head) {
+			continue;
+		}
+
+		path_tree_clear(&entry->tree);
+		entry->tree = path_tree_copy(&repo->tree);
+		entry->size = 0;
+		entry->revision = revision;
+		return;
+	}
 }
 
 
@@ -376,8 +633,10 @@ static int pr_fetch_paths(apr_array_header_t *paths, const char *path, svn_revnu
 /*---------------------------------------------------------------------------*/
 
 
-/* Creates a new path repository in the given directory */
-path_repo_t *path_repo_create(const char *tmpdir, apr_pool_t *pool)
+/* Creates a new path repository in the given directory, using the given mukv
+   flags. At most snapshot_size bytes of deltas are applied per reconstruction,
+   and cached trees may use about cache_size bytes of memory */
+path_repo_t *path_repo_create(const char *tmpdir, int flags, apr_size_t snapshot_size, apr_size_t cache_size, apr_pool_t *pool)
 {
 	apr_pool_t *subpool = svn_pool_create(pool);
 	path_repo_t *repo = apr_pcalloc(subpool, sizeof(path_repo_t));
@@ -386,13 +645,18 @@ path_repo_t *path_repo_create(const char *tmpdir, apr_pool_t *pool)
 	repo->pool = subpool;
 	repo->delta_pool = svn_pool_create(repo->pool);
 
-	repo->tree = cb_tree_make();
+	repo->tree = path_tree_make();
+	repo->lifetimes = cb_tree_make();
 	repo->delta = apr_array_make(repo->pool, 1, sizeof(pr_delta_entry_t));
-	pr_cache_init(repo, CACHE_SIZE);
+	repo->commits = apr_array_make(repo->pool, 0, sizeof(svn_revnum_t));
+	repo->snapshots = apr_array_make(repo->pool, 0, sizeof(int));
+	repo->snapshot_trees = apr_array_make(repo->pool, 0, sizeof(path_tree_t));
+	repo->snapshot_size = snapshot_size;
+	pr_cache_init(repo, cache_size);
 
 	/* Open database */
 	db_path = apr_psprintf(pool, "%s/paths.db", tmpdir);
-	repo->db = mukv_open(db_path, repo->pool);
+	repo->db = mukv_open(db_path, flags, repo->pool);
 	if (repo->db == NULL) {
 		fprintf(stderr, _("Error creating path database (%s)\n"), strerror(errno));
 		return NULL;
@@ -418,7 +682,7 @@ int path_repo_add(path_repo_t *repo, const char *path, apr_pool_t *pool)
 	e->path = apr_pstrdup(repo->delta_pool, path);
 	repo->delta_len += (2 + strlen(path));
 
-	if (cb_tree_insert(&repo->tree, e->path) != 0) {
+	if (path_tree_insert(&repo->tree, e->path, NULL) < 0) {
 		return -1;
 	}
 
@@ -440,7 +704,9 @@ int path_repo_delete(path_repo_t *repo, const char *path, apr_pool_t *pool)
 		e->path = apr_pstrdup(repo->delta_pool, p);
 		repo->delta_len += (2 + strlen(p));
 
-		cb_tree_delete(&repo->tree, e->path);
+		if (path_tree_delete(&repo->tree, e->path, NULL) < 0) {
+			return -1;
+		}
 	}
 	return 0;
 }
@@ -458,33 +724,30 @@ int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 #ifdef DEBUG
 	apr_time_t start = apr_time_now();
 #endif
-	int snapshot = (revision > 0 && (revision % SNAPSHOT_INTERVAL == 0));
+	int snapshot;
 
-	/* Skip empty revisions if there's no snapshot pending */
-	if (repo->delta_len <= 0 && !snapshot) {
+	/* Skip empty revisions */
+	if (repo->delta_len <= 0) {
 		repo->head = revision;
 		return 0;
 	}
 
-	/* Encode data if necessary */
-	if (!snapshot) {
-		val.dptr = apr_palloc(pool, repo->delta_len);
-		val.dsize = repo->delta_len;
-		dptr = val.dptr;
+	/* Keep a snapshot if the deltas to apply would grow too large */
+	snapshot = (revision > 0 && repo->replay_len + repo->delta_len > repo->snapshot_size);
 
-		for (i = 0; i < repo->delta->nelts; i++) {
-			pr_delta_entry_t *e = &APR_ARRAY_IDX(repo->delta, i, pr_delta_entry_t);
+	/* Encode data. The deltas are stored for snapshots, too, as they are
+	   needed for restoring the snapshots after loading a saved state */
+	val.dptr = apr_palloc(pool, repo->delta_len);
+	val.dsize = repo->delta_len;
+	dptr = val.dptr;
 
-			*dptr++ = e->action;
-			strcpy(dptr, e->path);
-			dptr += strlen(e->path);
-			*dptr++ = '\0';
-		}
-	} else {
-		if (pr_encode(&repo->tree, &val.dptr, &val.dsize, pool) != 0) {
-			fprintf(stderr, _("Error encoding tree data for snapshot\n"));
-			return -1;
-		}
+	for (i = 0; i < repo->delta->nelts; i++) {
+		pr_delta_entry_t *e = &APR_ARRAY_IDX(repo->delta, i, pr_delta_entry_t);
+
+		*dptr++ = e->action;
+		strcpy(dptr, e->path);
+		dptr += strlen(e->path);
+		*dptr++ = '\0';
 	}
 
 #ifdef DEBUG
@@ -512,6 +775,31 @@ int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 		return -1;
 	}
 
+	for (i = 0; i < repo->delta->nelts; i++) {
+		pr_delta_entry_t *e = &APR_ARRAY_IDX(repo->delta, i, pr_delta_entry_t);
+		if (pr_lifetime_record(repo, e->path, e->action, revision) != 0) {
+			fprintf(stderr, _("Error updating lifetime of %s\n"), e->path);
+			return -1;
+		}
+	}
+
+	if (repo->commits->nelts == 0 || APR_ARRAY_IDX(repo->commits, repo->commits->nelts-1, svn_revnum_t) < revision) {
+		pr_cache_forward(repo, (repo->commits->nelts > 0 ? APR_ARRAY_IDX(repo->commits, repo->commits->nelts-1, svn_revnum_t) : -1), revision);
+		APR_ARRAY_PUSH(repo->commits, svn_revnum_t) = revision;
+	}
+	if (snapshot) {
+		int idx = repo->commits->nelts-1;
+		if (repo->snapshots->nelts == 0 || APR_ARRAY_IDX(repo->snapshots, repo->snapshots->nelts-1, int) < idx) {
+			APR_ARRAY_PUSH(repo->snapshots, int) = idx;
+			APR_ARRAY_PUSH(repo->snapshot_trees, path_tree_t) = path_tree_make();
+		}
+		path_tree_clear(&APR_ARRAY_IDX(repo->snapshot_trees, repo->snapshot_trees->nelts-1, path_tree_t));
+		APR_ARRAY_IDX(repo->snapshot_trees, repo->snapshot_trees->nelts-1, path_tree_t) = path_tree_copy(&repo->tree);
+		repo->replay_len = 0;
+	} else {
+		repo->replay_len += repo->delta_len;
+	}
+
 	repo->head = revision;
 	repo->delta_len = 0;
 	apr_array_clear(repo->delta);
@@ -526,13 +814,22 @@ int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 /* Discards all scheduled actions */
 int path_repo_discard(path_repo_t *repo, apr_pool_t *pool)
 {
+	path_tree_t *tree;
+
+	/* Revert to previous head. This must be done before clearing the
+	   scheduled actions, as the current tree must not be used by pr_tree() */
+	tree = pr_tree(repo, repo->head, pool);
+
 	repo->delta_len = 0;
 	apr_array_clear(repo->delta);
 	svn_pool_clear(repo->delta_pool);
 
-	/* Revert to previous head */
-	cb_tree_clear(&repo->tree);
-	return pr_reconstruct(repo, &repo->tree, repo->head, pool);
+	path_tree_clear(&repo->tree);
+	if (tree == NULL) {
+		return -1;
+	}
+	repo->tree = path_tree_copy(tree);
+	return 0;
 }
 
 
@@ -595,7 +892,7 @@ int path_repo_commit_log(path_repo_t *repo, session_t *session, dump_options_t *
 				}
 			} else {
 				svn_revnum_t copyfrom_rev = delta_get_local_copyfrom_rev(info->copyfrom_rev, opts, logs, revision);
-				cb_tree_t *tree = pr_tree(repo, copyfrom_rev, pool);
+				path_tree_t *tree = pr_tree(repo, copyfrom_rev, pool);
 				if (tree == NULL) {
 					return -1;
 				}
@@ -627,41 +924,159 @@ int path_repo_commit_log(path_repo_t *repo, session_t *session, dump_options_t *
 /* Checks if a path exists at a given revision */
 extern signed char path_repo_exists(path_repo_t *repo, const char *path, svn_revnum_t revision, apr_pool_t *pool)
 {
-	cb_tree_t *tree;
+	(void)pool;
 	if (revision < 0) {
 		return 0;
 	}
+	return (signed char)pr_lifetime_exists(repo, path, revision);
+}
 
-	tree = pr_tree(repo, revision, pool);
-	if (tree == NULL) {
-		return -1;
+
+/* Checks the parent relation of two paths at a given revision */
+signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool)
+{
+	if (revision < 0) {
+		return 0;
 	}
-	if (cb_tree_contains(tree, path)) {
-		return 1;
+	return (signed char)pr_lifetime_exists(repo, apr_psprintf(pool, "%s/%s", parent, child), revision);
+}
+
+
+/* Saves the committed state of the repository to a state file */
+int path_repo_save(path_repo_t *repo, state_file_t *sf)
+{
+	pr_save_baton_t sb;
+	int i;
+
+	if (state_write_int(sf, repo->head) != 0
+		|| state_write_int(sf, repo->replay_len) != 0
+		|| state_write_int(sf, repo->commits->nelts) != 0) {
+		goto write_error;
+	}
+	for (i = 0; i < repo->commits->nelts; i++) {
+		if (state_write_int(sf, APR_ARRAY_IDX(repo->commits, i, svn_revnum_t)) != 0) {
+			goto write_error;
+		}
+	}
+	if (state_write_int(sf, repo->snapshots->nelts) != 0) {
+		goto write_error;
+	}
+	for (i = 0; i < repo->snapshots->nelts; i++) {
+		if (state_write_int(sf, APR_ARRAY_IDX(repo->snapshots, i, int)) != 0) {
+			goto write_error;
+		}
+	}
+
+	/* The lifetime index is terminated by a NULL path */
+	sb.sf = sf;
+	sb.err = 0;
+	cb_tree_walk_prefixed(&repo->lifetimes, "", pr_lifetime_save_cb, &sb);
+	if (sb.err || state_write_string(sf, NULL) != 0) {
+		goto write_error;
+	}
+
+	if (mukv_save(repo->db, sf) != 0) {
+		goto write_error;
 	}
 	return 0;
+
+write_error:
+	fprintf(stderr, _("Error saving path repository state\n"));
+	return -1;
 }
 
 
-/* Checks the parent relation of two paths at a given revision */
-signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool)
+/* Loads the state of the repository from a state file */
+int path_repo_load(path_repo_t *repo, state_file_t *sf, apr_pool_t *pool)
 {
+	apr_int64_t head, replay_len, n, v;
+	apr_pool_t *iterpool;
 	char *path;
-	cb_tree_t *tree;
+	int i, j;
 
-	if (revision < 0) {
-		return 0;
+	apr_array_clear(repo->commits);
+	apr_array_clear(repo->snapshots);
+	for (i = 0; i < repo->snapshot_trees->nelts; i++) {
+		path_tree_clear(&APR_ARRAY_IDX(repo->snapshot_trees, i, path_tree_t));
+	}
+	apr_array_clear(repo->snapshot_trees);
+	if (state_read_int(sf, &head) != 0
+		|| state_read_int(sf, &replay_len) != 0
+		|| state_read_int(sf, &n) != 0) {
+		goto read_error;
+	}
+	for (i = 0; i < n; i++) {
+		if (state_read_int(sf, &v) != 0) {
+			goto read_error;
+		}
+		APR_ARRAY_PUSH(repo->commits, svn_revnum_t) = (svn_revnum_t)v;
+	}
+	if (state_read_int(sf, &n) != 0) {
+		goto read_error;
+	}
+	for (i = 0; i < n; i++) {
+		if (state_read_int(sf, &v) != 0 || v < 0 || v >= repo->commits->nelts) {
+			goto read_error;
+		}
+		APR_ARRAY_PUSH(repo->snapshots, int) = (int)v;
 	}
 
-	tree = pr_tree(repo, revision, pool);
-	if (tree == NULL) {
-		return -1;
+	cb_tree_walk_prefixed(&repo->lifetimes, "", pr_lifetime_free_cb, NULL);
+	cb_tree_clear(&repo->lifetimes);
+	if (state_read_string(sf, &path, pool) != 0) {
+		goto read_error;
 	}
-	path = apr_psprintf(pool, "%s/%s", parent, child);
-	if (cb_tree_contains(tree, path)) {
-		return 1;
+	while (path != NULL) {
+		void *data;
+		pr_lifetime_t *lt;
+		char *revs;
+
+		if (state_read_data(sf, &revs, &n, pool) != 0 || n < 0 || n % sizeof(svn_revnum_t) != 0
+			|| cb_tree_insert_data(&repo->lifetimes, path, sizeof(pr_lifetime_t), &data) == ENOMEM) {
+			goto read_error;
+		}
+		lt = data;
+		lt->nrevs = lt->size = (int)(n / sizeof(svn_revnum_t));
+		if (lt->size > 0) {
+			if ((lt->revs = malloc((size_t)n)) == NULL) {
+				goto read_error;
+			}
+			memcpy(lt->revs, revs, (size_t)n);
+		}
+		if (state_read_string(sf, &path, pool) != 0) {
+			goto read_error;
+		}
+	}
+
+	if (mukv_load(repo->db, sf, pool) != 0) {
+		goto read_error;
+	}
+	repo->head = (svn_revnum_t)head;
+	repo->replay_len = (apr_size_t)replay_len;
+
+	/* Restore the snapshots and the current tree by replaying all deltas */
+	repo->delta_len = 0;
+	apr_array_clear(repo->delta);
+	svn_pool_clear(repo->delta_pool);
+	path_tree_clear(&repo->tree);
+	iterpool = svn_pool_create(pool);
+	for (i = 0, j = 0; i < repo->commits->nelts; i++) {
+		if (pr_replay(repo, &repo->tree, NULL, i, APR_ARRAY_IDX(repo->commits, i, svn_revnum_t), iterpool) != 0) {
+			svn_pool_destroy(iterpool);
+			return -1;
+		}
+		if (j < repo->snapshots->nelts && APR_ARRAY_IDX(repo->snapshots, j, int) == i) {
+			APR_ARRAY_PUSH(repo->snapshot_trees, path_tree_t) = path_tree_copy(&repo->tree);
+			j++;
+		}
+		svn_pool_clear(iterpool);
 	}
+	svn_pool_destroy(iterpool);
 	return 0;
+
+read_error:
+	fprintf(stderr, _("Error loading path repository state\n"));
+	return -1;
 }
 
 #ifdef DEBUG
@@ -671,7 +1086,7 @@ int path_repo_test(path_repo_t *repo, session_t *session, svn_revnum_t revision,
 {
 	apr_array_header_t *paths_recon;
 	apr_array_header_t *paths_orig;
-	cb_tree_t tree = cb_tree_make();
+	path_tree_t tree = path_tree_make();
 	int i, ret = 0;
 
 	/* Retrieve reconstructed tree */
@@ -712,7 +1127,7 @@ int path_repo_test(path_repo_t *repo, session_t *session, svn_revnum_t revision,
 		}
 	}
 
-	cb_tree_clear(&tree);
+	path_tree_clear(&tree);
 	return ret;
 }
 
@@ -30,13 +30,16 @@
 #include "dump.h"
 #include "log.h"
 #include "session.h"
+#include "state.h"
 
 
 typedef struct path_repo_t path_repo_t;
 
 
-/* Creates a new path repository in the given directory */
-extern path_repo_t *path_repo_create(const char *tmpdir, apr_pool_t *pool);
+/* Creates a new path repository in the given directory, using the given mukv
+   flags. At most snapshot_size bytes of deltas are applied per reconstruction,
+   and cached trees may use about cache_size bytes of memory */
+extern path_repo_t *path_repo_create(const char *tmpdir, int flags, apr_size_t snapshot_size, apr_size_t cache_size, apr_pool_t *pool);
 
 /* Schedules the given path for addition */
 extern int path_repo_add(path_repo_t *repo, const char *path, apr_pool_t *pool);
@@ -59,6 +62,12 @@ extern signed char path_repo_exists(path_repo_t *repo, const char *path, svn_rev
 /* Checks the parent relation of two paths at a given revision */
 extern signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool);
 
+/* Saves the committed state of the repository to a state file */
+extern int path_repo_save(path_repo_t *repo, state_file_t *sf);
+
+/* Loads the state of the repository from a state file */
+extern int path_repo_load(path_repo_t *repo, state_file_t *sf, apr_pool_t *pool);
+
 #ifdef DEBUG
 
 /* Testing */
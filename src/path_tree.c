@@ -0,0 +1,330 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: path_tree.c
+ *      desc: Persistent crit-bit tree for paths
+ *
+ *      This is the crit-bit tree of critbit89, but its nodes are reference
+ *      counted and may be shared by several trees. Copying a tree only
+ *      copies its root. Modifying a tree copies the shared nodes on the way
+ *      to the modified leaf (path copying), so a series of trees derived from
+ *      each other only needs memory proportional to the changes between them.
+ */
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "path_tree.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Internal nodes have two children, leaves have none and store a path */
+struct path_tree_node_t {
+	unsigned int refs;
+	apr_uint32_t byte;
+	unsigned char otherbits;
+	path_tree_node_t *child[2];
+	char path[1];
+};
+
+
+/* Memory used by nodes */
+#define PT_NODE_SIZE sizeof(path_tree_node_t)
+#define PT_LEAF_SIZE(len) (offsetof(path_tree_node_t, path) + (len) + 1)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Returns the child of an internal node to follow for the given path */
+static int pt_direction(const path_tree_node_t *n, const unsigned char *ubytes, size_t ulen)
+{
+	unsigned char c = 0;
+	if (n->byte < ulen) {
+		c = ubytes[n->byte];
+	}
+	return (1 + (n->otherbits | c)) >> 8;
+}
+
+
+/* Returns the leaf that would contain the given path */
+static path_tree_node_t *pt_closest(path_tree_node_t *n, const unsigned char *ubytes, size_t ulen)
+{
+	while (n->child[0] != NULL) {
+		n = n->child[pt_direction(n, ubytes, ulen)];
+	}
+	return n;
+}
+
+
+/* Drops a reference to a node, freeing it if it isn't used anymore */
+static void pt_unref(path_tree_node_t *n)
+{
+	if (--n->refs > 0) {
+		return;
+	}
+	if (n->child[0] != NULL) {
+		pt_unref(n->child[0]);
+		pt_unref(n->child[1]);
+	}
+	free(n);
+}
+
+
+/* Copies the internal node at the given location if it is shared with other
+   trees, so it can be modified. Returns the node or NULL on error */
+static path_tree_node_t *pt_own(path_tree_node_t **where, apr_size_t *size)
+{
+	path_tree_node_t *n = *where, *copy;
+
+	if (n->refs == 1) {
+		return n;
+	}
+	if ((copy = malloc(PT_NODE_SIZE)) == NULL) {
+		return NULL;
+	}
+	memcpy(copy, n, PT_NODE_SIZE);
+	copy->refs = 1;
+	copy->child[0]->refs++;
+	copy->child[1]->refs++;
+	--n->refs;
+	*where = copy;
+
+	if (size != NULL) {
+		*size += PT_NODE_SIZE;
+	}
+	return copy;
+}
+
+
+/* Calls callback for all paths below a node with the given prefix */
+static int pt_traverse_prefixed(path_tree_node_t *n, const char *prefix, size_t len, int (*callback)(const char *, void *), void *baton)
+{
+	int ret;
+
+	if (n->child[0] == NULL) {
+		if (strncmp(n->path, prefix, len) != 0) {
+			return 0;
+		}
+		return (callback)(n->path, baton);
+	}
+
+	if ((ret = pt_traverse_prefixed(n->child[0], prefix, len, callback, baton)) != 0) {
+		return ret;
+	}
+	return pt_traverse_prefixed(n->child[1], prefix, len, callback, baton);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new, empty tree */
+path_tree_t path_tree_make()
+{
+	path_tree_t tree;
+	tree.root = NULL;
+	return tree;
+}
+
+
+/* Returns non-zero if the tree contains the given path */
+int path_tree_contains(path_tree_t *tree, const char *path)
+{
+	if (tree->root == NULL) {
+		return 0;
+	}
+	return (strcmp(pt_closest(tree->root, (const unsigned char *)path, strlen(path))->path, path) == 0);
+}
+
+
+/* Inserts a path into the tree. Returns 0 if the path has been inserted, 1 if
+   it is already present and -1 on error. If size is not NULL, the memory of
+   newly allocated nodes will be added to it */
+int path_tree_insert(path_tree_t *tree, const char *path, apr_size_t *size)
+{
+	const unsigned char *ubytes = (const unsigned char *)path;
+	const size_t ulen = strlen(path);
+	path_tree_node_t *leaf, *node, **where;
+	apr_uint32_t newbyte = 0;
+	unsigned int newotherbits = 0;
+	int newdirection = 0;
+
+	/* Find the critical bit, as in critbit89 */
+	if (tree->root != NULL) {
+		const unsigned char *p = (const unsigned char *)pt_closest(tree->root, ubytes, ulen)->path;
+
+		while (newbyte < ulen && p[newbyte] == ubytes[newbyte]) {
+			++newbyte;
+		}
+		if (newbyte == ulen && p[newbyte] == 0) {
+			return 1;
+		}
+		newotherbits = p[newbyte] ^ ubytes[newbyte];
+		newotherbits |= newotherbits >> 1;
+		newotherbits |= newotherbits >> 2;
+		newotherbits |= newotherbits >> 4;
+		newotherbits = (newotherbits & ~(newotherbits >> 1)) ^ 255;
+		newdirection = (1 + (newotherbits | p[newbyte])) >> 8;
+	}
+
+	if ((leaf = malloc(PT_LEAF_SIZE(ulen))) == NULL) {
+		return -1;
+	}
+	leaf->refs = 1;
+	leaf->child[0] = leaf->child[1] = NULL;
+	memcpy(leaf->path, path, ulen + 1);
+
+	if (tree->root == NULL) {
+		tree->root = leaf;
+		if (size != NULL) {
+			*size += PT_LEAF_SIZE(ulen);
+		}
+		return 0;
+	}
+
+	if ((node = malloc(PT_NODE_SIZE)) == NULL) {
+		free(leaf);
+		return -1;
+	}
+	node->refs = 1;
+	node->byte = newbyte;
+	node->otherbits = (unsigned char)newotherbits;
+	node->child[1 - newdirection] = leaf;
+
+	/* Walk down to the insertion point, copying shared nodes on the way */
+	where = &tree->root;
+	while ((*where)->child[0] != NULL) {
+		path_tree_node_t *q = *where;
+		if (q->byte > newbyte || (q->byte == newbyte && q->otherbits > newotherbits)) {
+			break;
+		}
+		if ((q = pt_own(where, size)) == NULL) {
+			free(node);
+			free(leaf);
+			return -1;
+		}
+		where = &q->child[pt_direction(q, ubytes, ulen)];
+	}
+
+	node->child[newdirection] = *where;
+	*where = node;
+	if (size != NULL) {
+		*size += PT_NODE_SIZE + PT_LEAF_SIZE(ulen);
+	}
+	return 0;
+}
+
+
+/* Deletes a path from the tree. Returns 0 if the path has been deleted, 1 if
+   it is not present and -1 on error. If size is not NULL, the memory of newly
+   allocated nodes will be added to it */
+int path_tree_delete(path_tree_t *tree, const char *path, apr_size_t *size)
+{
+	const unsigned char *ubytes = (const unsigned char *)path;
+	const size_t ulen = strlen(path);
+	path_tree_node_t **where, **whereq = NULL, *parent, *sibling;
+
+	if (!path_tree_contains(tree, path)) {
+		return 1;
+	}
+
+	/*
+	 * The parent of the leaf will be replaced by its sibling, so all nodes
+	 * above the parent need to be copied if they are shared.
+	 */
+	where = &tree->root;
+	while ((*where)->child[0] != NULL) {
+		path_tree_node_t *q = *where;
+		int direction = pt_direction(q, ubytes, ulen);
+		if (q->child[direction]->child[0] != NULL && (q = pt_own(where, size)) == NULL) {
+			return -1;
+		}
+		whereq = where;
+		where = &q->child[direction];
+	}
+
+	if (whereq == NULL) {
+		pt_unref(tree->root);
+		tree->root = NULL;
+		return 0;
+	}
+
+	parent = *whereq;
+	sibling = parent->child[where == &parent->child[0] ? 1 : 0];
+	sibling->refs++;
+	*whereq = sibling;
+	pt_unref(parent);
+	return 0;
+}
+
+
+/* Returns a copy of the tree that shares all nodes with it */
+path_tree_t path_tree_copy(path_tree_t *tree)
+{
+	if (tree->root != NULL) {
+		tree->root->refs++;
+	}
+	return *tree;
+}
+
+
+/* Clears the tree, freeing all nodes that are not shared with other trees */
+void path_tree_clear(path_tree_t *tree)
+{
+	if (tree->root != NULL) {
+		pt_unref(tree->root);
+	}
+	tree->root = NULL;
+}
+
+
+/* Calls callback for all paths in the tree with the given prefix */
+int path_tree_walk_prefixed(path_tree_t *tree, const char *prefix, int (*callback)(const char *, void *), void *baton)
+{
+	const unsigned char *ubytes = (const unsigned char *)prefix;
+	const size_t ulen = strlen(prefix);
+	path_tree_node_t *n = tree->root, *top = n;
+
+	if (n == NULL) {
+		return 0;
+	}
+
+	/* Find the subtree of all paths sharing the prefix, as in critbit89 */
+	while (n->child[0] != NULL) {
+		path_tree_node_t *q = n;
+		n = q->child[pt_direction(q, ubytes, ulen)];
+		if (q->byte < ulen) {
+			top = n;
+		}
+	}
+
+	return pt_traverse_prefixed(top, prefix, ulen, callback, baton);
+}
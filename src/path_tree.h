@@ -0,0 +1,64 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: path_tree.h
+ *      desc: Persistent crit-bit tree for paths
+ */
+
+
+#ifndef PATH_TREE_H_
+#define PATH_TREE_H_
+
+
+#include <apr.h>
+
+
+typedef struct path_tree_node_t path_tree_node_t;
+
+typedef struct {
+	path_tree_node_t *root;
+} path_tree_t;
+
+
+/* Creates a new, empty tree */
+extern path_tree_t path_tree_make();
+
+/* Returns non-zero if the tree contains the given path */
+extern int path_tree_contains(path_tree_t *tree, const char *path);
+
+/* Inserts a path into the tree. Returns 0 if the path has been inserted, 1 if
+   it is already present and -1 on error. If size is not NULL, the memory of
+   newly allocated nodes will be added to it */
+extern int path_tree_insert(path_tree_t *tree, const char *path, apr_size_t *size);
+
+/* Deletes a path from the tree. Returns 0 if the path has been deleted, 1 if
+   it is not present and -1 on error. If size is not NULL, the memory of newly
+   allocated nodes will be added to it */
+extern int path_tree_delete(path_tree_t *tree, const char *path, apr_size_t *size);
+
+/* Returns a copy of the tree that shares all nodes with it */
+extern path_tree_t path_tree_copy(path_tree_t *tree);
+
+/* Clears the tree, freeing all nodes that are not shared with other trees */
+extern void path_tree_clear(path_tree_t *tree);
+
+/* Calls callback for all paths in the tree with the given prefix */
+extern int path_tree_walk_prefixed(path_tree_t *tree, const char *prefix, int (*callback)(const char *, void *), void *baton);
+
+
+#endif
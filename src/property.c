@@ -226,37 +226,47 @@ size_t property_del_strlen(struct apr_pool_t *pool, const char *key)
 }
 
 
-/* Dumps a property to stdout */
-void property_dump(const char *key, const char *value)
+/* Dumps a property to the given output */
+void property_dump(output_t *out, const char *key, const char *value)
 {
+	size_t len;
+
 	/* NOTE: This is duplicated in property_hash_write */
 	if (key == NULL) {
 		return;
 	}
-	printf("K %lu\n", (unsigned long)strlen(key));
-	printf("%s\n", key);
+	len = strlen(key);
+	output_printf(out, "K %lu\n", (unsigned long)len);
+	output_write(out, key, len);
+	output_write(out, "\n", 1);
 	if (value != NULL) {
-		printf("V %lu\n", (unsigned long)strlen(value));
-		printf("%s\n", value);
+		len = strlen(value);
+		output_printf(out, "V %lu\n", (unsigned long)len);
+		output_write(out, value, len);
+		output_write(out, "\n", 1);
 	} else {
-		printf("V 0\n\n");
+		output_puts(out, "V 0\n\n");
 	}
 }
 
 
-/* Dumps a property deletion to stdout */
-void property_del_dump(const char *key)
+/* Dumps a property deletion to the given output */
+void property_del_dump(output_t *out, const char *key)
 {
+	size_t len;
+
 	if (key == NULL) {
 		return;
 	}
-	printf("D %lu\n", (unsigned long)strlen(key));
-	printf("%s\n", key);
+	len = strlen(key);
+	output_printf(out, "D %lu\n", (unsigned long)len);
+	output_write(out, key, len);
+	output_write(out, "\n", 1);
 }
 
 
-/* Initializes the property storage, binding it to the given pool */
-property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool)
+/* Initializes the property storage, binding it to the given pool and using the given mukv flags */
+property_storage_t *property_storage_create(const char *tmpdir, int flags, apr_pool_t *pool)
 {
 	char *db_path;
 	property_storage_t *store = apr_pcalloc(pool, sizeof(property_storage_t));
@@ -272,7 +282,7 @@ property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool
 
 	/* Open database */
 	db_path = apr_psprintf(store->pool, "%s/props.db", tmpdir);
-	store->db = mukv_open(db_path, store->pool);
+	store->db = mukv_open(db_path, flags, store->pool);
 	if (store->db == NULL) {
 		fprintf(stderr, "Error creating path database (%s)\n", strerror(errno));
 		return NULL;
@@ -497,3 +507,91 @@ int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool)
 	}
 	return 0;
 }
+
+
+/* Saves the references of the storage to a state file. The storage should be cleaned up before */
+int property_storage_save(property_storage_t *store, state_file_t *sf, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	prop_ref_t *ref;
+	prop_entry_t *entry;
+
+	if (state_write_int(sf, apr_hash_count(store->refs)) != 0) {
+		return -1;
+	}
+	for (hi = apr_hash_first(pool, store->refs); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, NULL, NULL, (void **)&ref);
+		if (state_write_data(sf, ref->id, APR_MD5_DIGESTSIZE) != 0 || state_write_int(sf, ref->count) != 0) {
+			return -1;
+		}
+	}
+
+	if (state_write_int(sf, apr_hash_count(store->entries)) != 0) {
+		return -1;
+	}
+	for (hi = apr_hash_first(pool, store->entries); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, NULL, NULL, (void **)&entry);
+		if (state_write_string(sf, entry->path) != 0 || state_write_data(sf, entry->ref->id, APR_MD5_DIGESTSIZE) != 0) {
+			return -1;
+		}
+	}
+
+	return mukv_save(store->db, sf);
+}
+
+
+/* Loads the references of the storage from a state file */
+int property_storage_load(property_storage_t *store, state_file_t *sf, apr_pool_t *pool)
+{
+	apr_int64_t n, len, count;
+	char *data;
+	prop_ref_t *ref;
+	prop_entry_t *entry;
+
+	/* References */
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	while (n-- > 0) {
+		if (state_read_data(sf, &data, &len, pool) != 0 || len != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+		if (state_read_int(sf, &count) != 0) {
+			return -1;
+		}
+		if ((ref = malloc(sizeof(prop_ref_t))) == NULL) {
+			return -1;
+		}
+		memcpy(ref->id, data, APR_MD5_DIGESTSIZE);
+		ref->count = (int)count;
+		apr_hash_set(store->refs, ref->id, APR_MD5_DIGESTSIZE, ref);
+	}
+
+	/* Entries */
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	while (n-- > 0) {
+		char *path;
+		if (state_read_string(sf, &path, pool) != 0 || path == NULL) {
+			return -1;
+		}
+		if (state_read_data(sf, &data, &len, pool) != 0 || len != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+		if ((ref = apr_hash_get(store->refs, data, APR_MD5_DIGESTSIZE)) == NULL) {
+			return -1;
+		}
+		if ((entry = malloc(sizeof(prop_entry_t))) == NULL) {
+			return -1;
+		}
+		if ((entry->path = strdup(path)) == NULL) {
+			free(entry);
+			return -1;
+		}
+		entry->ref = ref;
+		apr_hash_set(store->entries, entry->path, APR_HASH_KEY_STRING, entry);
+	}
+
+	return mukv_load(store->db, sf, pool);
+}
@@ -29,6 +29,9 @@
 #include <apr_pools.h>
 #include <apr_hash.h>
 
+#include "output.h"
+#include "state.h"
+
 
 /* Returns the length of a property */
 extern size_t property_strlen(apr_pool_t *pool, const char *key, const char *value);
@@ -36,18 +39,18 @@ extern size_t property_strlen(apr_pool_t *pool, const char *key, const char *val
 /* Returns the length of a property deletion */
 extern size_t property_del_strlen(apr_pool_t *pool, const char *key);
 
-/* Dumps a property to stdout */
-extern void property_dump(const char *key, const char *value);
+/* Dumps a property to the given output */
+extern void property_dump(output_t *out, const char *key, const char *value);
 
-/* Dumps a property deletion to stdout */
-extern void property_del_dump(const char *key);
+/* Dumps a property deletion to the given output */
+extern void property_del_dump(output_t *out, const char *key);
 
 
 /* Persistent property storage */
 typedef struct property_storage_t property_storage_t;
 
-/* Initializes the property storage, binding it to the given pool */
-extern property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool);
+/* Initializes the property storage, binding it to the given pool and using the given mukv flags */
+extern property_storage_t *property_storage_create(const char *tmpdir, int flags, apr_pool_t *pool);
 
 /* Saves the properties of the given path and references them */
 extern int property_store(property_storage_t *store, const char *path, apr_hash_t *props, apr_pool_t *pool);
@@ -61,5 +64,11 @@ extern int property_delete(property_storage_t *store, const char *path, apr_pool
 /* Removes properties from the storage that have zero reference count */
 extern int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool);
 
+/* Saves the references of the storage to a state file. The storage should be cleaned up before */
+extern int property_storage_save(property_storage_t *store, state_file_t *sf, apr_pool_t *pool);
+
+/* Loads the references of the storage from a state file */
+extern int property_storage_load(property_storage_t *store, state_file_t *sf, apr_pool_t *pool);
+
 
 #endif
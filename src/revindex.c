@@ -0,0 +1,370 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: revindex.c
+ *      desc: Index of revision offsets in a dumpfile
+ *
+ *      The index starts with a fixed-size header containing a magic string,
+ *      the format version and the length of the dumpfile header. It is
+ *      followed by one fixed-size record per revision in ascending order,
+ *      consisting of the local and original revision numbers, the offset
+ *      of the revision in the dumpfile and its length. All numbers are
+ *      stored as big-endian 64 bit integers, so records can be located
+ *      directly in the file.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "main.h"
+#include "logger.h"
+
+#include "revindex.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local definitions                                                         */
+/*---------------------------------------------------------------------------*/
+
+
+#define REVINDEX_MAGIC "RSVNDIDX"
+#define REVINDEX_MAGIC_LEN 8
+#define REVINDEX_VERSION 1
+#define REVINDEX_HEADER_SIZE 24
+#define REVINDEX_RECORD_SIZE 32
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+struct revindex_t {
+	apr_file_t *file;
+	const char *path;
+	apr_off_t header_len;
+	apr_pool_t *pool;
+};
+
+
+/* A single index record */
+typedef struct {
+	apr_int64_t local_rev;
+	apr_int64_t orig_rev;
+	apr_int64_t offset;
+	apr_int64_t length;
+} revindex_record_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Encodes a big-endian 64 bit integer */
+static void revindex_encode(unsigned char *buf, apr_int64_t value)
+{
+	apr_uint64_t v = (apr_uint64_t)value;
+	int i;
+	for (i = 7; i >= 0; i--) {
+		buf[i] = (unsigned char)(v & 0xFF);
+		v >>= 8;
+	}
+}
+
+
+/* Decodes a big-endian 64 bit integer */
+static apr_int64_t revindex_decode(const unsigned char *buf)
+{
+	apr_uint64_t v = 0;
+	int i;
+	for (i = 0; i < 8; i++) {
+		v = (v << 8) | buf[i];
+	}
+	return (apr_int64_t)v;
+}
+
+
+/* Writes a record to the given file */
+static int revindex_write_record(apr_file_t *file, const revindex_record_t *rec)
+{
+	unsigned char buf[REVINDEX_RECORD_SIZE];
+
+	revindex_encode(buf, rec->local_rev);
+	revindex_encode(buf + 8, rec->orig_rev);
+	revindex_encode(buf + 16, rec->offset);
+	revindex_encode(buf + 24, rec->length);
+	return (apr_file_write_full(file, buf, sizeof(buf), NULL) == APR_SUCCESS ? 0 : -1);
+}
+
+
+/* Reads the next record from the given file */
+static int revindex_read_record(apr_file_t *file, revindex_record_t *rec)
+{
+	unsigned char buf[REVINDEX_RECORD_SIZE];
+
+	if (apr_file_read_full(file, buf, sizeof(buf), NULL) != APR_SUCCESS) {
+		return -1;
+	}
+	rec->local_rev = revindex_decode(buf);
+	rec->orig_rev = revindex_decode(buf + 8);
+	rec->offset = revindex_decode(buf + 16);
+	rec->length = revindex_decode(buf + 24);
+	return 0;
+}
+
+
+/* Reads the record with the given number */
+static int revindex_read_record_at(apr_file_t *file, apr_int64_t n, revindex_record_t *rec)
+{
+	apr_off_t off = REVINDEX_HEADER_SIZE + n * REVINDEX_RECORD_SIZE;
+
+	if (apr_file_seek(file, APR_SET, &off) != APR_SUCCESS) {
+		return -1;
+	}
+	return revindex_read_record(file, rec);
+}
+
+
+/* Opens an index file for reading, returning the header length and
+   the number of records */
+static int revindex_open(apr_file_t **file, const char *path, apr_off_t *header_len, apr_int64_t *count, apr_pool_t *pool)
+{
+	unsigned char buf[REVINDEX_HEADER_SIZE];
+	apr_finfo_t finfo;
+
+	if (apr_file_open(file, path, APR_READ | APR_BUFFERED | APR_BINARY, 0600, pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to open index file %s\n"), path);
+		return -1;
+	}
+	if (apr_file_info_get(&finfo, APR_FINFO_SIZE, *file) != APR_SUCCESS
+		|| apr_file_read_full(*file, buf, sizeof(buf), NULL) != APR_SUCCESS
+		|| memcmp(buf, REVINDEX_MAGIC, REVINDEX_MAGIC_LEN)
+		|| revindex_decode(buf + 8) != REVINDEX_VERSION) {
+		fprintf(stderr, _("ERROR: %s is not a valid index file\n"), path);
+		apr_file_close(*file);
+		return -1;
+	}
+
+	*header_len = (apr_off_t)revindex_decode(buf + 16);
+	*count = (finfo.size - REVINDEX_HEADER_SIZE) / REVINDEX_RECORD_SIZE;
+	return 0;
+}
+
+
+/* Returns the number of the first record with a local revision not less
+   than the given one, or count if there is none */
+static apr_int64_t revindex_find(apr_file_t *file, apr_int64_t count, svn_revnum_t rev)
+{
+	apr_int64_t lo = 0, hi = count;
+	revindex_record_t rec;
+
+	while (lo < hi) {
+		apr_int64_t mid = lo + (hi - lo) / 2;
+		if (revindex_read_record_at(file, mid, &rec) != 0) {
+			return -1;
+		}
+		if (rec.local_rev < rev) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new index file at the given path */
+revindex_t *revindex_create(const char *path, apr_pool_t *pool)
+{
+	revindex_t *idx = apr_pcalloc(pool, sizeof(revindex_t));
+	unsigned char buf[REVINDEX_HEADER_SIZE];
+
+	if (apr_file_open(&idx->file, path, APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to open index file %s for writing\n"), path);
+		return NULL;
+	}
+	idx->path = apr_pstrdup(pool, path);
+	idx->pool = pool;
+
+	/* Reserve space for the header, which is written on close */
+	memset(buf, 0x00, sizeof(buf));
+	if (apr_file_write_full(idx->file, buf, sizeof(buf), NULL) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to write to index file %s\n"), path);
+		apr_file_close(idx->file);
+		return NULL;
+	}
+	return idx;
+}
+
+
+/* Sets the length of the dumpfile header preceding the first revision */
+void revindex_set_header(revindex_t *idx, apr_off_t length)
+{
+	idx->header_len = length;
+}
+
+
+/* Adds a revision to the index. The original revision is -1 for padding revisions */
+int revindex_add(revindex_t *idx, svn_revnum_t local_rev, svn_revnum_t orig_rev, apr_off_t offset, apr_off_t length)
+{
+	revindex_record_t rec;
+
+	rec.local_rev = local_rev;
+	rec.orig_rev = orig_rev;
+	rec.offset = offset;
+	rec.length = length;
+	if (revindex_write_record(idx->file, &rec) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write to index file %s\n"), idx->path);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Appends all entries of another index file, shifting their offsets by base.
+   Afterwards, base is advanced by the length of the indexed dumpfile. */
+int revindex_append(revindex_t *idx, const char *path, apr_off_t *base, apr_pool_t *pool)
+{
+	apr_file_t *file;
+	apr_off_t header_len, end;
+	apr_int64_t count, i;
+	revindex_record_t rec;
+
+	if (revindex_open(&file, path, &header_len, &count, pool) != 0) {
+		return -1;
+	}
+
+	/* Only the first part carries the dumpfile header */
+	if (*base == 0) {
+		idx->header_len = header_len;
+	}
+	end = header_len;
+
+	for (i = 0; i < count; i++) {
+		if (revindex_read_record(file, &rec) != 0) {
+			fprintf(stderr, _("ERROR: Unable to read from index file %s\n"), path);
+			apr_file_close(file);
+			return -1;
+		}
+		end = (apr_off_t)(rec.offset + rec.length);
+		rec.offset += *base;
+		if (revindex_write_record(idx->file, &rec) != 0) {
+			fprintf(stderr, _("ERROR: Unable to write to index file %s\n"), idx->path);
+			apr_file_close(file);
+			return -1;
+		}
+	}
+
+	apr_file_close(file);
+	*base += end;
+	return 0;
+}
+
+
+/* Writes the index header and closes the index file */
+int revindex_close(revindex_t *idx)
+{
+	unsigned char buf[REVINDEX_HEADER_SIZE];
+	apr_off_t off = 0;
+	int ret = 0;
+
+	memcpy(buf, REVINDEX_MAGIC, REVINDEX_MAGIC_LEN);
+	revindex_encode(buf + 8, REVINDEX_VERSION);
+	revindex_encode(buf + 16, idx->header_len);
+	if (apr_file_seek(idx->file, APR_SET, &off) != APR_SUCCESS
+		|| apr_file_write_full(idx->file, buf, sizeof(buf), NULL) != APR_SUCCESS) {
+		ret = -1;
+	}
+	if (apr_file_close(idx->file) != APR_SUCCESS) {
+		ret = -1;
+	}
+	if (ret != 0) {
+		fprintf(stderr, _("ERROR: Unable to write to index file %s\n"), idx->path);
+	}
+	return ret;
+}
+
+
+/* Writes the header and the given range of local revisions of an indexed dumpfile */
+int revindex_extract(const char *index_path, const char *dump_path, svn_revnum_t start, svn_revnum_t end, output_t *out, apr_pool_t *pool)
+{
+	apr_file_t *file;
+	apr_off_t header_len, offset, length;
+	apr_int64_t count, first, last;
+	revindex_record_t rec;
+
+	if (revindex_open(&file, index_path, &header_len, &count, pool) != 0) {
+		return -1;
+	}
+	if (count == 0) {
+		fprintf(stderr, _("ERROR: The index file %s is empty\n"), index_path);
+		apr_file_close(file);
+		return -1;
+	}
+
+	/* Determine the range of records using binary searches. HEAD refers to
+	   the last record, and ranges may extend past it. */
+	if (end < 0) {
+		last = count - 1;
+	} else {
+		last = revindex_find(file, count, end + 1) - 1;
+	}
+	if (start < 0) {
+		first = last;
+	} else {
+		first = revindex_find(file, count, start);
+	}
+	if (first < 0 || last < 0 || first > last) {
+		fprintf(stderr, _("ERROR: The requested revisions are not contained in %s\n"), dump_path);
+		apr_file_close(file);
+		return -1;
+	}
+
+	if (revindex_read_record_at(file, first, &rec) != 0) {
+		goto read_error;
+	}
+	offset = (apr_off_t)rec.offset;
+	if (revindex_read_record_at(file, last, &rec) != 0) {
+		goto read_error;
+	}
+	length = (apr_off_t)(rec.offset + rec.length) - offset;
+	apr_file_close(file);
+
+	DEBUG_MSG("revindex_extract: records %ld:%ld, offset %ld, length %ld\n", (long)first, (long)last, (long)offset, (long)length);
+	if ((header_len > 0 && output_file_range(out, dump_path, 0, header_len) != 0)
+		|| output_file_range(out, dump_path, offset, length) != 0) {
+		fprintf(stderr, _("ERROR: Unable to copy revisions from %s\n"), dump_path);
+		return -1;
+	}
+	return 0;
+
+read_error:
+	fprintf(stderr, _("ERROR: Unable to read from index file %s\n"), index_path);
+	apr_file_close(file);
+	return -1;
+}
@@ -0,0 +1,59 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: revindex.h
+ *      desc: Index of revision offsets in a dumpfile
+ */
+
+
+#ifndef REVINDEX_H_
+#define REVINDEX_H_
+
+
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+#include "output.h"
+
+
+/* Revision index writer (opaque) */
+typedef struct revindex_t revindex_t;
+
+
+/* Creates a new index file at the given path */
+extern revindex_t *revindex_create(const char *path, apr_pool_t *pool);
+
+/* Sets the length of the dumpfile header preceding the first revision */
+extern void revindex_set_header(revindex_t *idx, apr_off_t length);
+
+/* Adds a revision to the index. The original revision is -1 for padding revisions */
+extern int revindex_add(revindex_t *idx, svn_revnum_t local_rev, svn_revnum_t orig_rev, apr_off_t offset, apr_off_t length);
+
+/* Appends all entries of another index file, shifting their offsets by base.
+   Afterwards, base is advanced by the length of the indexed dumpfile. */
+extern int revindex_append(revindex_t *idx, const char *path, apr_off_t *base, apr_pool_t *pool);
+
+/* Writes the index header and closes the index file */
+extern int revindex_close(revindex_t *idx);
+
+/* Writes the header and the given range of local revisions of an indexed dumpfile */
+extern int revindex_extract(const char *index_path, const char *dump_path, svn_revnum_t start, svn_revnum_t end, output_t *out, apr_pool_t *pool);
+
+
+#endif
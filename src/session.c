@@ -128,6 +128,35 @@ session_t session_create()
 }
 
 
+/* Creates a new session_t object with the same settings as the given one */
+session_t session_clone(session_t *session)
+{
+	session_t clone;
+
+	clone.ra = NULL;
+	clone.encoded_url = NULL;
+	clone.root = NULL;
+	clone.prefix = NULL;
+#ifdef USE_SINGLEFILE_DUMP
+	clone.file = 0;
+#endif
+	clone.flags = (session->flags & ~SF_OBFUSCATE);
+
+	clone.pool = svn_pool_create(NULL);
+
+	clone.url = (session->url ? apr_pstrdup(clone.pool, session->url) : NULL);
+	clone.username = (session->username ? apr_pstrdup(clone.pool, session->username) : NULL);
+	clone.password = (session->password ? apr_pstrdup(clone.pool, session->password) : NULL);
+	clone.config_dir = (session->config_dir ? apr_pstrdup(clone.pool, session->config_dir) : NULL);
+
+	/* Obfuscation is left to the original session */
+	clone.obf_hash = apr_hash_make(clone.pool);
+	clone.obf_taken = apr_hash_make(clone.pool);
+
+	return clone;
+}
+
+
 /* Frees a session_t object */
 void session_free(session_t *session)
 {
@@ -62,6 +62,9 @@ typedef struct {
 /* Creates and initializes a new session_t object */
 extern session_t session_create();
 
+/* Creates a new session_t object with the same settings as the given one */
+extern session_t session_clone(session_t *session);
+
 /* Frees a session_t object */
 extern void session_free(session_t *session);
 
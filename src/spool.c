@@ -0,0 +1,755 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: spool.c
+ *      desc: Recording and replaying of delta editor drives
+ *
+ *      The spool editor writes every call it receives to a file, including
+ *      the text delta windows. The recorded drive can be replayed later on,
+ *      possibly in a different thread, by driving another editor with the
+ *      exact same sequence of calls. The file format is private to the
+ *      running process, so values are written in native byte order.
+ */
+
+
+#include <svn_delta.h>
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_tables.h>
+
+#include "main.h"
+#include "logger.h"
+
+#include "spool.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Recorded operations */
+enum spool_op {
+	SO_SET_TARGET_REVISION = 1,
+	SO_OPEN_ROOT,
+	SO_DELETE_ENTRY,
+	SO_ADD_DIRECTORY,
+	SO_OPEN_DIRECTORY,
+	SO_CHANGE_DIR_PROP,
+	SO_CLOSE_DIRECTORY,
+	SO_ABSENT_DIRECTORY,
+	SO_ADD_FILE,
+	SO_OPEN_FILE,
+	SO_APPLY_TEXTDELTA,
+	SO_TEXTDELTA_WINDOW,
+	SO_CHANGE_FILE_PROP,
+	SO_CLOSE_FILE,
+	SO_ABSENT_FILE,
+	SO_CLOSE_EDIT,
+	SO_ABORT_EDIT
+};
+
+
+/* Recording editor baton */
+typedef struct {
+	apr_file_t *file;
+	apr_int64_t next_id;
+} spool_edit_baton_t;
+
+
+/* Recording node baton */
+typedef struct {
+	spool_edit_baton_t *eb;
+	apr_int64_t id;
+} spool_node_baton_t;
+
+
+/* Replay information for a node */
+typedef struct {
+	void *baton;
+	apr_pool_t *pool;
+	svn_txdelta_window_handler_t handler;
+	void *handler_baton;
+} spool_replay_node_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Writes raw data to the spool file */
+static svn_error_t *spool_write(apr_file_t *file, const void *data, apr_size_t len)
+{
+	apr_status_t status;
+
+	if (len == 0) {
+		return SVN_NO_ERROR;
+	}
+	if ((status = apr_file_write_full(file, data, len, NULL)) != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, _("Unable to write to spool file"));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes an operation code to the spool file */
+static svn_error_t *spool_write_op(apr_file_t *file, enum spool_op op)
+{
+	unsigned char c = (unsigned char)op;
+	return spool_write(file, &c, 1);
+}
+
+
+/* Writes an integer to the spool file */
+static svn_error_t *spool_write_int(apr_file_t *file, apr_int64_t value)
+{
+	return spool_write(file, &value, sizeof(value));
+}
+
+
+/* Writes a string to the spool file. A length of -1 denotes NULL */
+static svn_error_t *spool_write_string(apr_file_t *file, const char *data, apr_int64_t len)
+{
+	SVN_ERR(spool_write_int(file, len));
+	if (len > 0) {
+		SVN_ERR(spool_write(file, data, (apr_size_t)len));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes a C string (which may be NULL) to the spool file */
+static svn_error_t *spool_write_cstring(apr_file_t *file, const char *str)
+{
+	return spool_write_string(file, str, (str != NULL ? (apr_int64_t)strlen(str) : -1));
+}
+
+
+/* Writes a Subversion string (which may be NULL) to the spool file */
+static svn_error_t *spool_write_svnstring(apr_file_t *file, const svn_string_t *str)
+{
+	if (str == NULL) {
+		return spool_write_string(file, NULL, -1);
+	}
+	return spool_write_string(file, str->data, (apr_int64_t)str->len);
+}
+
+
+/* Reads raw data from the spool file */
+static svn_error_t *spool_read(apr_file_t *file, void *data, apr_size_t len)
+{
+	apr_status_t status;
+
+	if (len == 0) {
+		return SVN_NO_ERROR;
+	}
+	status = apr_file_read_full(file, data, len, NULL);
+	if (status == APR_EOF) {
+		return svn_error_create(1, NULL, _("Unexpected end of spool file"));
+	} else if (status != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, _("Unable to read from spool file"));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads an integer from the spool file */
+static svn_error_t *spool_read_int(apr_file_t *file, apr_int64_t *value)
+{
+	return spool_read(file, value, sizeof(*value));
+}
+
+
+/* Reads a revision number from the spool file */
+static svn_error_t *spool_read_revnum(apr_file_t *file, svn_revnum_t *rev)
+{
+	apr_int64_t value;
+	SVN_ERR(spool_read_int(file, &value));
+	*rev = (svn_revnum_t)value;
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a string from the spool file. The string will be NUL-terminated */
+static svn_error_t *spool_read_string(apr_file_t *file, const char **data, apr_size_t *len, apr_pool_t *pool)
+{
+	apr_int64_t slen;
+	char *buffer;
+
+	SVN_ERR(spool_read_int(file, &slen));
+	if (slen < 0) {
+		*data = NULL;
+		if (len) {
+			*len = 0;
+		}
+		return SVN_NO_ERROR;
+	}
+
+	buffer = apr_palloc(pool, (apr_size_t)slen + 1);
+	SVN_ERR(spool_read(file, buffer, (apr_size_t)slen));
+	buffer[slen] = '\0';
+	*data = buffer;
+	if (len) {
+		*len = (apr_size_t)slen;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a Subversion string (which may be NULL) from the spool file */
+static svn_error_t *spool_read_svnstring(apr_file_t *file, svn_string_t **str, apr_pool_t *pool)
+{
+	const char *data;
+	apr_size_t len;
+
+	SVN_ERR(spool_read_string(file, &data, &len, pool));
+	if (data == NULL) {
+		*str = NULL;
+	} else {
+		*str = apr_palloc(pool, sizeof(svn_string_t));
+		(*str)->data = data;
+		(*str)->len = len;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Creates a new node baton for recording */
+static spool_node_baton_t *spool_make_node(spool_edit_baton_t *eb, apr_pool_t *pool)
+{
+	spool_node_baton_t *node = apr_palloc(pool, sizeof(spool_node_baton_t));
+	node->eb = eb;
+	node->id = eb->next_id++;
+	return node;
+}
+
+
+/* Returns the replay information for a recorded node id */
+static svn_error_t *spool_get_node(apr_array_header_t *nodes, apr_file_t *file, spool_replay_node_t **node)
+{
+	apr_int64_t id;
+
+	SVN_ERR(spool_read_int(file, &id));
+	if (id < 0 || id >= nodes->nelts || APR_ARRAY_IDX(nodes, id, spool_replay_node_t).pool == NULL) {
+		return svn_error_createf(1, NULL, _("Invalid node reference in spool file"));
+	}
+	*node = &APR_ARRAY_IDX(nodes, id, spool_replay_node_t);
+	return SVN_NO_ERROR;
+}
+
+
+/* Registers a new node for replaying */
+static svn_error_t *spool_push_node(apr_array_header_t *nodes, apr_file_t *file, apr_pool_t *parent_pool, spool_replay_node_t **node)
+{
+	apr_int64_t id;
+	spool_replay_node_t *n;
+
+	SVN_ERR(spool_read_int(file, &id));
+	if (id != nodes->nelts) {
+		return svn_error_createf(1, NULL, _("Invalid node reference in spool file"));
+	}
+	n = apr_array_push(nodes);
+	n->baton = NULL;
+	n->pool = svn_pool_create(parent_pool);
+	n->handler = NULL;
+	n->handler_baton = NULL;
+
+	/* The array may have been reallocated */
+	*node = n;
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a text delta window from the spool file */
+static svn_error_t *spool_read_window(apr_file_t *file, svn_txdelta_window_t **window, apr_pool_t *pool)
+{
+	apr_int64_t value;
+	svn_txdelta_window_t *w;
+	svn_txdelta_op_t *ops;
+	svn_string_t *new_data;
+
+	SVN_ERR(spool_read_int(file, &value));
+	if (value == 0) {
+		*window = NULL;
+		return SVN_NO_ERROR;
+	}
+
+	w = apr_palloc(pool, sizeof(svn_txdelta_window_t));
+	SVN_ERR(spool_read_int(file, &value));
+	w->sview_offset = (svn_filesize_t)value;
+	SVN_ERR(spool_read_int(file, &value));
+	w->sview_len = (apr_size_t)value;
+	SVN_ERR(spool_read_int(file, &value));
+	w->tview_len = (apr_size_t)value;
+	SVN_ERR(spool_read_int(file, &value));
+	w->num_ops = (int)value;
+	SVN_ERR(spool_read_int(file, &value));
+	w->src_ops = (int)value;
+
+	ops = apr_palloc(pool, sizeof(svn_txdelta_op_t) * (w->num_ops > 0 ? w->num_ops : 1));
+	SVN_ERR(spool_read(file, ops, sizeof(svn_txdelta_op_t) * w->num_ops));
+	w->ops = ops;
+
+	SVN_ERR(spool_read_svnstring(file, &new_data, pool));
+	w->new_data = new_data;
+
+	*window = w;
+	return SVN_NO_ERROR;
+}
+
+
+/* Text delta window handler for recording */
+static svn_error_t *spool_window_handler(svn_txdelta_window_t *window, void *baton)
+{
+	spool_node_baton_t *node = baton;
+	apr_file_t *file = node->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_TEXTDELTA_WINDOW));
+	SVN_ERR(spool_write_int(file, node->id));
+	if (window == NULL) {
+		return spool_write_int(file, 0);
+	}
+
+	SVN_ERR(spool_write_int(file, 1));
+	SVN_ERR(spool_write_int(file, window->sview_offset));
+	SVN_ERR(spool_write_int(file, window->sview_len));
+	SVN_ERR(spool_write_int(file, window->tview_len));
+	SVN_ERR(spool_write_int(file, window->num_ops));
+	SVN_ERR(spool_write_int(file, window->src_ops));
+	SVN_ERR(spool_write(file, window->ops, sizeof(svn_txdelta_op_t) * window->num_ops));
+	return spool_write_svnstring(file, window->new_data);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_set_target_revision(void *edit_baton, svn_revnum_t target_revision, apr_pool_t *pool)
+{
+	spool_edit_baton_t *eb = edit_baton;
+
+	SVN_ERR(spool_write_op(eb->file, SO_SET_TARGET_REVISION));
+	return spool_write_int(eb->file, target_revision);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_open_root(void *edit_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **root_baton)
+{
+	spool_edit_baton_t *eb = edit_baton;
+	spool_node_baton_t *node = spool_make_node(eb, dir_pool);
+
+	SVN_ERR(spool_write_op(eb->file, SO_OPEN_ROOT));
+	SVN_ERR(spool_write_int(eb->file, node->id));
+	SVN_ERR(spool_write_int(eb->file, base_revision));
+	*root_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
+{
+	spool_node_baton_t *parent = parent_baton;
+	apr_file_t *file = parent->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_DELETE_ENTRY));
+	SVN_ERR(spool_write_int(file, parent->id));
+	SVN_ERR(spool_write_cstring(file, path));
+	return spool_write_int(file, revision);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_add_directory(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	spool_node_baton_t *parent = parent_baton;
+	spool_node_baton_t *node = spool_make_node(parent->eb, dir_pool);
+	apr_file_t *file = parent->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_ADD_DIRECTORY));
+	SVN_ERR(spool_write_int(file, parent->id));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, path));
+	SVN_ERR(spool_write_cstring(file, copyfrom_path));
+	SVN_ERR(spool_write_int(file, copyfrom_revision));
+	*child_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_open_directory(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	spool_node_baton_t *parent = parent_baton;
+	spool_node_baton_t *node = spool_make_node(parent->eb, dir_pool);
+	apr_file_t *file = parent->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_OPEN_DIRECTORY));
+	SVN_ERR(spool_write_int(file, parent->id));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, path));
+	SVN_ERR(spool_write_int(file, base_revision));
+	*child_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_change_dir_prop(void *dir_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	spool_node_baton_t *node = dir_baton;
+	apr_file_t *file = node->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_CHANGE_DIR_PROP));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, name));
+	return spool_write_svnstring(file, value);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_close_directory(void *dir_baton, apr_pool_t *pool)
+{
+	spool_node_baton_t *node = dir_baton;
+
+	SVN_ERR(spool_write_op(node->eb->file, SO_CLOSE_DIRECTORY));
+	return spool_write_int(node->eb->file, node->id);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_absent_directory(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	spool_node_baton_t *parent = parent_baton;
+
+	SVN_ERR(spool_write_op(parent->eb->file, SO_ABSENT_DIRECTORY));
+	SVN_ERR(spool_write_int(parent->eb->file, parent->id));
+	return spool_write_cstring(parent->eb->file, path);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	spool_node_baton_t *parent = parent_baton;
+	spool_node_baton_t *node = spool_make_node(parent->eb, file_pool);
+	apr_file_t *file = parent->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_ADD_FILE));
+	SVN_ERR(spool_write_int(file, parent->id));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, path));
+	SVN_ERR(spool_write_cstring(file, copyfrom_path));
+	SVN_ERR(spool_write_int(file, copyfrom_revision));
+	*file_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	spool_node_baton_t *parent = parent_baton;
+	spool_node_baton_t *node = spool_make_node(parent->eb, file_pool);
+	apr_file_t *file = parent->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_OPEN_FILE));
+	SVN_ERR(spool_write_int(file, parent->id));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, path));
+	SVN_ERR(spool_write_int(file, base_revision));
+	*file_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
+{
+	spool_node_baton_t *node = file_baton;
+
+	SVN_ERR(spool_write_op(node->eb->file, SO_APPLY_TEXTDELTA));
+	SVN_ERR(spool_write_int(node->eb->file, node->id));
+	SVN_ERR(spool_write_cstring(node->eb->file, base_checksum));
+	*handler = spool_window_handler;
+	*handler_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	spool_node_baton_t *node = file_baton;
+	apr_file_t *file = node->eb->file;
+
+	SVN_ERR(spool_write_op(file, SO_CHANGE_FILE_PROP));
+	SVN_ERR(spool_write_int(file, node->id));
+	SVN_ERR(spool_write_cstring(file, name));
+	return spool_write_svnstring(file, value);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
+{
+	spool_node_baton_t *node = file_baton;
+
+	SVN_ERR(spool_write_op(node->eb->file, SO_CLOSE_FILE));
+	SVN_ERR(spool_write_int(node->eb->file, node->id));
+	return spool_write_cstring(node->eb->file, text_checksum);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_absent_file(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	spool_node_baton_t *parent = parent_baton;
+
+	SVN_ERR(spool_write_op(parent->eb->file, SO_ABSENT_FILE));
+	SVN_ERR(spool_write_int(parent->eb->file, parent->id));
+	return spool_write_cstring(parent->eb->file, path);
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_close_edit(void *edit_baton, apr_pool_t *pool)
+{
+	spool_edit_baton_t *eb = edit_baton;
+	apr_status_t status;
+
+	SVN_ERR(spool_write_op(eb->file, SO_CLOSE_EDIT));
+	if ((status = apr_file_close(eb->file)) != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, _("Unable to write to spool file"));
+	}
+	eb->file = NULL;
+	return SVN_NO_ERROR;
+}
+
+
+/* Subversion delta editor callback */
+static svn_error_t *se_abort_edit(void *edit_baton, apr_pool_t *pool)
+{
+	spool_edit_baton_t *eb = edit_baton;
+
+	if (eb->file != NULL) {
+		SVN_ERR(spool_write_op(eb->file, SO_ABORT_EDIT));
+		apr_file_close(eb->file);
+		eb->file = NULL;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Returns a delta editor that records all calls to the given file */
+svn_error_t *spool_get_editor(const char *path, const svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool)
+{
+	svn_delta_editor_t *e;
+	spool_edit_baton_t *eb;
+	apr_status_t status;
+
+	eb = apr_palloc(pool, sizeof(spool_edit_baton_t));
+	eb->next_id = 0;
+	status = apr_file_open(&eb->file, path, APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY, APR_OS_DEFAULT, pool);
+	if (status != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, _("Unable to open spool file %s"), path);
+	}
+
+	e = svn_delta_default_editor(pool);
+	e->set_target_revision = se_set_target_revision;
+	e->open_root = se_open_root;
+	e->delete_entry = se_delete_entry;
+	e->add_directory = se_add_directory;
+	e->open_directory = se_open_directory;
+	e->change_dir_prop = se_change_dir_prop;
+	e->close_directory = se_close_directory;
+	e->absent_directory = se_absent_directory;
+	e->add_file = se_add_file;
+	e->open_file = se_open_file;
+	e->apply_textdelta = se_apply_textdelta;
+	e->change_file_prop = se_change_file_prop;
+	e->close_file = se_close_file;
+	e->absent_file = se_absent_file;
+	e->close_edit = se_close_edit;
+	e->abort_edit = se_abort_edit;
+
+	*editor = e;
+	*edit_baton = eb;
+	return SVN_NO_ERROR;
+}
+
+
+/* Replays a recorded editor drive from the given file */
+svn_error_t *spool_replay(const char *path, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool)
+{
+	apr_file_t *file;
+	apr_status_t status;
+	apr_array_header_t *nodes;
+	apr_pool_t *scratch_pool;
+	char done = 0;
+
+	status = apr_file_open(&file, path, APR_READ | APR_BUFFERED | APR_BINARY, 0600, pool);
+	if (status != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, _("Unable to open spool file %s"), path);
+	}
+
+	nodes = apr_array_make(pool, 16, sizeof(spool_replay_node_t));
+	scratch_pool = svn_pool_create(pool);
+
+	while (!done) {
+		unsigned char op;
+		spool_replay_node_t *node, *parent;
+		const char *str1, *str2;
+		svn_string_t *value;
+		svn_txdelta_window_t *window;
+		svn_revnum_t rev;
+
+		svn_pool_clear(scratch_pool);
+		SVN_ERR(spool_read(file, &op, 1));
+
+		switch (op) {
+			case SO_SET_TARGET_REVISION:
+				SVN_ERR(spool_read_revnum(file, &rev));
+				SVN_ERR(editor->set_target_revision(edit_baton, rev, scratch_pool));
+				break;
+
+			case SO_OPEN_ROOT:
+				SVN_ERR(spool_push_node(nodes, file, pool, &node));
+				SVN_ERR(spool_read_revnum(file, &rev));
+				SVN_ERR(editor->open_root(edit_baton, rev, node->pool, &node->baton));
+				break;
+
+			case SO_DELETE_ENTRY:
+				SVN_ERR(spool_get_node(nodes, file, &parent));
+				SVN_ERR(spool_read_string(file, &str1, NULL, scratch_pool));
+				SVN_ERR(spool_read_revnum(file, &rev));
+				SVN_ERR(editor->delete_entry(str1, rev, parent->baton, scratch_pool));
+				break;
+
+			case SO_ADD_DIRECTORY:
+			case SO_ADD_FILE:
+				SVN_ERR(spool_get_node(nodes, file, &parent));
+				/* The parent information may move when pushing the new node */
+				{
+					void *parent_baton = parent->baton;
+					SVN_ERR(spool_push_node(nodes, file, parent->pool, &node));
+					SVN_ERR(spool_read_string(file, &str1, NULL, node->pool));
+					SVN_ERR(spool_read_string(file, &str2, NULL, node->pool));
+					SVN_ERR(spool_read_revnum(file, &rev));
+					if (op == SO_ADD_DIRECTORY) {
+						SVN_ERR(editor->add_directory(str1, parent_baton, str2, rev, node->pool, &node->baton));
+					} else {
+						SVN_ERR(editor->add_file(str1, parent_baton, str2, rev, node->pool, &node->baton));
+					}
+				}
+				break;
+
+			case SO_OPEN_DIRECTORY:
+			case SO_OPEN_FILE:
+				SVN_ERR(spool_get_node(nodes, file, &parent));
+				{
+					void *parent_baton = parent->baton;
+					SVN_ERR(spool_push_node(nodes, file, parent->pool, &node));
+					SVN_ERR(spool_read_string(file, &str1, NULL, node->pool));
+					SVN_ERR(spool_read_revnum(file, &rev));
+					if (op == SO_OPEN_DIRECTORY) {
+						SVN_ERR(editor->open_directory(str1, parent_baton, rev, node->pool, &node->baton));
+					} else {
+						SVN_ERR(editor->open_file(str1, parent_baton, rev, node->pool, &node->baton));
+					}
+				}
+				break;
+
+			case SO_CHANGE_DIR_PROP:
+			case SO_CHANGE_FILE_PROP:
+				SVN_ERR(spool_get_node(nodes, file, &node));
+				SVN_ERR(spool_read_string(file, &str1, NULL, scratch_pool));
+				SVN_ERR(spool_read_svnstring(file, &value, scratch_pool));
+				if (op == SO_CHANGE_DIR_PROP) {
+					SVN_ERR(editor->change_dir_prop(node->baton, str1, value, scratch_pool));
+				} else {
+					SVN_ERR(editor->change_file_prop(node->baton, str1, value, scratch_pool));
+				}
+				break;
+
+			case SO_CLOSE_DIRECTORY:
+				SVN_ERR(spool_get_node(nodes, file, &node));
+				SVN_ERR(editor->close_directory(node->baton, scratch_pool));
+				svn_pool_destroy(node->pool);
+				node->pool = NULL;
+				break;
+
+			case SO_ABSENT_DIRECTORY:
+			case SO_ABSENT_FILE:
+				SVN_ERR(spool_get_node(nodes, file, &parent));
+				SVN_ERR(spool_read_string(file, &str1, NULL, scratch_pool));
+				if (op == SO_ABSENT_DIRECTORY) {
+					SVN_ERR(editor->absent_directory(str1, parent->baton, scratch_pool));
+				} else {
+					SVN_ERR(editor->absent_file(str1, parent->baton, scratch_pool));
+				}
+				break;
+
+			case SO_APPLY_TEXTDELTA:
+				SVN_ERR(spool_get_node(nodes, file, &node));
+				SVN_ERR(spool_read_string(file, &str1, NULL, node->pool));
+				SVN_ERR(editor->apply_textdelta(node->baton, str1, node->pool, &node->handler, &node->handler_baton));
+				break;
+
+			case SO_TEXTDELTA_WINDOW:
+				SVN_ERR(spool_get_node(nodes, file, &node));
+				SVN_ERR(spool_read_window(file, &window, scratch_pool));
+				if (node->handler == NULL) {
+					return svn_error_createf(1, NULL, _("Invalid node reference in spool file"));
+				}
+				SVN_ERR(node->handler(window, node->handler_baton));
+				break;
+
+			case SO_CLOSE_FILE:
+				SVN_ERR(spool_get_node(nodes, file, &node));
+				SVN_ERR(spool_read_string(file, &str1, NULL, scratch_pool));
+				SVN_ERR(editor->close_file(node->baton, str1, scratch_pool));
+				svn_pool_destroy(node->pool);
+				node->pool = NULL;
+				break;
+
+			case SO_CLOSE_EDIT:
+				SVN_ERR(editor->close_edit(edit_baton, scratch_pool));
+				done = 1;
+				break;
+
+			case SO_ABORT_EDIT:
+				SVN_ERR(editor->abort_edit(edit_baton, scratch_pool));
+				done = 1;
+				break;
+
+			default:
+				return svn_error_createf(1, NULL, _("Invalid operation in spool file"));
+		}
+	}
+
+	svn_pool_destroy(scratch_pool);
+	apr_file_close(file);
+	return SVN_NO_ERROR;
+}
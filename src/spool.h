@@ -0,0 +1,40 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: spool.h
+ *      desc: Recording and replaying of delta editor drives
+ */
+
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+
+#include <svn_delta.h>
+
+#include <apr_pools.h>
+
+
+/* Returns a delta editor that records all calls to the given file */
+extern svn_error_t *spool_get_editor(const char *path, const svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool);
+
+/* Replays a recorded editor drive from the given file */
+extern svn_error_t *spool_replay(const char *path, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool);
+
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: state.c
+ *      desc: Checkpoint files for resuming interrupted dumps
+ *
+ *      A state file is a plain sequence of integers and length-prefixed
+ *      data blocks written by the individual modules. Values are stored
+ *      in native byte order, as the state is only meant to be used on the
+ *      machine that created it. New state files are written to a temporary
+ *      file first, so a crash will never leave a partially written state.
+ */
+
+
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "main.h"
+
+#include "state.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+struct state_file_t {
+	apr_file_t *file;
+	const char *path;
+	const char *tmp_path;  /* NULL if opened for reading */
+	apr_pool_t *pool;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new state file. It replaces an existing one on commit only */
+state_file_t *state_file_create(const char *path, apr_pool_t *pool)
+{
+	state_file_t *sf = apr_pcalloc(pool, sizeof(state_file_t));
+
+	sf->path = apr_pstrdup(pool, path);
+	sf->tmp_path = apr_psprintf(pool, "%s.tmp", path);
+	sf->pool = pool;
+	if (apr_file_open(&sf->file, sf->tmp_path, APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+		return NULL;
+	}
+	return sf;
+}
+
+
+/* Opens an existing state file for reading */
+state_file_t *state_file_open(const char *path, apr_pool_t *pool)
+{
+	state_file_t *sf = apr_pcalloc(pool, sizeof(state_file_t));
+
+	sf->path = apr_pstrdup(pool, path);
+	sf->pool = pool;
+	if (apr_file_open(&sf->file, path, APR_READ | APR_BUFFERED | APR_BINARY, 0600, pool) != APR_SUCCESS) {
+		return NULL;
+	}
+	return sf;
+}
+
+
+/* Atomically replaces the previous state file with a newly created one */
+int state_file_commit(state_file_t *sf)
+{
+	apr_status_t status;
+
+	status = apr_file_close(sf->file);
+	sf->file = NULL;
+	if (status != APR_SUCCESS) {
+		apr_file_remove(sf->tmp_path, sf->pool);
+		return -1;
+	}
+	if (apr_file_rename(sf->tmp_path, sf->path, sf->pool) != APR_SUCCESS) {
+		apr_file_remove(sf->tmp_path, sf->pool);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Closes a state file, discarding it if it has been created but not committed */
+void state_file_close(state_file_t *sf)
+{
+	if (sf->file == NULL) {
+		return;
+	}
+	apr_file_close(sf->file);
+	sf->file = NULL;
+	if (sf->tmp_path != NULL) {
+		apr_file_remove(sf->tmp_path, sf->pool);
+	}
+}
+
+
+/* Writes an integer */
+int state_write_int(state_file_t *sf, apr_int64_t value)
+{
+	return (apr_file_write_full(sf->file, &value, sizeof(value), NULL) == APR_SUCCESS ? 0 : -1);
+}
+
+
+/* Writes a block of data. A length of -1 denotes NULL */
+int state_write_data(state_file_t *sf, const void *data, apr_int64_t len)
+{
+	if (state_write_int(sf, len) != 0) {
+		return -1;
+	}
+	if (len > 0 && apr_file_write_full(sf->file, data, (apr_size_t)len, NULL) != APR_SUCCESS) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Writes a C string (which may be NULL) */
+int state_write_string(state_file_t *sf, const char *str)
+{
+	return state_write_data(sf, str, (str != NULL ? (apr_int64_t)strlen(str) : -1));
+}
+
+
+/* Reads an integer */
+int state_read_int(state_file_t *sf, apr_int64_t *value)
+{
+	return (apr_file_read_full(sf->file, value, sizeof(*value), NULL) == APR_SUCCESS ? 0 : -1);
+}
+
+
+/* Reads a block of data, which will be NUL-terminated */
+int state_read_data(state_file_t *sf, char **data, apr_int64_t *len, apr_pool_t *pool)
+{
+	apr_int64_t n;
+
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	if (len != NULL) {
+		*len = n;
+	}
+	if (n < 0) {
+		*data = NULL;
+		return 0;
+	}
+
+	*data = apr_palloc(pool, (apr_size_t)n + 1);
+	if (n > 0 && apr_file_read_full(sf->file, *data, (apr_size_t)n, NULL) != APR_SUCCESS) {
+		return -1;
+	}
+	(*data)[n] = '\0';
+	return 0;
+}
+
+
+/* Reads a C string (which may be NULL) */
+int state_read_string(state_file_t *sf, char **str, apr_pool_t *pool)
+{
+	return state_read_data(sf, str, NULL, pool);
+}
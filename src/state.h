@@ -0,0 +1,66 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: state.h
+ *      desc: Checkpoint files for resuming interrupted dumps
+ */
+
+
+#ifndef STATE_H_
+#define STATE_H_
+
+
+#include <apr_pools.h>
+
+
+/* State file (opaque) */
+typedef struct state_file_t state_file_t;
+
+
+/* Creates a new state file. It replaces an existing one on commit only */
+extern state_file_t *state_file_create(const char *path, apr_pool_t *pool);
+
+/* Opens an existing state file for reading */
+extern state_file_t *state_file_open(const char *path, apr_pool_t *pool);
+
+/* Atomically replaces the previous state file with a newly created one */
+extern int state_file_commit(state_file_t *sf);
+
+/* Closes a state file, discarding it if it has been created but not committed */
+extern void state_file_close(state_file_t *sf);
+
+/* Writes an integer */
+extern int state_write_int(state_file_t *sf, apr_int64_t value);
+
+/* Writes a block of data. A length of -1 denotes NULL */
+extern int state_write_data(state_file_t *sf, const void *data, apr_int64_t len);
+
+/* Writes a C string (which may be NULL) */
+extern int state_write_string(state_file_t *sf, const char *str);
+
+/* Reads an integer */
+extern int state_read_int(state_file_t *sf, apr_int64_t *value);
+
+/* Reads a block of data, which will be NUL-terminated */
+extern int state_read_data(state_file_t *sf, char **data, apr_int64_t *len, apr_pool_t *pool);
+
+/* Reads a C string (which may be NULL) */
+extern int state_read_string(state_file_t *sf, char **str, apr_pool_t *pool);
+
+
+#endif
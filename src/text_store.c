@@ -0,0 +1,830 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: text_store.c
+ *      desc: Content-addressed storage for file texts
+ *
+ *      Texts are identified by their md5-sums and appended to a small
+ *      number of large pack files, so identical texts (e.g. copies or
+ *      reverted changes) are stored only once. Texts are reference-counted
+ *      and pack files that contain mostly unreferenced data are compacted
+ *      from time to time. Small texts are kept in memory instead and only
+ *      spill to a pack file if they grow beyond the configured threshold.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_md5.h>
+#include <apr_strings.h>
+#if APR_HAS_THREADS
+	#include <apr_thread_mutex.h>
+#endif
+
+#include "main.h"
+#include "logger.h"
+#include "rhash.h"
+
+#include "text_store.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local definitions                                                         */
+/*---------------------------------------------------------------------------*/
+
+
+/* New texts are appended to the current pack file until it reaches this size */
+#define TS_PACK_SIZE ((apr_off_t)64 * 1024 * 1024)
+
+/* Compaction starts if at least this many bytes, and at least half of
+   all pack data, are no longer referenced */
+#define TS_COMPACT_MIN ((apr_off_t)16 * 1024 * 1024)
+
+/* Maximum amount of memory used for small texts */
+#define TS_MEMORY_LIMIT ((apr_size_t)256 * 1024 * 1024)
+
+/* Buffer size for moving texts during compaction */
+#define TS_BUFFER_SIZE 65536
+
+/* Returns the pack file with the given id */
+#define TS_PACK(store, id) APR_ARRAY_IDX((store)->packs, (id), ts_pack_t *)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* A pack file */
+typedef struct {
+	const char *path;
+	apr_file_t *rfile;  /* Unbuffered, for random access */
+	apr_file_t *wfile;  /* Buffered, for appending */
+	apr_off_t size;
+	apr_off_t live;     /* Size of all referenced texts */
+	char writing;
+	char compacting;
+	apr_pool_t *pool;
+} ts_pack_t;
+
+/* Location and reference count of a text */
+typedef struct {
+	int pack;          /* -1 for texts kept in memory */
+	apr_off_t offset;
+	apr_off_t size;
+	apr_int64_t refs;
+	char *data;        /* Contents of texts kept in memory */
+} ts_text_t;
+
+struct text_store_t {
+	const char *dir;
+	rhash_t *index;              /* md5-sum -> ts_text_t */
+	apr_array_header_t *packs;   /* Removed packs are NULL */
+	int current;                 /* Pack for appending, or -1 */
+	apr_off_t total;
+	apr_off_t live;
+	apr_size_t mem_threshold;
+	apr_size_t mem_used;
+	char defer_removal;
+	apr_pool_t *dead_pool;
+	apr_array_header_t *dead_packs;
+#if APR_HAS_THREADS
+	apr_thread_mutex_t *read_lock;  /* Texts may be read from other threads */
+#endif
+	apr_pool_t *pool;
+};
+
+struct text_writer_t {
+	text_store_t *store;
+	int pack;          /* -1 while writing to memory */
+	apr_off_t start;
+	apr_off_t size;
+	char *buffer;
+	apr_size_t alloc;
+};
+
+/* Baton for reading a text */
+typedef struct {
+	text_store_t *store;
+	ts_pack_t *pack;
+	const char *data;  /* Used instead of pack for texts in memory */
+	apr_off_t pos;
+	apr_off_t end;
+} ts_reader_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Opens a pack file, optionally creating a new one */
+static ts_pack_t *ts_pack_open(text_store_t *store, int id, char create)
+{
+	apr_pool_t *pool = svn_pool_create(store->pool);
+	ts_pack_t *pack = apr_pcalloc(pool, sizeof(ts_pack_t));
+	apr_int32_t flags = APR_WRITE | APR_BUFFERED | APR_BINARY;
+
+	pack->path = apr_psprintf(pool, "%s/pack-%d", store->dir, id);
+	pack->pool = pool;
+	if (create) {
+		flags |= APR_CREATE | APR_TRUNCATE;
+		if (apr_dir_make_recursive(store->dir, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+			svn_pool_destroy(pool);
+			return NULL;
+		}
+	}
+	if (apr_file_open(&pack->wfile, pack->path, flags, APR_OS_DEFAULT, pool) != APR_SUCCESS
+		|| apr_file_open(&pack->rfile, pack->path, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+		svn_pool_destroy(pool);
+		return NULL;
+	}
+	return pack;
+}
+
+
+/* Discards everything after the given size in a pack file */
+static int ts_pack_truncate(ts_pack_t *pack, apr_off_t size)
+{
+	apr_off_t off = size;
+
+	if (apr_file_flush(pack->wfile) != APR_SUCCESS
+		|| apr_file_trunc(pack->wfile, size) != APR_SUCCESS
+		|| apr_file_seek(pack->wfile, APR_SET, &off) != APR_SUCCESS) {
+		return -1;
+	}
+	pack->size = size;
+	return 0;
+}
+
+
+/* Closes and removes a pack file */
+static void ts_pack_remove(text_store_t *store, int id)
+{
+	ts_pack_t *pack = TS_PACK(store, id);
+	const char *path;
+
+	DEBUG_MSG("text_store: removing %s\n", pack->path);
+	store->total -= pack->size;
+	store->live -= pack->live;
+
+	/* Close the files first */
+	path = apr_pstrdup(store->defer_removal ? store->dead_pool : store->pool, pack->path);
+	svn_pool_destroy(pack->pool);
+	if (store->defer_removal) {
+		APR_ARRAY_PUSH(store->dead_packs, const char *) = path;
+	} else {
+		apr_file_remove(path, store->pool);
+	}
+
+	TS_PACK(store, id) = NULL;
+	if (store->current == id) {
+		store->current = -1;
+	}
+}
+
+
+/* Returns the id of a pack file that new data can be appended to */
+static int ts_writable_pack(text_store_t *store)
+{
+	ts_pack_t *pack;
+
+	if (store->current >= 0) {
+		pack = TS_PACK(store, store->current);
+		if (!pack->writing && !pack->compacting && pack->size < TS_PACK_SIZE) {
+			return store->current;
+		}
+	}
+
+	if ((pack = ts_pack_open(store, store->packs->nelts, 1)) == NULL) {
+		return -1;
+	}
+	DEBUG_MSG("text_store: created %s\n", pack->path);
+	APR_ARRAY_PUSH(store->packs, ts_pack_t *) = pack;
+	store->current = store->packs->nelts - 1;
+	return store->current;
+}
+
+
+/* Moves a text to a writable pack file */
+static int ts_move_text(text_store_t *store, ts_text_t *text, char *buffer)
+{
+	ts_pack_t *src = TS_PACK(store, text->pack), *dest;
+	apr_off_t pos = text->offset, remaining = text->size, start;
+	int id;
+
+	if ((id = ts_writable_pack(store)) < 0) {
+		return -1;
+	}
+	dest = TS_PACK(store, id);
+	start = dest->size;
+
+	if (apr_file_seek(src->rfile, APR_SET, &pos) != APR_SUCCESS) {
+		return -1;
+	}
+	while (remaining > 0) {
+		apr_size_t len = (remaining > TS_BUFFER_SIZE ? TS_BUFFER_SIZE : (apr_size_t)remaining);
+		if (apr_file_read_full(src->rfile, buffer, len, NULL) != APR_SUCCESS
+			|| apr_file_write_full(dest->wfile, buffer, len, NULL) != APR_SUCCESS) {
+			ts_pack_truncate(dest, start);
+			return -1;
+		}
+		remaining -= len;
+	}
+
+	src->live -= text->size;
+	dest->live += text->size;
+	dest->size += text->size;
+	store->total += text->size;
+	text->pack = id;
+	text->offset = start;
+	return 0;
+}
+
+
+/* Moves a text that is being written from memory to a pack file */
+static int ts_spill(text_writer_t *writer)
+{
+	ts_pack_t *pack;
+	int id;
+
+	if ((id = ts_writable_pack(writer->store)) < 0) {
+		return -1;
+	}
+	pack = TS_PACK(writer->store, id);
+	pack->writing = 1;
+	writer->pack = id;
+	writer->start = pack->size;
+
+	if (writer->size > 0 && apr_file_write_full(pack->wfile, writer->buffer, (apr_size_t)writer->size, NULL) != APR_SUCCESS) {
+		return -1;
+	}
+	free(writer->buffer);
+	writer->buffer = NULL;
+	writer->alloc = 0;
+	return 0;
+}
+
+
+/* Stream callback for writing a text */
+static svn_error_t *ts_write(void *baton, const char *data, apr_size_t *len)
+{
+	text_writer_t *writer = (text_writer_t *)baton;
+	text_store_t *store = writer->store;
+	ts_pack_t *pack;
+	apr_status_t status;
+
+	if (writer->pack < 0) {
+		apr_size_t size = (apr_size_t)writer->size + *len;
+		if (size <= store->mem_threshold && store->mem_used + size <= TS_MEMORY_LIMIT) {
+			if (size > writer->alloc) {
+				char *buffer;
+				apr_size_t alloc = (writer->alloc > 0 ? writer->alloc * 2 : 256);
+				while (alloc < size) {
+					alloc *= 2;
+				}
+				if ((buffer = realloc(writer->buffer, alloc)) == NULL) {
+					return svn_error_create(ENOMEM, NULL, "Out of memory");
+				}
+				writer->buffer = buffer;
+				writer->alloc = alloc;
+			}
+			memcpy(writer->buffer + writer->size, data, *len);
+			writer->size = size;
+			return SVN_NO_ERROR;
+		}
+
+		/* The text is too large to be kept in memory */
+		if (ts_spill(writer) != 0) {
+			return svn_error_createf(1, NULL, "Unable to write to the text store in %s", store->dir);
+		}
+	}
+
+	pack = TS_PACK(store, writer->pack);
+	status = apr_file_write_full(pack->wfile, data, *len, NULL);
+	if (status != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, "Unable to write to %s", pack->path);
+	}
+	writer->size += *len;
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback for reading a text */
+static svn_error_t *ts_read(void *baton, char *buffer, apr_size_t *len)
+{
+	ts_reader_t *reader = (ts_reader_t *)baton;
+	apr_off_t pos = reader->pos;
+	apr_status_t status;
+
+	if ((apr_off_t)*len > reader->end - reader->pos) {
+		*len = (apr_size_t)(reader->end - reader->pos);
+	}
+	if (*len == 0) {
+		return SVN_NO_ERROR;
+	}
+	if (reader->data != NULL) {
+		memcpy(buffer, reader->data + reader->pos, *len);
+		reader->pos += *len;
+		return SVN_NO_ERROR;
+	}
+
+	/* The file offset is shared among all readers */
+#if APR_HAS_THREADS
+	if (reader->store->read_lock != NULL) {
+		apr_thread_mutex_lock(reader->store->read_lock);
+	}
+#endif
+	status = apr_file_seek(reader->pack->rfile, APR_SET, &pos);
+	if (status == APR_SUCCESS) {
+		status = apr_file_read_full(reader->pack->rfile, buffer, *len, NULL);
+	}
+#if APR_HAS_THREADS
+	if (reader->store->read_lock != NULL) {
+		apr_thread_mutex_unlock(reader->store->read_lock);
+	}
+#endif
+	if (status != APR_SUCCESS) {
+		return svn_error_wrap_apr(status, "Unable to read from %s", reader->pack->path);
+	}
+	reader->pos += *len;
+	return SVN_NO_ERROR;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new text store using pack files in the given directory. Texts
+   up to mem_threshold bytes are kept in memory */
+text_store_t *text_store_create(const char *dir, apr_size_t mem_threshold, apr_pool_t *pool)
+{
+	apr_pool_t *store_pool = svn_pool_create(pool);
+	text_store_t *store = apr_pcalloc(store_pool, sizeof(text_store_t));
+
+	store->dir = apr_pstrdup(store_pool, dir);
+	store->index = rhash_make(store_pool);
+	store->packs = apr_array_make(store_pool, 0, sizeof(ts_pack_t *));
+	store->current = -1;
+	store->mem_threshold = mem_threshold;
+	store->pool = store_pool;
+#if APR_HAS_THREADS
+	if (apr_thread_mutex_create(&store->read_lock, APR_THREAD_MUTEX_DEFAULT, store_pool) != APR_SUCCESS) {
+		store->read_lock = NULL;
+	}
+#endif
+	return store;
+}
+
+
+/* Closes all pack files and frees the store. The pack files are kept */
+void text_store_destroy(text_store_t *store)
+{
+	apr_hash_index_t *hi;
+
+	for (hi = rhash_first(store->pool, store->index); hi; hi = rhash_next(hi)) {
+		ts_text_t *text;
+		rhash_this(hi, NULL, NULL, (void **)&text);
+		free(text->data);
+	}
+	rhash_clear(store->index);
+	svn_pool_destroy(store->pool);
+}
+
+
+/* Starts writing a new text. The data written to the returned stream is
+   buffered or appended to a pack file until text_store_commit() is called */
+int text_store_write(text_store_t *store, text_writer_t **writer, svn_stream_t **stream, apr_pool_t *pool)
+{
+	text_writer_t *w = apr_pcalloc(pool, sizeof(text_writer_t));
+
+	w->store = store;
+	w->pack = -1;
+	if (store->mem_threshold == 0 && ts_spill(w) != 0) {
+		return -1;
+	}
+
+	*stream = svn_stream_create(w, pool);
+	svn_stream_set_write(*stream, ts_write);
+	*writer = w;
+	return 0;
+}
+
+
+/* Finishes writing a text with the given md5-sum and adds a reference to
+   it. If the text is present already, the new copy is discarded */
+int text_store_commit(text_writer_t *writer, const unsigned char *md5sum)
+{
+	text_store_t *store = writer->store;
+	ts_pack_t *pack;
+	ts_text_t *text, ntext;
+
+	text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+	if (writer->pack < 0) {
+		if (text != NULL) {
+			text->refs++;
+		} else {
+			ntext.pack = -1;
+			ntext.offset = 0;
+			ntext.size = writer->size;
+			ntext.refs = 1;
+			ntext.data = writer->buffer;
+			writer->buffer = NULL;
+			rhash_set(store->index, md5sum, APR_MD5_DIGESTSIZE, &ntext, sizeof(ts_text_t));
+			store->mem_used += (apr_size_t)writer->size;
+		}
+		free(writer->buffer);
+		writer->buffer = NULL;
+		return 0;
+	}
+
+	pack = TS_PACK(store, writer->pack);
+	pack->writing = 0;
+	if (text != NULL) {
+		text->refs++;
+		return ts_pack_truncate(pack, writer->start);
+	}
+
+	/* Make the text visible to readers */
+	if (apr_file_flush(pack->wfile) != APR_SUCCESS) {
+		return -1;
+	}
+
+	ntext.pack = writer->pack;
+	ntext.offset = writer->start;
+	ntext.size = writer->size;
+	ntext.refs = 1;
+	ntext.data = NULL;
+	rhash_set(store->index, md5sum, APR_MD5_DIGESTSIZE, &ntext, sizeof(ts_text_t));
+
+	pack->size = writer->start + writer->size;
+	pack->live += writer->size;
+	store->total += writer->size;
+	store->live += writer->size;
+	return 0;
+}
+
+
+/* Discards a text that is being written */
+void text_store_abort(text_writer_t *writer)
+{
+	ts_pack_t *pack;
+
+	if (writer->pack < 0) {
+		free(writer->buffer);
+		writer->buffer = NULL;
+		return;
+	}
+	pack = TS_PACK(writer->store, writer->pack);
+	pack->writing = 0;
+	ts_pack_truncate(pack, writer->start);
+}
+
+
+/* Adds a reference to a text */
+int text_store_ref(text_store_t *store, const unsigned char *md5sum)
+{
+	ts_text_t *text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+
+	if (text == NULL) {
+		return -1;
+	}
+	text->refs++;
+	return 0;
+}
+
+
+/* Removes a reference to a text, freeing it if it's no longer referenced */
+int text_store_unref(text_store_t *store, const unsigned char *md5sum)
+{
+	ts_text_t *text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+	ts_pack_t *pack;
+	int id;
+
+	if (text == NULL) {
+		return -1;
+	}
+	if (--text->refs > 0) {
+		return 0;
+	}
+
+	if (text->pack < 0) {
+		store->mem_used -= (apr_size_t)text->size;
+		free(text->data);
+		rhash_set(store->index, md5sum, APR_MD5_DIGESTSIZE, NULL, 0);
+		return 0;
+	}
+
+	id = text->pack;
+	pack = TS_PACK(store, id);
+	pack->live -= text->size;
+	store->live -= text->size;
+	rhash_set(store->index, md5sum, APR_MD5_DIGESTSIZE, NULL, 0);
+
+	/* Pack files without any referenced text can be removed right away */
+	if (pack->live == 0 && !pack->writing && id != store->current) {
+		ts_pack_remove(store, id);
+	}
+	return 0;
+}
+
+
+/* Returns the size of a text, or -1 if it is not present */
+apr_off_t text_store_size(text_store_t *store, const unsigned char *md5sum)
+{
+	ts_text_t *text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+
+	return (text != NULL ? text->size : -1);
+}
+
+
+/* Returns a stream for reading a text, or NULL if it is not present. The
+   stream may be used by another thread as long as the text is referenced
+   and the store is not compacted */
+svn_stream_t *text_store_read(text_store_t *store, const unsigned char *md5sum, apr_pool_t *pool)
+{
+	ts_text_t *text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+	ts_reader_t *reader;
+	svn_stream_t *stream;
+
+	if (text == NULL) {
+		return NULL;
+	}
+
+	reader = apr_palloc(pool, sizeof(ts_reader_t));
+	reader->store = store;
+	if (text->pack < 0) {
+		reader->pack = NULL;
+		reader->data = text->data;
+	} else {
+		reader->pack = TS_PACK(store, text->pack);
+		reader->data = NULL;
+	}
+	reader->pos = text->offset;
+	reader->end = text->offset + text->size;
+
+	stream = svn_stream_create(reader, pool);
+	svn_stream_set_read(stream, ts_read);
+	return stream;
+}
+
+
+/* Writes a text to the dump output */
+int text_store_output(text_store_t *store, const unsigned char *md5sum, output_t *out)
+{
+	ts_text_t *text = rhash_get(store->index, md5sum, APR_MD5_DIGESTSIZE);
+
+	if (text == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (text->pack < 0) {
+		return output_write(out, text->data, (apr_size_t)text->size);
+	}
+	return output_file_range(out, TS_PACK(store, text->pack)->path, text->offset, text->size);
+}
+
+
+/* Moves the live texts out of mostly unreferenced pack files and removes
+   these, if enough space can be reclaimed */
+int text_store_compact(text_store_t *store)
+{
+	apr_hash_index_t *hi;
+	apr_pool_t *pool;
+	char *buffer;
+	int i, n = 0, ret = 0;
+
+	if (store->total - store->live < TS_COMPACT_MIN || (store->total - store->live) * 2 < store->total) {
+		return 0;
+	}
+
+	for (i = 0; i < store->packs->nelts; i++) {
+		ts_pack_t *pack = TS_PACK(store, i);
+		if (pack != NULL && !pack->writing && pack->live * 2 < pack->size) {
+			pack->compacting = 1;
+			++n;
+		}
+	}
+	if (n == 0) {
+		return 0;
+	}
+	DEBUG_MSG("text_store: compacting %d packs (%ld of %ld bytes live)\n", n, (long)store->live, (long)store->total);
+
+	pool = svn_pool_create(store->pool);
+	buffer = apr_palloc(pool, TS_BUFFER_SIZE);
+	for (hi = rhash_first(pool, store->index); hi && ret == 0; hi = rhash_next(hi)) {
+		ts_text_t *text;
+		rhash_this(hi, NULL, NULL, (void **)&text);
+		if (text->pack >= 0 && TS_PACK(store, text->pack)->compacting) {
+			ret = ts_move_text(store, text, buffer);
+		}
+	}
+
+	for (i = 0; i < store->packs->nelts; i++) {
+		ts_pack_t *pack = TS_PACK(store, i);
+		if (pack == NULL) {
+			continue;
+		}
+		if (pack->compacting && ret == 0) {
+			ts_pack_remove(store, i);
+		} else {
+			pack->compacting = 0;
+			if (apr_file_flush(pack->wfile) != APR_SUCCESS) {
+				ret = -1;
+			}
+		}
+	}
+	svn_pool_destroy(pool);
+	return ret;
+}
+
+
+/* Defers the removal of pack files until text_store_release_files() is called */
+void text_store_defer_removal(text_store_t *store)
+{
+	if (store->dead_pool == NULL) {
+		store->dead_pool = svn_pool_create(store->pool);
+		store->dead_packs = apr_array_make(store->dead_pool, 0, sizeof(const char *));
+	}
+	store->defer_removal = 1;
+}
+
+
+/* Removes all pack files whose removal has been deferred */
+void text_store_release_files(text_store_t *store)
+{
+	int i;
+
+	if (store->dead_packs == NULL) {
+		return;
+	}
+	for (i = 0; i < store->dead_packs->nelts; i++) {
+		const char *path = APR_ARRAY_IDX(store->dead_packs, i, const char *);
+		if (apr_file_remove(path, store->dead_pool) != APR_SUCCESS) {
+			DEBUG_MSG("text_store_release_files(): Cannot remove file %s\n", path);
+		}
+	}
+	svn_pool_clear(store->dead_pool);
+	store->dead_packs = apr_array_make(store->dead_pool, 0, sizeof(const char *));
+}
+
+
+/* Flushes all pack files and saves the index to a state file */
+int text_store_save(text_store_t *store, state_file_t *sf)
+{
+	apr_hash_index_t *hi;
+	apr_pool_t *pool;
+	int i, ret = 0;
+
+	if (state_write_int(sf, store->packs->nelts) != 0) {
+		return -1;
+	}
+	for (i = 0; i < store->packs->nelts; i++) {
+		ts_pack_t *pack = TS_PACK(store, i);
+		if (pack != NULL && apr_file_flush(pack->wfile) != APR_SUCCESS) {
+			return -1;
+		}
+		if (state_write_int(sf, (pack != NULL ? pack->size : -1)) != 0) {
+			return -1;
+		}
+	}
+
+	if (state_write_int(sf, store->current) != 0
+		|| state_write_int(sf, rhash_count(store->index)) != 0) {
+		return -1;
+	}
+	pool = svn_pool_create(store->pool);
+	for (hi = rhash_first(pool, store->index); hi && ret == 0; hi = rhash_next(hi)) {
+		const void *md5sum;
+		ts_text_t *text;
+
+		rhash_this(hi, &md5sum, NULL, (void **)&text);
+		if (state_write_data(sf, md5sum, APR_MD5_DIGESTSIZE) != 0
+			|| state_write_int(sf, text->pack) != 0
+			|| state_write_int(sf, text->offset) != 0
+			|| state_write_int(sf, text->size) != 0
+			|| state_write_int(sf, text->refs) != 0) {
+			ret = -1;
+		} else if (text->pack < 0 && state_write_data(sf, text->data, text->size) != 0) {
+			ret = -1;
+		}
+	}
+	svn_pool_destroy(pool);
+	return ret;
+}
+
+
+/* Loads the index from a state file, discarding pack data written after
+   the state has been saved */
+int text_store_load(text_store_t *store, state_file_t *sf, apr_pool_t *pool)
+{
+	apr_int64_t n, v, len;
+	apr_dir_t *dir;
+	apr_finfo_t finfo;
+	int i;
+
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		ts_pack_t *pack = NULL;
+		if (state_read_int(sf, &v) != 0) {
+			return -1;
+		}
+		if (v >= 0) {
+			if ((pack = ts_pack_open(store, i, 0)) == NULL || ts_pack_truncate(pack, (apr_off_t)v) != 0) {
+				return -1;
+			}
+			store->total += pack->size;
+		}
+		APR_ARRAY_PUSH(store->packs, ts_pack_t *) = pack;
+	}
+
+	if (state_read_int(sf, &v) != 0 || v >= n) {
+		return -1;
+	}
+	store->current = (int)v;
+	if (state_read_int(sf, &n) != 0) {
+		return -1;
+	}
+	while (n-- > 0) {
+		char *md5sum;
+		ts_text_t text;
+		if (state_read_data(sf, &md5sum, &len, pool) != 0 || len != APR_MD5_DIGESTSIZE
+			|| state_read_int(sf, &v) != 0 || v < -1 || v >= store->packs->nelts || (v >= 0 && TS_PACK(store, v) == NULL)) {
+			return -1;
+		}
+		text.pack = (int)v;
+		if (state_read_int(sf, &v) != 0) {
+			return -1;
+		}
+		text.offset = (apr_off_t)v;
+		if (state_read_int(sf, &v) != 0) {
+			return -1;
+		}
+		text.size = (apr_off_t)v;
+		if (state_read_int(sf, &text.refs) != 0) {
+			return -1;
+		}
+		text.data = NULL;
+		if (text.pack < 0) {
+			char *data;
+			if (state_read_data(sf, &data, &len, pool) != 0 || len != text.size) {
+				return -1;
+			}
+			if (len > 0) {
+				if ((text.data = malloc((apr_size_t)len)) == NULL) {
+					return -1;
+				}
+				memcpy(text.data, data, (apr_size_t)len);
+			}
+			store->mem_used += (apr_size_t)len;
+		} else {
+			TS_PACK(store, text.pack)->live += text.size;
+			store->live += text.size;
+		}
+		rhash_set(store->index, md5sum, APR_MD5_DIGESTSIZE, &text, sizeof(ts_text_t));
+	}
+
+	/* Remove pack files that have been created after the checkpoint */
+	if (apr_dir_open(&dir, store->dir, pool) != APR_SUCCESS) {
+		return 0;
+	}
+	while (apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir) == APR_SUCCESS) {
+		if (finfo.filetype != APR_REG) {
+			continue;
+		}
+		if (!strncmp(finfo.name, "pack-", 5)) {
+			i = atoi(finfo.name + 5);
+			if (i >= 0 && i < store->packs->nelts && TS_PACK(store, i) != NULL) {
+				continue;
+			}
+		}
+		DEBUG_MSG("text_store_load(): Removing stale file %s\n", finfo.name);
+		apr_file_remove(apr_psprintf(pool, "%s/%s", store->dir, finfo.name), pool);
+	}
+	apr_dir_close(dir);
+	return 0;
+}
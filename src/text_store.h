@@ -0,0 +1,96 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2012 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: text_store.h
+ *      desc: Content-addressed storage for file texts
+ */
+
+
+#ifndef TEXT_STORE_H_
+#define TEXT_STORE_H_
+
+
+#include <svn_io.h>
+
+#include <apr_pools.h>
+
+#include "output.h"
+#include "state.h"
+
+
+/* Text store (opaque) */
+typedef struct text_store_t text_store_t;
+
+/* A text that is being written (opaque) */
+typedef struct text_writer_t text_writer_t;
+
+
+/* Creates a new text store using pack files in the given directory. Texts
+   up to mem_threshold bytes are kept in memory */
+extern text_store_t *text_store_create(const char *dir, apr_size_t mem_threshold, apr_pool_t *pool);
+
+/* Closes all pack files and frees the store. The pack files are kept */
+extern void text_store_destroy(text_store_t *store);
+
+/* Starts writing a new text. The data written to the returned stream is
+   buffered or appended to a pack file until text_store_commit() is called */
+extern int text_store_write(text_store_t *store, text_writer_t **writer, svn_stream_t **stream, apr_pool_t *pool);
+
+/* Finishes writing a text with the given md5-sum and adds a reference to
+   it. If the text is present already, the new copy is discarded */
+extern int text_store_commit(text_writer_t *writer, const unsigned char *md5sum);
+
+/* Discards a text that is being written */
+extern void text_store_abort(text_writer_t *writer);
+
+/* Adds a reference to a text */
+extern int text_store_ref(text_store_t *store, const unsigned char *md5sum);
+
+/* Removes a reference to a text, freeing it if it's no longer referenced */
+extern int text_store_unref(text_store_t *store, const unsigned char *md5sum);
+
+/* Returns the size of a text, or -1 if it is not present */
+extern apr_off_t text_store_size(text_store_t *store, const unsigned char *md5sum);
+
+/* Returns a stream for reading a text, or NULL if it is not present. The
+   stream may be used by another thread as long as the text is referenced
+   and the store is not compacted */
+extern svn_stream_t *text_store_read(text_store_t *store, const unsigned char *md5sum, apr_pool_t *pool);
+
+/* Writes a text to the dump output */
+extern int text_store_output(text_store_t *store, const unsigned char *md5sum, output_t *out);
+
+/* Moves the live texts out of mostly unreferenced pack files and removes
+   these, if enough space can be reclaimed */
+extern int text_store_compact(text_store_t *store);
+
+/* Defers the removal of pack files until text_store_release_files() is called */
+extern void text_store_defer_removal(text_store_t *store);
+
+/* Removes all pack files whose removal has been deferred */
+extern void text_store_release_files(text_store_t *store);
+
+/* Flushes all pack files and saves the index to a state file */
+extern int text_store_save(text_store_t *store, state_file_t *sf);
+
+/* Loads the index from a state file, discarding pack data written after
+   the state has been saved */
+extern int text_store_load(text_store_t *store, state_file_t *sf, apr_pool_t *pool);
+
+
+#endif
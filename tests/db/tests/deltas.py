@@ -0,0 +1,73 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Delta dump test"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		for i in range(0, 200):
+			print >>f, "hello"+str(i)
+		f = open("dir1/file2","wb")
+		print >>f, "hello1"
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		# Changed files are dumped using the svndiff from the server
+		f = open("dir1/file1","wb")
+		for i in range(0, 200):
+			if i % 7 != 0:
+				print >>f, "hello"+str(i)
+		print >>f, "world"
+		f = open("dir1/file2","ab")
+		print >>f, "hello2"
+		return True
+	elif step == 2:
+		# Copied and modified files are deltified locally
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/file1","ab")
+		print >>f, "hello3"
+		return True
+	elif step == 3:
+		# Replaced files have a different base in the dump
+		test_api.run("svn", "rm", "dir1/file2", output = log)
+		test_api.run("svn", "cp", "dir2/file1", "dir1/file2", output = log)
+		f = open("dir1/file2","ab")
+		print >>f, "hello4"
+		f = open("dir1/file3","wb")
+		print >>f, "hello5"
+		test_api.run("svn", "add", "dir1/file3", output = log)
+		return True
+	elif step == 4:
+		f = open("dir1/file3","wb")
+		print >>f, "hello6"
+		f = open("dir2/file2","wb")
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	if not "--deltas" in args:
+		args = args + ["--deltas"]
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+
+	return test_api.diff(id, odump_path, vdump_path)
@@ -0,0 +1,101 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Revision index and extraction test"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file2","wb")
+		print >>f, "hello2"
+		test_api.run("svn", "add", "dir1/file2", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	elif step == 3:
+		f = open("dir2/file1","ab")
+		print >>f, "hello3"
+		return True
+	elif step == 4:
+		test_api.run("svn", "rm", "dir1/file2", output = log)
+		return True
+	elif step == 5:
+		f = open("dir1/file1","ab")
+		print >>f, "hello4"
+		return True
+	else:
+		return False
+
+
+# Writes the header and the given revisions of a dumpfile to a new file
+def slice(id, dump_path, revs):
+	parts = [[]]
+	for line in open(dump_path, "rb"):
+		if line.startswith("Revision-number: "):
+			parts.append([])
+		parts[-1].append(line)
+
+	path = test_api.mktemp(id)
+	o = open(path, "wb")
+	o.writelines(parts[0])
+	for rev in revs:
+		o.writelines(parts[rev+1])
+	o.close()
+	return path
+
+
+# Extracts revisions from a dumpfile and compares them to the expected ones
+def check_extract(id, args, dump_path, index_path, revrange, revs):
+	rdump_path = test_api.dump_rsvndump(id, args + ["--index-file", index_path, "--extract", dump_path, "--revision", revrange])
+	edump_path = test_api.mktemp(id)
+	shutil.move(rdump_path, edump_path)
+	return test_api.diff(id, slice(id, dump_path, revs), edump_path)
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	# Dump the repository, once serially and once in parallel
+	index_path = test_api.mktemp(id)
+	rdump_path = test_api.dump_rsvndump(id, args + ["--index-file", index_path])
+	dump_path = test_api.mktemp(id)
+	shutil.move(rdump_path, dump_path)
+
+	jindex_path = test_api.mktemp(id)
+	rdump_path = test_api.dump_rsvndump(id, args + ["--jobs", "3", "--index-file", jindex_path])
+	jdump_path = test_api.mktemp(id)
+	shutil.move(rdump_path, jdump_path)
+
+	nrevs = len([l for l in open(dump_path, "rb") if l.startswith("Revision-number: ")])
+
+	# Ranges within the dump, past its end and of its last revision
+	for (d, i) in [(dump_path, index_path), (jdump_path, jindex_path)]:
+		if not check_extract(id, args, d, i, "2:4", range(2, 5)):
+			return False
+		if not check_extract(id, args, d, i, "3:100", range(3, nrevs)):
+			return False
+		if not check_extract(id, args, d, i, "HEAD", [nrevs-1]):
+			return False
+
+	# The full dump must still be valid
+	odump_path = test_api.dump_original(id)
+	vdump_path = test_api.dump_reload(id, dump_path)
+	return test_api.diff(id, odump_path, vdump_path)
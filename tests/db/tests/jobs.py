@@ -0,0 +1,72 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Parallel dump test"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		print >>f, "hello2"
+		f = open("dir1/file2","wb")
+		print >>f, "hello3"
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file2","ab")
+		print >>f, "hello4"
+		test_api.run("svn", "propset", "eol-style", "LF", "dir1/file1", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	elif step == 3:
+		f = open("dir2/file1","ab")
+		print >>f, "hello5"
+		test_api.run("svn", "rm", "dir1/file2", output = log)
+		return True
+	elif step == 4:
+		os.mkdir("dir3")
+		f = open("dir3/file1","wb")
+		print >>f, "hello6"
+		test_api.run("svn", "add", "dir3", output = log)
+		return True
+	elif step == 5:
+		test_api.run("svn", "cp", "dir2/file2", "dir3/file2", output = log)
+		f = open("dir1/file1","ab")
+		print >>f, "hello7"
+		return True
+	elif step == 6:
+		test_api.run("svn", "rm", "dir2", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	# The shards of a parallel dump must add up to the serial dump
+	rdump_path = test_api.dump_rsvndump(id, args + ["--jobs", "1"])
+	shutil.move(rdump_path, rdump_path+".serial")
+	rdump_path = test_api.dump_rsvndump(id, args + ["--jobs", "3"])
+	if not test_api.diff(id, rdump_path+".serial", rdump_path):
+		return False
+
+	odump_path = test_api.dump_original(id)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+
+	return test_api.diff(id, odump_path, vdump_path)
@@ -0,0 +1,75 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Replay engine test"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		os.mkdir("dir1/sdir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		print >>f, "hello2"
+		f = open("dir1/sdir1/file1","wb")
+		print >>f, "hello3"
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		print >>f, "hello4"
+		test_api.run("svn", "propset", "eol-style", "LF", "dir1/sdir1/file1", output = log)
+		return True
+	elif step == 2:
+		f = open("dir1/file2","wb")
+		print >>f, "hello5"
+		test_api.run("svn", "add", "dir1/file2", output = log)
+		return True
+	elif step == 3:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	elif step == 4:
+		f = open("dir2/sdir1/file1","ab")
+		print >>f, "hello6"
+		test_api.run("svn", "propdel", "eol-style", "dir2/sdir1/file1", output = log)
+		return True
+	elif step == 5:
+		test_api.run("svn", "rm", "dir1/sdir1", output = log)
+		f = open("dir2/file2","wb")
+		print >>f, "hello7"
+		return True
+	elif step == 6:
+		f = open("dir1/file1","wb")
+		print >>f, "hello8"
+		f = open("dir2/file1","ab")
+		print >>f, "hello9"
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	# Replayed revisions must be dumped the same way as diffed ones
+	rdump_path = test_api.dump_rsvndump(id, args)
+	shutil.move(rdump_path, rdump_path+".diff")
+	rdump_path = test_api.dump_rsvndump(id, args + ["--replay"])
+	if not test_api.diff(id, rdump_path+".diff", rdump_path):
+		return False
+
+	odump_path = test_api.dump_original(id)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+
+	return test_api.diff(id, odump_path, vdump_path)
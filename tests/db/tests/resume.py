@@ -0,0 +1,82 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Resumed dump test"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		f = open("dir1/file2","wb")
+		print >>f, "hello2"
+		test_api.run("svn", "add", "dir1", output = log)
+		test_api.run("svn", "propset", "eol-style", "LF", "dir1/file1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file2","ab")
+		print >>f, "hello3"
+		return True
+	elif step == 2:
+		os.mkdir("dir1/sdir1")
+		f = open("dir1/sdir1/file1","wb")
+		print >>f, "hello4"
+		test_api.run("svn", "add", "dir1/sdir1", output = log)
+		return True
+	elif step == 3:
+		# Copies from before the checkpoint
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/file2","ab")
+		print >>f, "hello5"
+		return True
+	elif step == 4:
+		f = open("dir1/file1","ab")
+		print >>f, "hello6"
+		test_api.run("svn", "rm", "dir2/sdir1", output = log)
+		return True
+	elif step == 5:
+		test_api.run("svn", "cp", "dir1/sdir1", "dir2/sdir2", output = log)
+		test_api.run("svn", "propdel", "eol-style", "dir2/file1", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	rdump_path = test_api.dump_rsvndump(id, args)
+	shutil.move(rdump_path, rdump_path+".orig")
+
+	# Dump the first revisions only and simulate an interruption after
+	# the checkpoint, which must be discarded when resuming
+	state_dir = test_api.mktemp(id)
+	rdump_path = test_api.dump_rsvndump(id, args + ["--state-dir", state_dir, "--revision", "0:3"])
+	f = open(rdump_path, "ab")
+	f.write("Revision-number: 4\nProp-content-length: 1")
+	f.close()
+
+	rdump_path = test_api.dump_rsvndump(id, args + ["--state-dir", state_dir])
+	if not test_api.diff(id, rdump_path+".orig", rdump_path):
+		return False
+
+	# Running again must not dump anything
+	rdump_path = test_api.dump_rsvndump(id, args + ["--state-dir", state_dir])
+	if not test_api.diff(id, rdump_path+".orig", rdump_path):
+		return False
+
+	odump_path = test_api.dump_original(id)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	return test_api.diff(id, odump_path, vdump_path)